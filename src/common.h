@@ -49,7 +49,7 @@
 #endif /* GITVERSION */
 
 /** XML-RPC API version in integer representation. */
-#define FLOWGRIND_API_VERSION 3
+#define FLOWGRIND_API_VERSION 6
 
 /** Daemon's default listen port. */
 #define DEFAULT_LISTEN_PORT 5999
@@ -57,12 +57,20 @@
 /** Maximal number of parallel flows supported by one controller. */
 #define MAX_FLOWS_CONTROLLER 2048
 
+#ifdef HAVE_EPOLL
+/** Maximal number of parallel flows supported by one daemon instance.
+  * With epoll the daemon is not bound to FD_SETSIZE. The actual limit is
+  * given by the maximal number of open files (RLIMIT_NOFILE).
+  */
+#define MAX_FLOWS_DAEMON 65536
+#else /* HAVE_EPOLL */
 /** Maximal number of parallel flows supported by one daemon instance.
   * This is currenty limited by the file descriptor number which can
   * be added to an fd_set. As we currently may need up to two FDs per
   * destination, we limit this to half of FD_SETSIZE.
   */
 #define MAX_FLOWS_DAEMON FD_SETSIZE >> 1
+#endif /* HAVE_EPOLL */
 
 /** Max number of arbitrary extra socket options which may sent to the deamon. */
 #define MAX_EXTRA_SOCKET_OPTIONS 10
@@ -75,6 +83,20 @@
 #define TCP_CA_NAME_MAX 16
 #endif /* TCP_CA_NAME_MAX */
 
+/** Flush the blocks sent with MSG_MORE at the end of each burst (option
+ * --msg-more). */
+#define MSG_MORE_BURST -1
+
+/** Set SO_RCVLOWAT to the size of the received blocks (option --rcvlowat). */
+#define RCVLOWAT_BLOCK -1
+
+/** Maximal number of connections of a single flow (option --connections). */
+#define MAX_CONNECTIONS (1 << 20)
+
+/** Length of the hello a source sends to a shared listener of the
+ * destination daemon (option --shared-listener). */
+#define HELLO_SIZE 32
+
 /** Minium block (message) size we can send. */
 #define MIN_BLOCK_SIZE (signed) sizeof (struct block)
 
@@ -126,6 +148,31 @@ enum extra_socket_option_level {
 	level_ipproto_udp,
 };
 
+/** Connect/request/response (CRR) modes of a flow (option --crr). */
+enum crr_mode {
+	/** All blocks are sent over one connection. */
+	CRR_NONE = 0,
+	/** A new connection is opened for every request block. */
+	CRR_PLAIN,
+	/** Like #CRR_PLAIN, the request is sent with TCP Fast Open. */
+	CRR_FASTOPEN,
+};
+
+/** Stages of a request block on its way out, measured by transmit
+ * timestamps (option --tx-timestamps). */
+enum tx_stage {
+	/** From the send call until the packet scheduler, i.e. the time in
+	 * the send buffer of the socket. */
+	TX_SNDBUF = 0,
+	/** From the packet scheduler until the network device, i.e. the
+	 * time in the queueing discipline. */
+	TX_QDISC,
+	/** From the network device until the block is acknowledged. */
+	TX_ACK,
+	/** Number of transmit stages. */
+	TX_STAGES,
+};
+
 /** Stochastic distributions for traffic generation. */
 enum distribution_t {
 	/** No stochastic distribution. */
@@ -158,8 +205,9 @@ struct block {
 
 	/** Sending timestap for calculating delay and RTT. */
 	struct timespec data;
-	/** Used to access 64bit timespec on 32bit arch. */
-	struct timespec data2;
+	/** Point in time the block was due to be sent by the schedule of the
+	 * flow, echoed like #data. Equals #data if the flow is not paced. */
+	struct timespec scheduled;
 };
 
 /** Options for stochastic traffic generation. */
@@ -245,6 +293,61 @@ struct flow_settings {
 	/** Set IP_MTU_DISCOVER on test socket (option -O). */
 	int ipmtudiscover;
 
+	/** Handle flow by the daemon worker bound to this CPU core, -1 for
+	 * any worker (option --cpu). */
+	int cpu;
+
+	/** Send without copying the payload into the kernel, using
+	 * MSG_ZEROCOPY (option -O). */
+	int zerocopy;
+	/** Map received data instead of copying it, using
+	 * TCP_ZEROCOPY_RECEIVE (option -O). */
+	int zerocopy_receive;
+	/** Take the arrival time of received blocks from kernel receive
+	 * timestamps, using SO_TIMESTAMPING (option -O). */
+	int timestamping;
+	/** Share of the request blocks sampled for transmit timestamps, 0
+	 * for none (option --tx-timestamps). */
+	double tx_timestamps;
+	/** Drop the payload of received blocks after reading their header,
+	 * using MSG_TRUNC (option --discard). */
+	int discard;
+	/** Send the payload of the write blocks from this file using
+	 * sendfile(), empty to send it from memory (option --payload-file). */
+	char payload_file[1000];
+	/** Send the write blocks with MSG_MORE and flush them every that many
+	 * blocks, #MSG_MORE_BURST to flush at the end of each burst, 0 to
+	 * send each block right away (option --msg-more). */
+	int msg_more;
+	/** Amount of unsent data in bytes the socket is considered writable
+	 * below, 0 to keep the default (option --notsent-lowat). */
+	int notsent_lowat;
+	/** Amount of received data in bytes the socket is considered readable
+	 * from, 0 to keep the default (option --rcvlowat). The controller
+	 * resolves #RCVLOWAT_BLOCK before passing it to the daemon. */
+	int rcvlowat;
+	/** Amount of data a pushy flow may move per direction before
+	 * yielding to the other flows of the daemon worker, 0 for no limit
+	 * (option --budget). */
+	int budget;
+	/** The budget is counted in blocks instead of bytes (option
+	 * --budget). */
+	int budget_blocks;
+	/** Maximum number of request blocks awaiting their response, 0 for
+	 * no limit (option --pipeline). A new request block is only sent
+	 * once fewer are outstanding. */
+	int pipeline;
+	/** Open a new connection per request block, one of #crr_mode
+	 * (option --crr). */
+	int crr;
+	/** Number of connections the flow is made of, 0 or 1 for a single
+	 * connection (option --connections). */
+	int connections;
+	/** The destination accepts the data connection on the listen socket
+	 * its daemon shares among destination flows (option
+	 * --shared-listener). */
+	int shared_listener;
+
 	/** Stochastic traffic generation settings for the request size. */
 	struct trafgen_options request_trafgen_options;
 	/** Stochastic traffic generation settings for the response size. */
@@ -289,7 +392,10 @@ struct report {
 	enum endpoint_t endpoint;
 	/** Report type - either INTERVAL or FINAL report */
 	enum report_t type;
+	/** Begin of the reported period. Taken from the monotonic clock of
+	 * the daemon, only the differences between them are meaningful */
 	struct timespec begin;
+	/** End of the reported period. */
 	struct timespec end;
 #ifdef HAVE_UNSIGNED_LONG_LONG_INT
 	unsigned long long bytes_read;
@@ -297,6 +403,13 @@ struct report {
 #else /* HAVE_UNSIGNED_LONG_LONG_INT */
 	long bytes_read;
 	long bytes_written;
+#endif /* HAVE_UNSIGNED_LONG_LONG_INT */
+	/** Received payload bytes dropped without copying them
+	 * (option --discard). */
+#ifdef HAVE_UNSIGNED_LONG_LONG_INT
+	unsigned long long bytes_discarded;
+#else /* HAVE_UNSIGNED_LONG_LONG_INT */
+	long bytes_discarded;
 #endif /* HAVE_UNSIGNED_LONG_LONG_INT */
 	unsigned request_blocks_read;
 	unsigned request_blocks_written;
@@ -305,6 +418,9 @@ struct report {
 
 	/* TODO Create an array for IAT / RTT and delay */
 
+	/** Number of inter-arrival times taken, one per receive call that
+	 * completed request blocks. */
+	unsigned iat_samples;
 	/** Minimum inter-arrival time. */
 	double iat_min;
 	/** Maximum inter-arrival time. */
@@ -323,6 +439,51 @@ struct report {
 	double rtt_max;
 	/** Accumulated round-trip time. */
 	double rtt_sum;
+	/** Maximum one-way delay from the scheduled send time. */
+	double sched_delay_max;
+	/** Accumulated one-way delay from the scheduled send time. */
+	double sched_delay_sum;
+	/** Maximum round-trip time from the scheduled send time. */
+	double sched_rtt_max;
+	/** Accumulated round-trip time from the scheduled send time. */
+	double sched_rtt_sum;
+	/** Number of request blocks with a kernel receive timestamp. */
+	unsigned kernel_blocks;
+	/** Number of interarrival times taken by the kernel receive
+	 * timestamps. */
+	unsigned kernel_iat_samples;
+	/** Minimum interarrival time by the kernel receive timestamps. */
+	double kernel_iat_min;
+	/** Maximum interarrival time by the kernel receive timestamps. */
+	double kernel_iat_max;
+	/** Accumulated interarrival time by the kernel receive timestamps. */
+	double kernel_iat_sum;
+	/** Minimum one-way delay by the kernel receive timestamps. */
+	double kernel_delay_min;
+	/** Maximum one-way delay by the kernel receive timestamps. */
+	double kernel_delay_max;
+	/** Accumulated one-way delay by the kernel receive timestamps. */
+	double kernel_delay_sum;
+	/** Offset of the clock of the destination daemon to the one of the
+	 * source daemon, in seconds. The one-way delays are corrected by
+	 * it. */
+	double clock_offset;
+	/** Error bound of @p clock_offset in seconds, 0 if the one-way delays
+	 * are not corrected. */
+	double clock_error;
+	/** Time the flow started after the start it was armed for, in
+	 * seconds. 0 if it was not armed. */
+	double start_error;
+	/** Number of sampled request blocks that passed each transmit
+	 * stage. */
+	unsigned tx_samples[TX_STAGES];
+	/** Minimum time a sampled block spent in each transmit stage. */
+	double tx_min[TX_STAGES];
+	/** Maximum time a sampled block spent in each transmit stage. */
+	double tx_max[TX_STAGES];
+	/** Accumulated time the sampled blocks spent in each transmit
+	 * stage. */
+	double tx_sum[TX_STAGES];
 
 	/* on the Daemon this is filled from the os specific
 	 * tcp_info struct */
@@ -333,6 +494,34 @@ struct report {
 	/** Interface MTU */
 	unsigned imtu;
 
+	/** Number of sends of a zerocopy flow. */
+	unsigned zerocopy_sends;
+	/** Number of sends of a zerocopy flow that were copied nevertheless. */
+	unsigned zerocopy_copied;
+	/** Number of times the daemon handled events on the data socket. */
+	unsigned wakeups;
+	/** Number of times a pushy flow used up its budget and yielded. */
+	unsigned budget_exhausted;
+	/** Number of response blocks queued but not yet sent. */
+	unsigned response_blocks_pending;
+
+	/** Number of connections established, CRR flows only. */
+	unsigned connects;
+	/** Number of connects that failed for lack of a local port. */
+	unsigned connect_failures;
+	/** Minimum time from connect() until the connection is usable. */
+	double connect_time_min;
+	/** Maximum time from connect() until the connection is usable. */
+	double connect_time_max;
+	/** Accumulated time from connect() until the connection is usable. */
+	double connect_time_sum;
+	/** Number of TCP sockets in TIME_WAIT on the host of the daemon, -1
+	 * if unknown. Only sampled for CRR flows. */
+	int time_wait;
+	/** Number of connections established by a flow with many
+	 * connections. */
+	unsigned connections;
+
 	int status;
 
 	struct report* next;
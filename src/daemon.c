@@ -43,6 +43,7 @@
 #include <sys/socket.h>
 #include <sys/param.h>
 #include <sys/select.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
@@ -57,14 +58,36 @@
 #include <float.h>
 #include <uuid/uuid.h>
 
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif /* HAVE_EPOLL */
+
+#ifdef HAVE_LIBURING
+#include <poll.h>
+#endif /* HAVE_LIBURING */
+
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#endif /* HAVE_SENDFILE */
+
+#ifdef HAVE_SO_TIMESTAMPING
+#include <linux/errqueue.h>
+#endif /* HAVE_SO_TIMESTAMPING */
+
 #include "common.h"
 #include "debug.h"
 #include "fg_error.h"
+#include "fg_affinity.h"
 #include "fg_math.h"
 #include "fg_definitions.h"
 #include "fg_socket.h"
 #include "fg_time.h"
 #include "fg_log.h"
+#include "fg_zerocopy.h"
+#include "fg_connections.h"
+#include "fg_listener.h"
+#include "fg_txstamp.h"
 #include "daemon.h"
 #include "source.h"
 #include "destination.h"
@@ -84,35 +107,105 @@
 
 #define CONGESTION_LIMIT 10000
 
-int daemon_pipe[2];
+/** Size of the control messages taken by a receive call, fits the receive
+ * timestamps and the TCP_INQ hint. */
+#define RECV_CONTROL_SIZE (CMSG_SPACE(3 * sizeof(struct timespec)) + \
+			   CMSG_SPACE(sizeof(int)))
 
-pthread_t daemon_thread;
-char *dump_prefix;
-char *dump_dir;
+/** Initial number of response blocks a flow can queue. */
+#define RESPONSE_QUEUE_SIZE 16
+
+/** Time a CRR flow waits for a local port after a connect failed for lack
+ * of one, in seconds. */
+#define CRR_RETRY_DELAY 0.001
+
+/** Initial number of buckets of the flow index of a worker. */
+#define FLOW_INDEX_INITIAL_SIZE 64
 
-pthread_mutex_t mutex;
-struct request *requests = 0, *requests_last = 0;
+/** Size of the buffer a worker receives the data stream of a flow into. */
+#define RECV_BUFFER_SIZE (1 << 16)
 
-fd_set rfds, wfds, efds;
-int maxfd;
+#ifdef HAVE_EPOLL
+/** Maximum number of events fetched by a single epoll_wait() call. */
+#define MAX_EPOLL_EVENTS 1024
+#endif /* HAVE_EPOLL */
 
-struct report* reports = 0;
-struct report* reports_last = 0;
-unsigned pending_reports = 0;
+#ifdef HAVE_LIBURING
+/** Number of submission queue entries of the io_uring of a worker. */
+#define URING_ENTRIES 4096
+/** Number of completion queue entries of the io_uring of a worker. */
+#define URING_CQ_ENTRIES (4 * URING_ENTRIES)
 
-struct linked_list flows;
+/**
+ * Types of io_uring operations of a flow.
+ *
+ * The type is stored in the low bits of the user data of an operation, the
+ * remaining bits hold the pointer to the flow.
+ */
+enum uring_op {
+	/** Receive the next part of the read block. */
+	URING_RECV = 1 << 0,
+	/** Send the next part of the write block. */
+	URING_SEND = 1 << 1,
+	/** Wait for a connection on the listen socket. */
+	URING_POLL = 1 << 2,
+};
+
+/** Mask of the operation type in the user data of an operation. */
+#define URING_OP_MASK (URING_RECV | URING_SEND | URING_POLL)
+#endif /* HAVE_LIBURING */
+
+char *dump_prefix;
+char *dump_dir;
 
-char started = 0;
+struct worker *workers = NULL;
+unsigned num_workers = 0;
+enum placement_policy placement_policy = PLACEMENT_ROUND_ROBIN;
+#ifdef HAVE_LIBURING
+bool use_io_uring = false;
+bool use_registered_buffers = false;
+#endif /* HAVE_LIBURING */
+
+/** Serializes the requests dispatched to the workers. */
+static pthread_mutex_t dispatch_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Payload shared by the flows sending blocks of the same pattern. */
+struct shared_payload {
+	char *data;
+	int size;
+};
+/** Shared payloads without and with byte counting. */
+static struct shared_payload shared_payloads[2];
+/** Protects the shared payloads. */
+static pthread_mutex_t shared_payload_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* Forward declarations */
+static int send_hello(struct flow *flow);
 static int write_data(struct flow *flow);
 static int read_data(struct flow *flow);
 static void process_rtt(struct flow* flow);
 static void process_iat(struct flow* flow);
 static void process_delay(struct flow* flow);
+static void process_rx_timestamp(struct flow *flow);
 static void report_flow(struct flow* flow, int type);
+static void finish_flow(struct flow *flow);
 static void send_response(struct flow* flow,
 			  int requested_response_block_size);
+static void prepare_write_block(struct flow *flow);
+static int block_iov(const char *header, const char *payload,
+		     unsigned offset, unsigned size, struct iovec *iov);
+static int send_queued_responses(struct flow *flow);
+static int account_write(struct flow *flow, int bytes);
+static int account_read(struct flow *flow, int bytes);
+static int parse_block_header(struct flow *flow);
+static void finish_read_block(struct flow *flow,
+			      int requested_response_block_size);
+static void abort_flow(struct flow *flow);
+#ifdef HAVE_LIBURING
+static bool uring_cancel_flow(struct flow *flow);
+static void uring_arm_flow(struct flow *flow, bool want_read,
+			   bool want_write);
+#endif /* HAVE_LIBURING */
 int get_tcp_info(struct flow *flow, struct fg_tcp_info *info);
 
 
@@ -154,21 +247,215 @@ static inline int flow_sending(struct timespec *now, struct flow *flow,
 {
 	return !flow_in_delay(now, flow, direction) &&
 		(flow->settings.duration[direction] < 0 ||
-		 time_diff_now(&flow->stop_timestamp[direction]) < 0.0);
+		 time_is_after(&flow->stop_timestamp[direction], now));
+}
+
+/* Number of request blocks that may await their response, 0 for no limit */
+static inline unsigned pipeline_depth(const struct flow *flow)
+{
+	/* A CRR connection carries a single transaction */
+	return flow->settings.crr ? 1 : (unsigned)flow->settings.pipeline;
+}
+
+/* Returns true if a new request block has to wait for a response first */
+static inline bool pipeline_full(const struct flow *flow)
+{
+	unsigned depth = pipeline_depth(flow);
+
+	return depth && !flow->current_block_bytes_written &&
+	       flow->requests_outstanding >= depth;
 }
 
 static inline int flow_block_scheduled(struct timespec *now, struct flow *flow)
 {
-	return time_is_after(now, &flow->next_write_block_timestamp);
+	return time_is_after(now, &flow->next_write_block_timestamp) &&
+	       !pipeline_full(flow);
+}
+
+/**
+ * Let the worker look after @p flow again at @p tp at the latest.
+ *
+ * An earlier timer of the flow is kept.
+ *
+ * @param[in,out] flow flow to wake up
+ * @param[in] tp point in time the flow has to be looked after
+ */
+static void wake_flow_at(struct flow *flow, const struct timespec *tp)
+{
+	if (fg_heap_contains(&flow->timer) &&
+	    !time_is_after(&flow->timer.key, tp))
+		return;
+
+	if (fg_heap_update(&flow->worker->timers, &flow->timer, tp))
+		crit("could not allocate memory for flow timer");
+}
+
+/* Take @p tp as next timer if it is after @p now and before @p next */
+static inline void earliest_timer(const struct timespec *now,
+				  const struct timespec *tp,
+				  struct timespec *next, bool *have_next)
+{
+	if (!time_is_after(tp, now))
+		return;
+	if (*have_next && !time_is_after(next, tp))
+		return;
+	*next = *tp;
+	*have_next = true;
+}
+
+/**
+ * Set the timer of @p flow to the next point in time its state changes.
+ *
+ * These are the begin and end of the read and write phase, the next
+ * scheduled write block and the next interval report. Points in time
+ * not after @p now are assumed to be handled already.
+ *
+ * @param[in,out] flow flow to schedule
+ * @param[in] now current time
+ */
+static void schedule_flow(struct flow *flow, struct timespec *now)
+{
+	struct timespec next = {0, 0};
+	bool have_next = false;
+
+	if (flow->worker->started) {
+		if (flow->settings.reporting_interval)
+			earliest_timer(now, &flow->next_report_time, &next,
+				       &have_next);
+
+		foreach(int *i, WRITE, READ) {
+			if (flow->finished[*i])
+				continue;
+			earliest_timer(now, &flow->start_timestamp[*i], &next,
+				       &have_next);
+			if (flow->settings.duration[*i] >= 0)
+				earliest_timer(now, &flow->stop_timestamp[*i],
+					       &next, &have_next);
+		}
+
+		if (!flow->finished[WRITE])
+			earliest_timer(now, &flow->next_write_block_timestamp,
+				       &next, &have_next);
+	}
+
+	if (!have_next) {
+		fg_heap_remove(&flow->worker->timers, &flow->timer);
+		return;
+	}
+
+	if (fg_heap_update(&flow->worker->timers, &flow->timer, &next))
+		crit("could not allocate memory for flow timer");
+}
+
+#ifdef HAVE_EPOLL
+/**
+ * Change the set of events the daemon thread waits for on a flow.
+ *
+ * A flow has at most one socket registered with epoll: its listen socket
+ * while waiting for the data connection, its data socket afterwards. A flow
+ * with many connections has the epoll instance of its connections registered
+ * instead, which becomes readable on any event of the connections. The
+ * kernel is only asked for changes, so calling this with the currently
+ * registered @p events is cheap. An empty event set removes the socket from
+ * the epoll instance.
+ *
+ * @param[in,out] flow flow to (re)register
+ * @param[in] events epoll events to wait for
+ */
+static void watch_flow(struct flow *flow, uint32_t events)
+{
+	int fd = (flow->listenfd_data != -1 ? flow->listenfd_data : flow->fd);
+	uint32_t watch = events;
+
+	if (flow->conns && flow->listenfd_data == -1) {
+		fd = flow->conns->epollfd;
+		watch = events ? EPOLLIN : 0;
+		/* The connection to send on may change with every block */
+		connections_poll_out(flow, events & EPOLLOUT);
+	}
+
+	if (fd == flow->watched_fd && events == flow->watched_events)
+		return;
+
+	if (flow->watched_fd != -1 && (fd != flow->watched_fd || !events)) {
+		if (epoll_ctl(flow->worker->epollfd, EPOLL_CTL_DEL,
+			      flow->watched_fd, NULL) == -1)
+			logging(LOG_WARNING, "failed to remove fd %d of flow "
+				"%d from epoll: %s", flow->watched_fd,
+				flow->id, strerror(errno));
+		flow->watched_fd = -1;
+		flow->watched_events = 0;
+	}
+
+	if (fd == -1 || !events)
+		return;
+
+	struct epoll_event ev = { .events = watch, .data.ptr = flow };
+	int op = (flow->watched_fd == -1 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD);
+
+	if (epoll_ctl(flow->worker->epollfd, op, fd, &ev) == -1) {
+		logging(LOG_WARNING, "failed to watch fd %d of flow %d with "
+			"epoll: %s", fd, flow->id, strerror(errno));
+		return;
+	}
+
+	flow->watched_fd = fd;
+	flow->watched_events = events;
+}
+#endif /* HAVE_EPOLL */
+
+/**
+ * Stop waiting for events on the sockets of @p flow.
+ *
+ * Must be called before one of the flow sockets is closed, since the
+ * descriptor number may be reused immediately by another flow.
+ */
+void unwatch_flow(struct flow *flow)
+{
+#ifdef HAVE_EPOLL
+	watch_flow(flow, 0);
+#else /* HAVE_EPOLL */
+	UNUSED_ARGUMENT(flow);
+#endif /* HAVE_EPOLL */
+}
+
+/* Release the read and write block and the response queue of a flow, the
+ * payload is shared */
+static void free_flow_blocks(struct flow *flow)
+{
+	free(flow->responses);
+#ifdef HAVE_SO_ZEROCOPY
+	zerocopy_free(flow);
+#endif /* HAVE_SO_ZEROCOPY */
+#ifdef HAVE_TCP_ZEROCOPY_RECEIVE
+	zerocopy_receive_free(flow);
+#endif /* HAVE_TCP_ZEROCOPY_RECEIVE */
+#ifdef HAVE_SO_TIMESTAMPING
+	txstamp_free(flow);
+#endif /* HAVE_SO_TIMESTAMPING */
+	free_all(flow->read_block, flow->write_block);
 }
 
 void uninit_flow(struct flow *flow)
 {
 	DEBUG_MSG(LOG_DEBUG,"uninit_flow() called for flow %d",flow->id);
+	unwatch_flow(flow);
+#ifdef HAVE_LIBURING
+	uring_cancel_flow(flow);
+#endif /* HAVE_LIBURING */
+#ifdef HAVE_EPOLL
+	connections_free(flow);
+#endif /* HAVE_EPOLL */
 	if (flow->fd != -1)
 		close(flow->fd);
 	if (flow->listenfd_data != -1)
 		close(flow->listenfd_data);
+	if (flow->crr_listenfd != -1)
+		close(flow->crr_listenfd);
+#ifdef HAVE_SENDFILE
+	if (flow->payload_fd != -1)
+		close(flow->payload_fd);
+#endif /* HAVE_SENDFILE */
 #ifdef HAVE_LIBPCAP
 	int rc;
 	if (flow->settings.traffic_dump && flow->pcap_thread) {
@@ -184,26 +471,163 @@ void uninit_flow(struct flow *flow)
 				strerror(rc));
 	}
 #endif /* HAVE_LIBPCAP */
-	free_all(flow->read_block, flow->write_block, flow->addr, flow->error);
+#ifdef HAVE_LIBURING
+	/* In-flight io_uring operations still use the blocks. They are
+	 * released once the cancelled operations completed */
+	if (!flow->uring_pending)
+#endif /* HAVE_LIBURING */
+		free_flow_blocks(flow);
+	free_all(flow->addr, flow->error);
 	free_math_functions(flow);
 }
 
+/* Bucket of the flow index of @p worker for a flow ID and endpoint */
+static inline struct flow **flow_index_bucket(struct worker *worker, int id,
+					      enum endpoint_t endpoint)
+{
+	unsigned hash = ((unsigned)id << 1 | endpoint) * 2654435761U;
+
+	return &worker->flow_index[hash & (worker->flow_index_size - 1)];
+}
+
+/* Double the number of buckets of the flow index of @p worker */
+static int grow_flow_index(struct worker *worker)
+{
+	size_t old_size = worker->flow_index_size;
+	struct flow **old_index = worker->flow_index;
+	size_t size = old_size ? 2 * old_size : FLOW_INDEX_INITIAL_SIZE;
+
+	worker->flow_index = calloc(size, sizeof(struct flow *));
+	if (!worker->flow_index) {
+		worker->flow_index = old_index;
+		return -1;
+	}
+	worker->flow_index_size = size;
+
+	for (size_t i = 0; i < old_size; i++) {
+		struct flow *flow = old_index[i];
+		while (flow) {
+			struct flow *next = flow->index_next;
+			struct flow **bucket =
+				flow_index_bucket(worker, flow->id,
+						  flow->endpoint);
+			flow->index_next = *bucket;
+			*bucket = flow;
+			flow = next;
+		}
+	}
+	free(old_index);
+
+	return 0;
+}
+
+/**
+ * Look up a flow of @p worker by its flow ID and endpoint.
+ *
+ * @param[in] worker worker to search
+ * @param[in] id flow ID given by the controller
+ * @param[in] endpoint endpoint of the flow
+ * @return the flow, NULL if the worker does not handle such a flow
+ */
+static struct flow *find_flow(struct worker *worker, int id,
+			      enum endpoint_t endpoint)
+{
+	if (!worker->flow_index_size)
+		return NULL;
+
+	struct flow *flow = *flow_index_bucket(worker, id, endpoint);
+	while (flow && (flow->id != id || flow->endpoint != endpoint))
+		flow = flow->index_next;
+
+	return flow;
+}
+
+/**
+ * Hand a new flow over to @p worker.
+ *
+ * The flow is appended to the flow list of the worker and added to its flow
+ * index, so it can be found and removed in constant time.
+ *
+ * @param[in,out] worker worker the flow is assigned to
+ * @param[in,out] flow new flow
+ * @return 0 on success, -1 if memory could not be allocated
+ */
+int add_flow(struct worker *worker, struct flow *flow)
+{
+	/* Keep the load factor of the index below one */
+	if (fg_list_size(&worker->flows) >= worker->flow_index_size &&
+	    grow_flow_index(worker) == -1)
+		return -1;
+
+	if (fg_list_push_back(&worker->flows, flow))
+		return -1;
+	flow->list_node = fg_list_back(&worker->flows);
+
+	pthread_mutex_lock(&worker->mutex);
+	worker->num_flows++;
+	pthread_mutex_unlock(&worker->mutex);
+
+	struct flow **bucket = flow_index_bucket(worker, flow->id,
+						 flow->endpoint);
+	flow->index_next = *bucket;
+	*bucket = flow;
+
+	/* Let the worker arm the sockets of the flow */
+	wake_flow_at(flow, &worker->now);
+
+	return 0;
+}
+
 void remove_flow(struct flow * const flow)
 {
-	fg_list_remove(&flows, flow);
-	free(flow);
-	if (!fg_list_size(&flows))
-		started = 0;
+	struct worker *worker = flow->worker;
+
+	fg_heap_remove(&worker->timers, &flow->timer);
+	fg_list_remove_node(&worker->flows, flow->list_node);
+	pthread_mutex_lock(&worker->mutex);
+	worker->num_flows--;
+	pthread_mutex_unlock(&worker->mutex);
+	for (struct flow **bucket = flow_index_bucket(worker, flow->id,
+						      flow->endpoint);
+	     *bucket; bucket = &(*bucket)->index_next) {
+		if (*bucket == flow) {
+			*bucket = flow->index_next;
+			break;
+		}
+	}
+#ifdef HAVE_LIBURING
+	if (flow->uring_pending)
+		flow->uring_retired = 1;
+	else
+#endif /* HAVE_LIBURING */
+		free(flow);
+	if (!fg_list_size(&worker->flows))
+		worker->started = 0;
+}
+
+/* Shut down the data connection of @p flow, or all of its connections */
+static int shutdown_flow(struct flow *flow, int how)
+{
+#ifdef HAVE_EPOLL
+	if (flow->conns)
+		return connections_shutdown(flow, how);
+#endif /* HAVE_EPOLL */
+	return shutdown(flow->fd, how);
 }
 
-static void prepare_wfds(struct timespec *now, struct flow *flow, fd_set *wfds)
+/* Returns true if the daemon has to wait for the socket becoming writable */
+static bool prepare_wfds(struct timespec *now, struct flow *flow)
 {
 	int rc = 0;
 
+	/* Queued responses are sent regardless of the request schedule */
+	if (flow->responses_queued)
+		return true;
+
 	if (flow_in_delay(now, flow, WRITE)) {
 		DEBUG_MSG(LOG_WARNING, "flow %i not started yet (delayed)",
 			  flow->id);
-		return;
+		return false;
 	}
 
 	if (flow_sending(now, flow, WRITE)) {
@@ -211,7 +635,7 @@ static void prepare_wfds(struct timespec *now, struct flow *flow, fd_set *wfds)
 		if (flow_block_scheduled(now, flow)) {
 			DEBUG_MSG(LOG_DEBUG, "adding sock of flow %d to wfds",
 				  flow->id);
-			FD_SET(flow->fd, wfds);
+			return true;
 		} else {
 			DEBUG_MSG(LOG_DEBUG, "no block for flow %d scheduled "
 				  "yet", flow->id);
@@ -221,30 +645,33 @@ static void prepare_wfds(struct timespec *now, struct flow *flow, fd_set *wfds)
 		if (flow->settings.shutdown) {
 			DEBUG_MSG(LOG_WARNING, "shutting down flow %d (WR)",
 				  flow->id);
-			rc = shutdown(flow->fd,SHUT_WR);
+			rc = shutdown_flow(flow, SHUT_WR);
 			if (rc == -1)
 				warn("shutdown() SHUT_WR failed");
 		}
 	}
 
-	return;
+	return false;
 }
 
-static int prepare_rfds(struct timespec *now, struct flow *flow, fd_set *rfds)
+/* Returns 1 if the daemon has to wait for the socket becoming readable, 0 if
+ * not, and -1 if a late connect failed */
+static int prepare_rfds(struct timespec *now, struct flow *flow)
 {
 	int rc = 0;
 
 	if (!flow_in_delay(now, flow, READ) && !flow_sending(now, flow, READ)) {
 		if (!flow->finished[READ] && flow->settings.shutdown) {
 			warnx("server flow %u missed to shutdown", flow->id);
-			rc = shutdown(flow->fd, SHUT_RD);
+			rc = shutdown_flow(flow, SHUT_RD);
 			if (rc == -1)
 				warn("shutdown SHUT_RD failed");
 			flow->finished[READ] = 1;
 		}
 	}
 
-	if (flow->source_settings.late_connect && !flow->connect_called ) {
+	if (flow->source_settings.late_connect && !flow->connect_called &&
+	    !flow->settings.crr) {
 		DEBUG_MSG(LOG_ERR, "late connecting test socket for flow %d "
 			  "after %.3fs delay",
 			  flow->id, flow->settings.delay[WRITE]);
@@ -258,95 +685,229 @@ static int prepare_rfds(struct timespec *now, struct flow *flow, fd_set *rfds)
 	if (flow->connect_called && !flow->finished[READ]) {
 		DEBUG_MSG(LOG_DEBUG, "adding sock of flow %d to rfds",
 			  flow->id);
-		FD_SET(flow->fd, rfds);
+		return 1;
 	}
 
 	return 0;
 }
 
-static int prepare_fds() {
+/**
+ * Let the worker wait for a flow becoming readable or writable.
+ *
+ * While waiting for the data connection the listen socket of the flow is
+ * used, the data socket afterwards. With io_uring, the read and write
+ * operations are queued right away instead.
+ *
+ * @param[in] worker worker handling the flow
+ * @param[in,out] flow flow to wait for
+ * @param[in] want_read wait for the socket becoming readable
+ * @param[in] want_write wait for the socket becoming writable
+ */
+static void arm_flow(struct worker *worker, struct flow *flow, bool want_read,
+		     bool want_write)
+{
+#ifdef HAVE_LIBURING
+	if (worker->uring) {
+		uring_arm_flow(flow, want_read, want_write);
+		return;
+	}
+#endif /* HAVE_LIBURING */
+
+#ifdef HAVE_EPOLL
+	UNUSED_ARGUMENT(worker);
+	watch_flow(flow, (want_read ? EPOLLIN : 0) |
+			 (want_write ? EPOLLOUT : 0));
+#else /* HAVE_EPOLL */
+	int fd = (flow->listenfd_data != -1 ? flow->listenfd_data : flow->fd);
+
+	/* Errors are only of interest for the data connection */
+	if (fd == flow->fd)
+		FD_SET(fd, &worker->efds);
+	if (want_write)
+		FD_SET(fd, &worker->wfds);
+	if (want_read)
+		FD_SET(fd, &worker->rfds);
+	worker->maxfd = MAX(worker->maxfd, fd);
+#endif /* HAVE_EPOLL */
+}
 
-	DEBUG_MSG(LOG_DEBUG, "prepare_fds() called, number of flows: %zu",
-		  fg_list_size(&flows));
+/**
+ * Connect the data socket of a CRR source for its next transaction.
+ *
+ * If no local port is free, e.g. since all are held by connections in
+ * TIME_WAIT, the failure is counted and the connect is retried after
+ * #CRR_RETRY_DELAY.
+ *
+ * @param[in,out] flow flow to connect
+ * @param[in] now current time
+ * @return 0 on success or if the connect is retried, -1 on failure
+ */
+static int crr_connect(struct flow *flow, struct timespec *now)
+{
+	if (do_connect(flow) == 0)
+		return 0;
+	if (errno != EADDRNOTAVAIL)
+		return -1;
 
-	FD_ZERO(&rfds);
-	FD_ZERO(&wfds);
-	FD_ZERO(&efds);
+	DEBUG_MSG(LOG_NOTICE, "no local port to connect flow %d", flow->id);
+	foreach(int *i, INTERVAL, FINAL)
+		flow->statistics[*i].connect_failures++;
 
-	FD_SET(daemon_pipe[0], &rfds);
-	maxfd = daemon_pipe[0];
+	flow->next_write_block_timestamp = *now;
+	time_add(&flow->next_write_block_timestamp, CRR_RETRY_DELAY);
+	return renew_data_socket(flow);
+}
 
-	struct timespec now;
-	gettime(&now);
+/* Account the connect time of a CRR source whose connection became usable */
+static void crr_established(struct flow *flow)
+{
+	double connect_time = time_diff(&flow->crr_connect_start,
+					&flow->worker->now);
+	flow->crr_connecting = 0;
 
-	const struct list_node *node = fg_list_front(&flows);
-	while (node) {
-		struct flow *flow = node->data;
-		node = node->next;
+	foreach(int *i, INTERVAL, FINAL) {
+		flow->statistics[*i].connects++;
+		ASSIGN_MIN(flow->statistics[*i].connect_time_min,
+			   connect_time);
+		ASSIGN_MAX(flow->statistics[*i].connect_time_max,
+			   connect_time);
+		flow->statistics[*i].connect_time_sum += connect_time;
+	}
+}
 
-		if (started &&
-		    (flow->finished[READ] ||
-		     !flow->settings.duration[READ] ||
-		     (!flow_in_delay(&now, flow, READ) &&
-		      !flow_sending(&now, flow, READ))) &&
-		    (flow->finished[WRITE] ||
-		     !flow->settings.duration[WRITE] ||
-		     (!flow_in_delay(&now, flow, WRITE) &&
-		      !flow_sending(&now, flow, WRITE)))) {
-
-			/* On Other OSes than Linux or FreeBSD, tcp_info will contain all zeroes */
-			flow->statistics[FINAL].has_tcp_info =
-				get_tcp_info(flow,
-					     &flow->statistics[FINAL].tcp_info)
-					? 0 : 1;
-
-			flow->pmtu = get_pmtu(flow->fd);
-
-			if (flow->settings.reporting_interval)
-				report_flow(flow, INTERVAL);
-			report_flow(flow, FINAL);
-			uninit_flow(flow);
-			remove_flow(flow);
-			continue;
-		}
+/**
+ * Close the connection of a CRR flow that served its transaction.
+ *
+ * The source gets a new socket to connect once its next request is due, the
+ * destination waits on its listen socket for the next connection. Responses
+ * not yet sent are void with the connection.
+ *
+ * @param[in,out] flow flow whose connection is closed
+ * @return 0 on success, -1 on failure
+ */
+static int next_connection(struct flow *flow)
+{
+	flow->crr_done = 0;
+	flow->current_block_bytes_read = 0;
+	flow->current_block_bytes_written = 0;
+	flow->requests_outstanding = 0;
+	flow->responses_queued = 0;
+	flow->responses_head = 0;
+	flow->response_bytes_written = 0;
+
+	if (flow->endpoint == SOURCE) {
+		if (renew_data_socket(flow) == -1)
+			return -1;
+		wake_flow_at(flow, &flow->next_write_block_timestamp);
+		return 0;
+	}
 
-		if (flow->state == GRIND_WAIT_ACCEPT &&
-		    flow->listenfd_data != -1) {
-			FD_SET(flow->listenfd_data, &rfds);
-			maxfd = MAX(maxfd, flow->listenfd_data);
-		}
+	unwatch_flow(flow);
+	close(flow->fd);
+	flow->fd = -1;
+	flow->connect_called = 0;
+	flow->listenfd_data = flow->crr_listenfd;
+	flow->crr_listenfd = -1;
+	flow->state = GRIND_WAIT_ACCEPT;
 
-		if (!started)
-			continue;
+	wake_flow_at(flow, &flow->worker->now);
+	return 0;
+}
 
-		if (flow->fd != -1) {
-			FD_SET(flow->fd, &efds);
-			maxfd = MAX(maxfd, flow->fd);
-			prepare_wfds(&now, flow, &wfds);
-			prepare_rfds(&now, flow, &rfds);
-		}
+/**
+ * Reap @p flow if it is finished, otherwise determine on which of its
+ * sockets to wait.
+ *
+ * @param[in] worker worker handling the flow
+ * @param[in,out] flow flow to prepare
+ * @param[in] now current time
+ * @return true if the flow has been finished and removed
+ */
+static bool prepare_flow(struct worker *worker, struct flow *flow,
+			 struct timespec *now)
+{
+	if (worker->started &&
+	    (flow->finished[READ] ||
+	     !flow->settings.duration[READ] ||
+	     (!flow_in_delay(now, flow, READ) &&
+	      !flow_sending(now, flow, READ))) &&
+	    (flow->finished[WRITE] ||
+	     !flow->settings.duration[WRITE] ||
+	     (!flow_in_delay(now, flow, WRITE) &&
+	      !flow_sending(now, flow, WRITE)))) {
+		finish_flow(flow);
+		return true;
+	}
+
+	if (flow->state == GRIND_WAIT_ACCEPT &&
+	    flow->listenfd_data != -1) {
+		arm_flow(worker, flow, true, false);
+		return false;
 	}
 
-	return fg_list_size(&flows);
+	if (!worker->started || flow->fd == -1)
+		return false;
+
+	/* A CRR source opens a connection once its next request is due */
+	if (flow->settings.crr && flow->endpoint == SOURCE &&
+	    !flow->connect_called && flow_sending(now, flow, WRITE) &&
+	    flow_block_scheduled(now, flow) && crr_connect(flow, now) == -1) {
+		abort_flow(flow);
+		return true;
+	}
+
+	bool want_write = prepare_wfds(now, flow);
+	bool want_read = (prepare_rfds(now, flow) == 1);
+	if (flow->hello_left && flow->connect_called)
+		want_write = true;
+
+	arm_flow(worker, flow, want_read, want_write);
+	return false;
 }
 
-static void start_flows(struct request_start_flows *request)
-{
-	struct timespec start;
-	gettime(&start);
+#ifndef HAVE_EPOLL
+/**
+ * Reap finished flows and determine on which sockets to wait.
+ *
+ * The fd sets of the select() backend are rebuilt from scratch and the
+ * timers of all flows are recalculated. With epoll and io_uring, flows are
+ * only looked at when their timer expires.
+ *
+ * @return number of flows handled by the daemon
+ */
+static int prepare_fds(struct worker *worker) {
+
+	DEBUG_MSG(LOG_DEBUG, "prepare_fds() called for worker %u, number of "
+		  "flows: %zu", worker->id, fg_list_size(&worker->flows));
+
+	FD_ZERO(&worker->rfds);
+	FD_ZERO(&worker->wfds);
+	FD_ZERO(&worker->efds);
+
+	FD_SET(worker->pipe[0], &worker->rfds);
+	worker->maxfd = worker->pipe[0];
 
-#if 0
-	if (start.tv_sec < request->start_timestamp) {
-		/* If the clock is synchronized between nodes, all nodes will
-		 * start at the same time regardless of any RPC delays */
-		start.tv_sec = request->start_timestamp;
-		start.tv_nsec = 0;
+	const struct list_node *node = fg_list_front(&worker->flows);
+	while (node) {
+		struct flow *flow = node->data;
+		node = node->next;
+
+		if (!prepare_flow(worker, flow, &worker->now))
+			schedule_flow(flow, &worker->now);
 	}
-#else /* 0 */
-	UNUSED_ARGUMENT(request);
-#endif /* 0 */
 
-	const struct list_node *node = fg_list_front(&flows);
+	return fg_list_size(&worker->flows);
+}
+#endif /* HAVE_EPOLL */
+
+static void start_flows(struct worker *worker,
+			struct request_start_flows *request)
+{
+	/* All workers use the start time taken by dispatch_request() */
+	struct timespec start = request->start;
+	bool armed = request->start_at.tv_sec || request->start_at.tv_nsec;
+
+	const struct list_node *node = fg_list_front(&worker->flows);
 	while (node) {
 		struct flow *flow = node->data;
 		node = node->next;
@@ -367,124 +928,202 @@ static void start_flows(struct request_start_flows *request)
 		}
 		flow->next_write_block_timestamp =
 			flow->start_timestamp[WRITE];
+		flow->start_armed = armed;
 
-		gettime(&flow->last_report_time);
-		flow->first_report_time = flow->last_report_time;
-		flow->next_report_time = flow->last_report_time;
+		/* The first interval begins with the start of the flow */
+		flow->last_report_time = start;
+		flow->first_report_time = start;
+		flow->next_report_time = start;
 
 		time_add(&flow->next_report_time,
 			 flow->settings.reporting_interval);
+
+		/* Let the worker arm the sockets and schedule the flow */
+		wake_flow_at(flow, &start);
 	}
 
-	started = 1;
+	worker->started = 1;
 }
 
-static void stop_flow(struct request_stop_flow *request)
+/* Generate the final report of a flow and remove it */
+static void finish_flow(struct flow *flow)
 {
-	DEBUG_MSG(LOG_DEBUG, "stop_flow forcefully unlocked mutex");
-	pthread_mutex_unlock(&mutex);
-
-	if (request->flow_id == -1) {
-		/* Stop all flows */
-
-		const struct list_node *node = fg_list_front(&flows);
-		while (node) {
-			struct flow *flow = node->data;
-			node = node->next;
+	/* On Other OSes than Linux or FreeBSD, tcp_info will contain all zeroes */
+	if (flow->fd != -1)
+		flow->statistics[FINAL].has_tcp_info =
+			get_tcp_info(flow,
+				     &flow->statistics[FINAL].tcp_info)
+				? 0 : 1;
+	flow->pmtu = get_pmtu(flow->fd);
 
-			flow->statistics[FINAL].has_tcp_info =
-				get_tcp_info(flow,
-					     &flow->statistics[FINAL].tcp_info)
-					? 0 : 1;
-			flow->pmtu = get_pmtu(flow->fd);
+	if (flow->settings.reporting_interval)
+		report_flow(flow, INTERVAL);
+	report_flow(flow, FINAL);
 
-			if (flow->settings.reporting_interval)
-				report_flow(flow, INTERVAL);
-			report_flow(flow, FINAL);
+	uninit_flow(flow);
+	remove_flow(flow);
+}
 
-			uninit_flow(flow);
-			remove_flow(flow);
-		}
+static void stop_flow(struct worker *worker, struct request_stop_flow *request)
+{
+	bool found = false;
 
+	/* -1 stops all flows */
+	if (request->flow_id == -1) {
+		const struct list_node *node;
+		while ((node = fg_list_front(&worker->flows)))
+			finish_flow(node->data);
 		return;
 	}
 
-	const struct list_node *node = fg_list_front(&flows);
-	while (node) {
-		struct flow *flow = node->data;
-		node = node->next;
-
-		if (flow->id != request->flow_id)
+	/* Both endpoints of a flow may be handled by the same worker */
+	foreach(int *i, SOURCE, DESTINATION) {
+		struct flow *flow = find_flow(worker, request->flow_id, *i);
+		if (!flow)
 			continue;
+		finish_flow(flow);
+		found = true;
+	}
 
-		/* On Other OSes than Linux or FreeBSD, tcp_info will contain all zeroes */
-		flow->statistics[FINAL].has_tcp_info =
-			get_tcp_info(flow,
-				     &flow->statistics[FINAL].tcp_info)
-				? 0 : 1;
-		flow->pmtu = get_pmtu(flow->fd);
+	if (!found)
+		request_error(&request->r, "Unknown flow id");
+}
 
-		if (flow->settings.reporting_interval)
-			report_flow(flow, INTERVAL);
-		report_flow(flow, FINAL);
+/* Take the estimated clock offset to the source daemon of a destination
+ * flow */
+static void set_clock(struct worker *worker, struct request_set_clock *request)
+{
+	struct flow *flow = find_flow(worker, request->flow_id, DESTINATION);
 
-		uninit_flow(flow);
-		remove_flow(flow);
+	if (!flow) {
+		request_error(&request->r, "Unknown flow id");
 		return;
 	}
 
-	request_error(&request->r, "Unknown flow id");
+	flow->clock_offset = request->offset;
+	flow->clock_drift = request->drift;
+	flow->clock_error = request->error;
+	gettime(&flow->clock_reference);
+	DEBUG_MSG(LOG_NOTICE, "clock offset of flow %d is %.6lfs (+/- %.6lfs)",
+		  flow->id, flow->clock_offset, flow->clock_error);
+}
+
+#ifdef HAVE_EPOLL
+/**
+ * Attach the connections handed over by the shared listeners to the flows
+ * their hellos name.
+ *
+ * Connections for flows that are gone or already connected are closed.
+ *
+ * @param[in,out] worker worker the connections were handed over to
+ * @param[in] handoff list of connections, freed
+ */
+static void attach_handoffs(struct worker *worker, struct handoff *handoff)
+{
+	while (handoff) {
+		struct handoff *next = handoff->next;
+		struct flow *flow = NULL;
+
+		if (worker->flow_index_size)
+			flow = *flow_index_bucket(worker, handoff->flow_id,
+						  DESTINATION);
+		/* Flows of different controllers may share an ID */
+		while (flow && (flow->id != handoff->flow_id ||
+				flow->endpoint != DESTINATION ||
+				flow->hello_nonce != handoff->nonce))
+			flow = flow->index_next;
+
+		if (!flow || flow->state != GRIND_WAIT_ACCEPT ||
+		    flow->fd != -1) {
+			logging(LOG_WARNING, "no flow waits for connection "
+				"from %s (flow %d)",
+				fg_nameinfo((struct sockaddr *)&handoff->addr,
+					    handoff->addr_len),
+				handoff->flow_id);
+			close(handoff->fd);
+		} else if (add_data_connection(flow, handoff->fd,
+					       (struct sockaddr *)
+					       &handoff->addr,
+					       handoff->addr_len) == -1) {
+			abort_flow(flow);
+		} else {
+			/* Wait on the data connection from now on */
+			wake_flow_at(flow, &worker->now);
+		}
+
+		free(handoff);
+		handoff = next;
+	}
 }
+#endif /* HAVE_EPOLL */
 
 /**
  * To process the request issued from the controller.
  *
  * The daemon reads the request from the controller, and executes the issued
  * request type from the controller. The daemons have separate data structure
- * for each request type.
+ * for each request type. The request queue of the worker is detached while
+ * holding the lock, the requests itself are processed without it.
+ *
+ * @param[in,out] worker worker whose request queue is processed
  */
-static void process_requests()
+static void process_requests(struct worker *worker)
 {
-	int rc;
 	DEBUG_MSG(LOG_DEBUG, "process_requests trying to lock mutex");
-	pthread_mutex_lock(&mutex);
+	pthread_mutex_lock(&worker->mutex);
 	DEBUG_MSG(LOG_DEBUG, "process_requests locked mutex");
 
 	char tmp[100];
 	for (;;) {
-		int rc = read(daemon_pipe[0], tmp, 100);
+		int rc = read(worker->pipe[0], tmp, 100);
 		if (rc != 100)
 			break;
 	}
 
-	while (requests) {
-		struct request* request = requests;
-		requests = requests->next;
-		rc = 0;
+	struct request *request = worker->requests;
+	worker->requests = worker->requests_last = NULL;
+#ifdef HAVE_EPOLL
+	struct handoff *handoffs = worker->handoffs;
+	worker->handoffs = NULL;
+#endif /* HAVE_EPOLL */
+
+	pthread_mutex_unlock(&worker->mutex);
+	DEBUG_MSG(LOG_DEBUG, "process_requests unlocked mutex");
+
+#ifdef HAVE_EPOLL
+	attach_handoffs(worker, handoffs);
+#endif /* HAVE_EPOLL */
+
+	while (request) {
+		/* The request is freed once we signaled its completion */
+		struct request *next = request->next;
 
 		switch (request->type) {
 		case REQUEST_ADD_DESTINATION:
-			add_flow_destination((struct
-						request_add_flow_destination
-						*)request);
+			add_flow_destination(worker,
+					     (struct request_add_flow_destination
+					      *)request);
 			break;
 		case REQUEST_ADD_SOURCE:
-			rc = add_flow_source((struct
-						request_add_flow_source
-						*)request);
+			add_flow_source(worker,
+					(struct request_add_flow_source *)request);
 			break;
 		case REQUEST_START_FLOWS:
-			start_flows((struct request_start_flows *)request);
+			start_flows(worker,
+				    (struct request_start_flows *)request);
 			break;
 		case REQUEST_STOP_FLOW:
-			stop_flow((struct request_stop_flow *)request);
+			stop_flow(worker, (struct request_stop_flow *)request);
+			break;
+		case REQUEST_SET_CLOCK:
+			set_clock(worker, (struct request_set_clock *)request);
 			break;
 		case REQUEST_GET_STATUS:
 			{
 				struct request_get_status *r =
 					(struct request_get_status *)request;
-				r->started = started;
-				r->num_flows = fg_list_size(&flows);
+				r->started |= worker->started;
+				r->num_flows += fg_list_size(&worker->flows);
 			}
 			break;
 		case REQUEST_GET_UUID:
@@ -498,12 +1137,14 @@ static void process_requests()
 			request_error(request, "Unknown request type");
 			break;
 		}
-		if (rc != 1)
-			pthread_cond_signal(request->condition);
-	}
 
-	pthread_mutex_unlock(&mutex);
-	DEBUG_MSG(LOG_DEBUG, "process_requests unlocked mutex");
+		pthread_mutex_lock(&worker->mutex);
+		request->done = 1;
+		pthread_cond_signal(request->condition);
+		pthread_mutex_unlock(&worker->mutex);
+
+		request = next;
+	}
 }
 
 /**
@@ -535,7 +1176,7 @@ static void report_flow(struct flow* flow, int type)
 	else
 		report->begin = flow->first_report_time;
 
-	gettime(&report->end);
+	gettime_mono(&report->end);
 	flow->last_report_time = report->end;
 
 	/* abort if we were scheduled way to early for a interval report */
@@ -545,8 +1186,20 @@ static void report_flow(struct flow* flow, int type)
 		return;
 	}
 
+#ifdef HAVE_SO_ZEROCOPY
+	/* Account the sends completed since the last report */
+	if (flow->zc && flow->fd != -1)
+		zerocopy_reap(flow);
+#endif /* HAVE_SO_ZEROCOPY */
+#ifdef HAVE_SO_TIMESTAMPING
+	/* Account the blocks acknowledged since the last report */
+	if (flow->tx && flow->fd != -1)
+		txstamp_reap(flow);
+#endif /* HAVE_SO_TIMESTAMPING */
+
 	report->bytes_read = flow->statistics[type].bytes_read;
 	report->bytes_written = flow->statistics[type].bytes_written;
+	report->bytes_discarded = flow->statistics[type].bytes_discarded;
 	report->request_blocks_read =
 		flow->statistics[type].request_blocks_read;
 	report->response_blocks_read =
@@ -555,16 +1208,55 @@ static void report_flow(struct flow* flow, int type)
 		flow->statistics[type].request_blocks_written;
 	report->response_blocks_written =
 		flow->statistics[type].response_blocks_written;
+	report->zerocopy_sends = flow->statistics[type].zerocopy_sends;
+	report->zerocopy_copied = flow->statistics[type].zerocopy_copied;
+	report->wakeups = flow->statistics[type].wakeups;
+	report->budget_exhausted = flow->statistics[type].budget_exhausted;
+	report->response_blocks_pending = flow->responses_queued;
+	report->connects = flow->statistics[type].connects;
+	report->connect_failures = flow->statistics[type].connect_failures;
+	report->connect_time_min = flow->statistics[type].connect_time_min;
+	report->connect_time_max = flow->statistics[type].connect_time_max;
+	report->connect_time_sum = flow->statistics[type].connect_time_sum;
+	report->time_wait = flow->settings.crr ? get_tcp_time_wait() : -1;
+#ifdef HAVE_EPOLL
+	report->connections = flow->conns ? flow->conns->count : 0;
+#else /* HAVE_EPOLL */
+	report->connections = 0;
+#endif /* HAVE_EPOLL */
 
 	report->rtt_min = flow->statistics[type].rtt_min;
 	report->rtt_max = flow->statistics[type].rtt_max;
 	report->rtt_sum = flow->statistics[type].rtt_sum;
+	report->iat_samples = flow->statistics[type].iat_samples;
 	report->iat_min = flow->statistics[type].iat_min;
 	report->iat_max = flow->statistics[type].iat_max;
 	report->iat_sum = flow->statistics[type].iat_sum;
 	report->delay_min = flow->statistics[type].delay_min;
 	report->delay_max = flow->statistics[type].delay_max;
 	report->delay_sum = flow->statistics[type].delay_sum;
+	report->sched_delay_max = flow->statistics[type].sched_delay_max;
+	report->sched_delay_sum = flow->statistics[type].sched_delay_sum;
+	report->sched_rtt_max = flow->statistics[type].sched_rtt_max;
+	report->sched_rtt_sum = flow->statistics[type].sched_rtt_sum;
+	report->kernel_blocks = flow->statistics[type].kernel_blocks;
+	report->kernel_iat_samples = flow->statistics[type].kernel_iat_samples;
+	report->kernel_iat_min = flow->statistics[type].kernel_iat_min;
+	report->kernel_iat_max = flow->statistics[type].kernel_iat_max;
+	report->kernel_iat_sum = flow->statistics[type].kernel_iat_sum;
+	report->kernel_delay_min = flow->statistics[type].kernel_delay_min;
+	report->kernel_delay_max = flow->statistics[type].kernel_delay_max;
+	report->kernel_delay_sum = flow->statistics[type].kernel_delay_sum;
+	report->clock_offset = flow->clock_offset;
+	report->clock_error = flow->clock_error;
+	report->start_error = flow->start_error;
+	for (int stage = 0; stage < TX_STAGES; stage++) {
+		report->tx_samples[stage] =
+			flow->statistics[type].tx_samples[stage];
+		report->tx_min[stage] = flow->statistics[type].tx_min[stage];
+		report->tx_max[stage] = flow->statistics[type].tx_max[stage];
+		report->tx_sum[stage] = flow->statistics[type].tx_sum[stage];
+	}
 
 	/* Currently this will only contain useful information on Linux
 	 * and FreeBSD */
@@ -622,25 +1314,54 @@ static void report_flow(struct flow* flow, int type)
 	if (type == INTERVAL) {
 		flow->statistics[INTERVAL].bytes_read = 0;
 		flow->statistics[INTERVAL].bytes_written = 0;
+		flow->statistics[INTERVAL].bytes_discarded = 0;
 
 		flow->statistics[INTERVAL].request_blocks_read = 0;
 		flow->statistics[INTERVAL].response_blocks_read = 0;
 
 		flow->statistics[INTERVAL].request_blocks_written = 0;
 		flow->statistics[INTERVAL].response_blocks_written = 0;
+		flow->statistics[INTERVAL].zerocopy_sends = 0;
+		flow->statistics[INTERVAL].zerocopy_copied = 0;
+		flow->statistics[INTERVAL].wakeups = 0;
+		flow->statistics[INTERVAL].budget_exhausted = 0;
+		flow->statistics[INTERVAL].connects = 0;
+		flow->statistics[INTERVAL].connect_failures = 0;
+		flow->statistics[INTERVAL].connect_time_min = FLT_MAX;
+		flow->statistics[INTERVAL].connect_time_max = FLT_MIN;
+		flow->statistics[INTERVAL].connect_time_sum = 0.0F;
 
 		flow->statistics[INTERVAL].rtt_min = FLT_MAX;
 		flow->statistics[INTERVAL].rtt_max = FLT_MIN;
 		flow->statistics[INTERVAL].rtt_sum = 0.0F;
+		flow->statistics[INTERVAL].iat_samples = 0;
 		flow->statistics[INTERVAL].iat_min = FLT_MAX;
 		flow->statistics[INTERVAL].iat_max = FLT_MIN;
 		flow->statistics[INTERVAL].iat_sum = 0.0F;
 		flow->statistics[INTERVAL].delay_min = FLT_MAX;
 		flow->statistics[INTERVAL].delay_max = FLT_MIN;
 		flow->statistics[INTERVAL].delay_sum = 0.0F;
+		flow->statistics[INTERVAL].sched_delay_max = FLT_MIN;
+		flow->statistics[INTERVAL].sched_delay_sum = 0.0F;
+		flow->statistics[INTERVAL].sched_rtt_max = FLT_MIN;
+		flow->statistics[INTERVAL].sched_rtt_sum = 0.0F;
+		flow->statistics[INTERVAL].kernel_blocks = 0;
+		flow->statistics[INTERVAL].kernel_iat_samples = 0;
+		flow->statistics[INTERVAL].kernel_iat_min = FLT_MAX;
+		flow->statistics[INTERVAL].kernel_iat_max = FLT_MIN;
+		flow->statistics[INTERVAL].kernel_iat_sum = 0.0F;
+		flow->statistics[INTERVAL].kernel_delay_min = FLT_MAX;
+		flow->statistics[INTERVAL].kernel_delay_max = FLT_MIN;
+		flow->statistics[INTERVAL].kernel_delay_sum = 0.0F;
+		for (int stage = 0; stage < TX_STAGES; stage++) {
+			flow->statistics[INTERVAL].tx_samples[stage] = 0;
+			flow->statistics[INTERVAL].tx_min[stage] = FLT_MAX;
+			flow->statistics[INTERVAL].tx_max[stage] = FLT_MIN;
+			flow->statistics[INTERVAL].tx_sum[stage] = 0.0F;
+		}
 	}
 
-	add_report(report);
+	add_report(flow->worker, report);
 	DEBUG_MSG(LOG_DEBUG, "report_flow finished for flow %d (type %d)",
 		  flow->id, type);
 }
@@ -688,198 +1409,1021 @@ int get_tcp_info(struct flow *flow, struct fg_tcp_info *info)
 	return 0;
 }
 
-static void timer_check()
+/* Generate the interval report of @p flow if it is due */
+static void check_report_timer(struct flow *flow, struct timespec *now)
 {
-	struct timespec now;
+	DEBUG_MSG(LOG_DEBUG, "checking report timer of flow %d",
+		  flow->id);
 
-	if (!started)
+	if (!flow->worker->started || !flow->settings.reporting_interval)
 		return;
 
-	gettime(&now);
-	const struct list_node *node = fg_list_front(&flows);
-	while (node) {
-		struct flow *flow = node->data;
-		node = node->next;
-
-		DEBUG_MSG(LOG_DEBUG, "processing timer_check() for flow %d",
-			  flow->id);
+	if (!time_is_after(now, &flow->next_report_time))
+		return;
 
-		if (!flow->settings.reporting_interval)
-			continue;
+	/* On Other OSes than Linux or FreeBSD, tcp_info will contain all zeroes */
+	if (flow->fd != -1)
+		flow->statistics[INTERVAL].has_tcp_info =
+			get_tcp_info(flow,
+				     &flow->statistics[INTERVAL].tcp_info)
+				? 0 : 1;
+	report_flow(flow, INTERVAL);
 
-		if (!time_is_after(&now, &flow->next_report_time))
-			continue;
+	do {
+		time_add(&flow->next_report_time,
+			 flow->settings.reporting_interval);
+	} while (time_is_after(now, &flow->next_report_time));
+}
 
-		/* On Other OSes than Linux or FreeBSD, tcp_info will contain all zeroes */
-		if (flow->fd != -1)
-			flow->statistics[INTERVAL].has_tcp_info =
-				get_tcp_info(flow,
-					     &flow->statistics[INTERVAL].tcp_info)
-					? 0 : 1;
-		report_flow(flow, INTERVAL);
+/* Take the start error of @p flow once the start it was armed for has been
+ * reached */
+static void check_start(struct flow *flow, const struct timespec *now)
+{
+	const struct timespec *start = &flow->start_timestamp[WRITE];
+
+	if (!flow->start_armed || !flow->worker->started)
+		return;
+	if (time_is_after(start, &flow->start_timestamp[READ]))
+		start = &flow->start_timestamp[READ];
+	if (time_is_after(start, now))
+		return;
+
+	flow->start_armed = false;
+	flow->start_error = time_diff(start, now);
+	DEBUG_MSG(LOG_NOTICE, "flow %d started %.6lfs after its armed start",
+		  flow->id, flow->start_error);
+}
+
+/**
+ * Look after all flows whose timer expired.
+ *
+ * Only these flows are reaped, rearmed and reported, instead of scanning
+ * all flows of the worker.
+ *
+ * @param[in] worker worker to handle the expired timers for
+ */
+static void expire_timers(struct worker *worker)
+{
+	struct heap_node *node;
+
+	while ((node = fg_heap_top(&worker->timers)) &&
+	       !time_is_after(&node->key, &worker->now)) {
+		struct flow *flow = node->data;
+
+		check_start(flow, &worker->now);
+		if (prepare_flow(worker, flow, &worker->now))
+			continue;
+		check_report_timer(flow, &worker->now);
+		schedule_flow(flow, &worker->now);
+	}
+}
+
+/**
+ * Time until the earliest timer of @p worker expires.
+ *
+ * @param[in] worker worker to check
+ * @param[out] timeout relative time until the timer expires
+ * @return false if the worker has no timer pending, true otherwise
+ */
+static bool next_timeout(struct worker *worker, struct timespec *timeout)
+{
+	struct heap_node *node = fg_heap_top(&worker->timers);
+
+	if (!node)
+		return false;
+
+	int64_t ns = time_diff_ns(&worker->now, &node->key);
+	timeout->tv_sec = timeout->tv_nsec = 0;
+	if (ns > 0)
+		time_add_ns(timeout, ns);
+
+	return true;
+}
+
+/* Generate the final report of a failed flow and remove it */
+static void abort_flow(struct flow *flow)
+{
+	if (flow->fd != -1) {
+		flow->statistics[FINAL].has_tcp_info =
+			get_tcp_info(flow,
+				     &flow->statistics[FINAL].tcp_info)
+				? 0 : 1;
+	}
+	flow->pmtu = get_pmtu(flow->fd);
+	report_flow(flow, FINAL);
+	uninit_flow(flow);
+	DEBUG_MSG(LOG_ERR, "removing flow %d", flow->id);
+	remove_flow(flow);
+}
+
+/**
+ * Handle the events reported for a single flow.
+ *
+ * For a flow still waiting for its data connection, @p readable means that a
+ * connection can be accepted on the listen socket. If handling an event fails
+ * the final report is generated and the flow is removed.
+ *
+ * @param[in,out] flow flow to process
+ * @param[in] readable socket of the flow is readable
+ * @param[in] writable socket of the flow is writable
+ * @param[in] pending_error an error or exceptional condition is pending on
+ * the socket
+ * @return true if the flow has been removed
+ */
+static bool process_flow(struct flow *flow, bool readable, bool writable,
+			 bool pending_error)
+{
+	DEBUG_MSG(LOG_DEBUG, "processing events for flow %d", flow->id);
+
+	if (flow->listenfd_data != -1) {
+		if (readable && flow->state == GRIND_WAIT_ACCEPT) {
+			DEBUG_MSG(LOG_DEBUG, "ready for accept");
+			if (accept_data(flow) == -1) {
+				DEBUG_MSG(LOG_ERR, "accept_data() failed");
+				goto remove;
+			}
+			/* Wait on the data connection from now on */
+			wake_flow_at(flow, &flow->worker->now);
+		}
+		return false;
+	}
+
+	if (flow->fd == -1)
+		return false;
+
+	foreach(int *i, INTERVAL, FINAL)
+		flow->statistics[*i].wakeups++;
+
+#ifdef HAVE_SO_TIMESTAMPING
+	/* Transmit timestamps are queued as errors, which select() reports
+	 * as readable */
+	if (flow->tx && (pending_error || readable) &&
+	    txstamp_reap(flow) == -1) {
+		warn("failed to read transmit timestamps");
+		goto remove;
+	}
+#endif /* HAVE_SO_TIMESTAMPING */
+
+	if (pending_error) {
+		int error_number, rc;
+		socklen_t error_number_size = sizeof(error_number);
+		DEBUG_MSG(LOG_DEBUG, "sock of flow %d in efds", flow->id);
+#ifdef HAVE_SO_ZEROCOPY
+		/* Completions of zerocopy sends are queued as errors */
+		if (flow->zc && zerocopy_reap(flow) == -1) {
+			warn("failed to read zerocopy completions");
+			goto remove;
+		}
+#endif /* HAVE_SO_ZEROCOPY */
+		rc = getsockopt(flow->fd, SOL_SOCKET, SO_ERROR,
+				(void *)&error_number, &error_number_size);
+		if (rc == -1) {
+			warn("failed to get errno for non-blocking connect");
+			goto remove;
+		}
+		if (error_number != 0) {
+			warnc(error_number, "connect");
+			goto remove;
+		}
+	}
+
+#ifdef HAVE_SO_TIMESTAMPING
+	/* The kernel keys the transmit timestamps relative to the first byte
+	 * not yet acknowledged when they are set up. While connecting, this
+	 * is the SYN, which would shift all keys by one */
+	if (writable && flow->endpoint == SOURCE &&
+	    flow->settings.tx_timestamps && !flow->tx &&
+	    txstamp_init(flow) == -1)
+		goto remove;
+#endif /* HAVE_SO_TIMESTAMPING */
+
+	/* The data follows the hello to the shared listener */
+	if (writable && flow->hello_left) {
+		if (send_hello(flow) == -1)
+			goto remove;
+		writable = !flow->hello_left;
+	}
+
+	if (writable) {
+		struct timespec *now = &flow->worker->now;
+		if (flow->crr_connecting)
+			crr_established(flow);
+		if (send_queued_responses(flow) == -1)
+			goto remove;
+		/* Finish a partially sent request block even if responses
+		 * are waiting */
+		if ((!flow->responses_queued ||
+		     flow->current_block_bytes_written) &&
+		    flow_sending(now, flow, WRITE) &&
+		    flow_block_scheduled(now, flow) &&
+		    write_data(flow) == -1) {
+			DEBUG_MSG(LOG_ERR, "write_data() failed");
+			goto remove;
+		}
+		/* Stop polling for writability until responses are queued or
+		 * the next block is due. The flow timer will rearm the
+		 * socket */
+		if (!flow->responses_queued &&
+		    (!flow_sending(now, flow, WRITE) ||
+		     !flow_block_scheduled(now, flow))) {
+#ifdef HAVE_EPOLL
+			watch_flow(flow, flow->watched_events & ~EPOLLOUT);
+#endif /* HAVE_EPOLL */
+			wake_flow_at(flow, &flow->next_write_block_timestamp);
+		}
+	}
+
+	if (readable)
+		if (read_data(flow) == -1) {
+			DEBUG_MSG(LOG_ERR, "read_data() failed");
+			goto remove;
+		}
+
+	if (flow->crr_done && next_connection(flow) == -1)
+		goto remove;
+
+	return false;
 
-		do {
-			time_add(&flow->next_report_time,
-				 flow->settings.reporting_interval);
-		} while (time_is_after(&now, &flow->next_report_time));
+remove:
+	abort_flow(flow);
+	return true;
+}
+
+/* Bind the calling worker thread to its CPU core */
+static void bind_worker_to_core(struct worker *worker)
+{
+	if (worker->core < 0)
+		return;
+
+	int rc = pthread_setaffinity(pthread_self(), worker->core);
+	if (rc)
+		logging(LOG_WARNING, "failed to bind worker %u to CPU core %i",
+			worker->id, worker->core);
+	else
+		DEBUG_MSG(LOG_INFO, "bound worker %u to CPU core %i",
+			  worker->id, worker->core);
+}
+
+#ifdef HAVE_EPOLL
+/**
+ * Process the events on the connections of a flow with many connections.
+ *
+ * The data socket of the flow is switched to each connection with pending
+ * events in turn before the flow is processed.
+ *
+ * @param[in,out] flow flow whose epoll instance of connections is readable
+ */
+static void process_connections(struct flow *flow)
+{
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+	struct connections *conns = flow->conns;
+
+	int nfds = epoll_wait(conns->epollfd, events, MAX_EPOLL_EVENTS, 0);
+	if (nfds < 0) {
+		if (errno != EINTR)
+			logging(LOG_WARNING, "failed to wait on the connections "
+				"of flow %d: %s", flow->id, strerror(errno));
+		return;
 	}
-	DEBUG_MSG(LOG_DEBUG, "finished timer_check()");
+
+	for (int i = 0; i < nfds; i++) {
+		unsigned c = events[i].data.u32;
+		uint32_t revents = events[i].events;
+		bool writable = revents & EPOLLOUT;
+
+		/* Do not spin on a hangup of a single connection */
+		if (revents == EPOLLHUP) {
+			connections_watch(flow, c, 0);
+			continue;
+		}
+		/* The flow is done receiving, but a peer keeps sending */
+		if ((revents & EPOLLIN) && !(flow->watched_events & EPOLLIN)) {
+			connections_watch(flow, c,
+					  conns->conn[c].events & ~EPOLLIN);
+			revents &= ~EPOLLIN;
+		}
+
+		if (writable || (revents & EPOLLERR)) {
+			connections_switch(flow, c);
+			if (process_flow(flow, false, writable,
+					 revents & EPOLLERR))
+				return;
+		}
+		if (revents & EPOLLIN) {
+			connections_switch(flow, c);
+			if (process_flow(flow, true, false, false))
+				return;
+		}
+	}
+
+	/* Sending may have moved on to another connection */
+	if (flow->watched_events & EPOLLOUT)
+		connections_poll_out(flow, true);
 }
 
-static void process_select(fd_set *rfds, fd_set *wfds, fd_set *efds)
+/* Readiness based event loop of a worker using epoll */
+static void event_loop(struct worker *worker)
+{
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+	struct timespec timeout;
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	if (epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, worker->pipe[0],
+		      &ev) == -1)
+		crit("could not add worker pipe to epoll");
+	ev.data.ptr = worker;
+	if (epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, worker->listen_epollfd,
+		      &ev) == -1)
+		crit("could not add shared listeners to epoll");
+
+	for (;;) {
+		/* Scheduled writes, the end of flows and interval reports are
+		 * driven by the flow timers. New and started flows have their
+		 * timer expire right away */
+		gettime_mono(&worker->now);
+		expire_timers(worker);
+
+		bool need_timeout = next_timeout(worker, &timeout);
+
+		DEBUG_MSG(LOG_DEBUG, "calling epoll_wait() need_timeout: %d",
+			  need_timeout);
+#ifdef HAVE_EPOLL_PWAIT2
+		int nfds = epoll_pwait2(worker->epollfd, events,
+					MAX_EPOLL_EVENTS,
+					need_timeout ? &timeout : NULL, NULL);
+#else /* HAVE_EPOLL_PWAIT2 */
+		/* Round up, waking up early would only cause another wait */
+		int nfds = epoll_wait(worker->epollfd, events,
+				      MAX_EPOLL_EVENTS, need_timeout ?
+				      (int)(timeout.tv_sec * 1000 +
+					    (timeout.tv_nsec + 999999) /
+					    1000000) : -1);
+#endif /* HAVE_EPOLL_PWAIT2 */
+		if (nfds < 0) {
+			if (errno == EINTR)
+				continue;
+			crit("epoll_wait() failed");
+		}
+		DEBUG_MSG(LOG_DEBUG, "epoll_wait() returned %d events", nfds);
+
+		/* All events of the batch are handled at the same time */
+		gettime_mono(&worker->now);
+
+		bool have_requests = false;
+		for (int i = 0; i < nfds; i++) {
+			struct flow *flow = events[i].data.ptr;
+			uint32_t revents = events[i].events;
+
+			if (events[i].data.ptr == worker) {
+				listener_accept(worker);
+				continue;
+			}
+
+			/* Requests may remove flows which still have events
+			 * pending in this batch, thus process them last */
+			if (!flow) {
+				have_requests = true;
+				continue;
+			}
+
+			/* Hangup is reported regardless of the requested
+			 * events. Do not spin on it until the next scan */
+			if (revents == EPOLLHUP) {
+				unwatch_flow(flow);
+				continue;
+			}
+
+			if (flow->conns && flow->listenfd_data == -1)
+				process_connections(flow);
+			else
+				process_flow(flow, revents & EPOLLIN,
+					     revents & EPOLLOUT,
+					     revents & EPOLLERR);
+		}
+
+		if (have_requests)
+			process_requests(worker);
+	}
+}
+#else /* HAVE_EPOLL */
+static void process_select(struct worker *worker)
 {
-	const struct list_node *node = fg_list_front(&flows);
+	fd_set *rfds = &worker->rfds, *wfds = &worker->wfds,
+	       *efds = &worker->efds;
+
+	const struct list_node *node = fg_list_front(&worker->flows);
 	while (node) {
 		struct flow *flow = node->data;
 		node = node->next;
 
-		DEBUG_MSG(LOG_DEBUG, "processing pselect() for flow %d",
-			  flow->id);
+		if (flow->listenfd_data != -1)
+			process_flow(flow, FD_ISSET(flow->listenfd_data, rfds),
+				     false, false);
+		else if (flow->fd != -1)
+			process_flow(flow, FD_ISSET(flow->fd, rfds),
+				     FD_ISSET(flow->fd, wfds),
+				     FD_ISSET(flow->fd, efds));
+	}
+}
 
-		if (flow->listenfd_data != -1 &&
-		    FD_ISSET(flow->listenfd_data, rfds)) {
-			DEBUG_MSG(LOG_DEBUG, "ready for accept");
-			if (flow->state == GRIND_WAIT_ACCEPT) {
-				if (accept_data(flow) == -1) {
-					DEBUG_MSG(LOG_ERR, "accept_data() "
-						  "failed");
-					goto remove;
-				}
+/* Readiness based event loop of a worker using pselect() */
+static void event_loop(struct worker *worker)
+{
+	struct timespec timeout;
+
+	for (;;) {
+		gettime_mono(&worker->now);
+		prepare_fds(worker);
+
+		bool need_timeout = next_timeout(worker, &timeout);
+		DEBUG_MSG(LOG_DEBUG, "calling pselect() need_timeout: %i",
+			  need_timeout);
+		int rc = pselect(worker->maxfd + 1, &worker->rfds,
+				 &worker->wfds, &worker->efds,
+				 need_timeout ? &timeout : 0, NULL);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			crit("pselect() failed");
+		}
+		DEBUG_MSG(LOG_DEBUG, "pselect() finished");
+
+		/* All events of the batch are handled at the same time */
+		gettime_mono(&worker->now);
+
+		if (FD_ISSET(worker->pipe[0], &worker->rfds))
+			process_requests(worker);
+
+		process_select(worker);
+		/* Rearming flows touches the fd sets, thus do it after they
+		 * have been evaluated. They are rebuilt anyway */
+		expire_timers(worker);
+	}
+}
+#endif /* HAVE_EPOLL */
+
+#ifdef HAVE_LIBURING
+/**
+ * Set up the io_uring instance of a worker.
+ *
+ * Registering the receive buffer of the worker is optional. If it is not
+ * requested or the registration fails, payload is received with plain
+ * receives.
+ *
+ * @param[in,out] worker worker to set up
+ * @return 0 on success, -1 if io_uring is not available
+ */
+static int init_uring(struct worker *worker)
+{
+	struct io_uring_params params;
+	struct iovec iov = { worker->recv_buffer, RECV_BUFFER_SIZE };
+
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = URING_CQ_ENTRIES;
+
+	int rc = io_uring_queue_init_params(URING_ENTRIES, &worker->ring,
+					    &params);
+	if (rc < 0) {
+		logging(LOG_WARNING, "io_uring not available for worker %u: "
+			"%s", worker->id, strerror(-rc));
+		return -1;
+	}
+
+	if (!use_registered_buffers)
+		return 0;
+
+	/* Most likely fails if RLIMIT_MEMLOCK is exhausted */
+	rc = io_uring_register_buffers(&worker->ring, &iov, 1);
+	if (rc < 0) {
+		logging(LOG_WARNING, "worker %u can not use registered "
+			"buffers: %s", worker->id, strerror(-rc));
+		return 0;
+	}
+	worker->uring_fixed_recv = true;
+
+	return 0;
+}
+
+/* Get a free submission queue entry, flush the queue if it is full */
+static struct io_uring_sqe *uring_get_sqe(struct worker *worker)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&worker->ring);
+
+	if (!sqe) {
+		io_uring_submit(&worker->ring);
+		sqe = io_uring_get_sqe(&worker->ring);
+	}
+	if (!sqe)
+		logging(LOG_WARNING, "io_uring submission queue of worker %u "
+			"is full", worker->id);
+
+	return sqe;
+}
+
+/* Queue an operation of a flow */
+static inline void uring_queued(struct flow *flow, struct io_uring_sqe *sqe,
+				enum uring_op op)
+{
+	io_uring_sqe_set_data64(sqe, (uintptr_t)flow | op);
+	flow->uring_pending |= op;
+}
+
+/* Queue the receive of the next part of the current block */
+static void uring_recv(struct flow *flow)
+{
+	struct worker *worker = flow->worker;
+	unsigned offset = flow->current_block_bytes_read;
+	/* Read the block header first to learn the size of the block */
+	bool header = offset < (unsigned)MIN_BLOCK_SIZE;
+	unsigned len = (header ? (unsigned)MIN_BLOCK_SIZE :
+			flow->current_read_block_size) - offset;
+	struct io_uring_sqe *sqe = uring_get_sqe(worker);
+
+	if (!sqe)
+		return;
+
+#ifdef HAVE_TCP_ZEROCOPY_RECEIVE
+	/* Mapped data is received synchronously once the socket is
+	 * readable */
+	if (flow->zr)
+		io_uring_prep_poll_add(sqe, flow->fd, POLLIN);
+	else
+#endif /* HAVE_TCP_ZEROCOPY_RECEIVE */
+	if (header)
+		io_uring_prep_recv(sqe, flow->fd, flow->read_block + offset,
+				   len, 0);
+	/* Drop the payload if requested, nothing is written to the buffer */
+	else if (flow->settings.discard)
+		io_uring_prep_recv(sqe, flow->fd, worker->recv_buffer, len,
+				   MSG_TRUNC);
+	/* The payload is not kept, all flows of the worker receive it into
+	 * the same buffer */
+	else if (worker->uring_fixed_recv)
+		io_uring_prep_read_fixed(sqe, flow->fd, worker->recv_buffer,
+					 MIN(len, RECV_BUFFER_SIZE), 0, 0);
+	else
+		io_uring_prep_recv(sqe, flow->fd, worker->recv_buffer,
+				   MIN(len, RECV_BUFFER_SIZE), 0);
+	uring_queued(flow, sqe, URING_RECV);
+}
+
+/* Queue the send of the (rest of the) current write block */
+static void uring_send(struct flow *flow)
+{
+	struct io_uring *ring = &flow->worker->ring;
+
+	/* Linked operations have to be submitted together */
+	if (io_uring_sq_space_left(ring) < 2)
+		io_uring_submit(ring);
+
+	struct io_uring_sqe *sqe = uring_get_sqe(flow->worker);
+
+	if (!sqe)
+		return;
+	flow->uring_send_header = 0;
+
+	/* Queued responses are sent synchronously once the socket is
+	 * writable, unless a request block is partially sent */
+	if (flow->responses_queued && !flow->current_block_bytes_written) {
+		io_uring_prep_poll_add(sqe, flow->fd, POLLOUT);
+		uring_queued(flow, sqe, URING_SEND);
+		flow->uring_send_polling = true;
+		return;
+	}
+
+#ifdef HAVE_SENDFILE
+	/* The payload file is sent synchronously once the socket is
+	 * writable */
+	if (flow->payload_fd != -1) {
+		io_uring_prep_poll_add(sqe, flow->fd, POLLOUT);
+		uring_queued(flow, sqe, URING_SEND);
+		return;
+	}
+#endif /* HAVE_SENDFILE */
+
+	/* sendmsg() does not wait for buffer space on a non-blocking socket,
+	 * see uring_sent() */
+	if (flow->uring_send_blocked) {
+		io_uring_prep_poll_add(sqe, flow->fd, POLLOUT);
+		uring_queued(flow, sqe, URING_SEND);
+		flow->uring_send_blocked = false;
+		flow->uring_send_polling = true;
+		return;
+	}
+
+	if (!flow->current_block_bytes_written)
+		prepare_write_block(flow);
+
+#ifdef HAVE_SO_ZEROCOPY
+	if (flow->zc) {
+		io_uring_prep_sendmsg(sqe, flow->fd, &flow->zc->msg,
+				      zerocopy_prepare_send(flow));
+		uring_queued(flow, sqe, URING_SEND);
+		return;
+	}
+#endif /* HAVE_SO_ZEROCOPY */
+
+	struct iovec iov[2] = { { NULL, 0 }, { NULL, 0 } };
+	int parts = block_iov(flow->write_block, flow->payload,
+			      flow->current_block_bytes_written,
+			      flow->current_write_block_size, iov);
+
+	/* Header and payload are sent by two linked plain sends, io_uring
+	 * handles them much faster than a sendmsg(). Only the send of the
+	 * payload completes to the flow, it accounts the header as well */
+	if (parts > 1) {
+		io_uring_prep_send(sqe, flow->fd, iov[0].iov_base,
+				   iov[0].iov_len, MSG_WAITALL | MSG_MORE);
+		io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK |
+				       IOSQE_CQE_SKIP_SUCCESS);
+		io_uring_sqe_set_data64(sqe, 0);
+		flow->uring_send_header = iov[0].iov_len;
+
+		sqe = io_uring_get_sqe(ring);
+		iov[0] = iov[1];
+	}
+	io_uring_prep_send(sqe, flow->fd, iov[0].iov_base, iov[0].iov_len,
+			   (parts > 1 ? MSG_WAITALL : 0) |
+			   (flow->write_more ? MSG_MORE : 0));
+	uring_queued(flow, sqe, URING_SEND);
+}
+
+/**
+ * Queue the operations a flow is waiting for.
+ *
+ * At most one operation of each type is in flight per flow. Completed
+ * operations are requeued by their completion handlers.
+ *
+ * @param[in,out] flow flow to queue operations for
+ * @param[in] want_read receive data on the data socket
+ * @param[in] want_write send data on the data socket
+ */
+static void uring_arm_flow(struct flow *flow, bool want_read, bool want_write)
+{
+	if (flow->listenfd_data != -1) {
+		if (want_read && !(flow->uring_pending & URING_POLL)) {
+			struct io_uring_sqe *sqe = uring_get_sqe(flow->worker);
+			if (!sqe)
+				return;
+			io_uring_prep_poll_add(sqe, flow->listenfd_data,
+					       POLLIN);
+			uring_queued(flow, sqe, URING_POLL);
+		}
+		return;
+	}
+
+	if (want_read && !(flow->uring_pending & URING_RECV))
+		uring_recv(flow);
+	if (want_write && !(flow->uring_pending & URING_SEND))
+		uring_send(flow);
+}
+
+/**
+ * Cancel the in-flight io_uring operations of a flow.
+ *
+ * The operations complete asynchronously, so the memory they use must not be
+ * released before.
+ *
+ * @param[in,out] flow flow whose operations are cancelled
+ * @return true if operations of the flow are still in flight
+ */
+static bool uring_cancel_flow(struct flow *flow)
+{
+	if (!flow->uring_pending)
+		return false;
+
+	struct io_uring_sqe *sqe;
+
+	/* Cancel the operations on the data socket by descriptor, which also
+	 * catches the header send linked to a payload send. The descriptor
+	 * is resolved on submission, so submit before it is closed */
+	if (flow->uring_pending & (URING_RECV | URING_SEND) &&
+	    (sqe = uring_get_sqe(flow->worker))) {
+		io_uring_prep_cancel_fd(sqe, flow->fd,
+					IORING_ASYNC_CANCEL_ALL);
+		/* Completion of the cancel request itself is ignored */
+		io_uring_sqe_set_data64(sqe, 0);
+		io_uring_submit(&flow->worker->ring);
+	}
+
+	if (flow->uring_pending & URING_POLL &&
+	    (sqe = uring_get_sqe(flow->worker))) {
+		io_uring_prep_cancel(sqe, (void *)((uintptr_t)flow | URING_POLL),
+				     0);
+		io_uring_sqe_set_data64(sqe, 0);
+	}
+
+	return true;
+}
+
+/* Handle the completion of a send operation */
+static void uring_sent(struct flow *flow, int res, struct timespec *now)
+{
+	if (flow->uring_send_polling) {
+		/* Nothing was sent, but the socket is writable again */
+		flow->uring_send_polling = false;
+		if (res >= 0) {
+			if (send_queued_responses(flow) == -1) {
+				abort_flow(flow);
+				return;
 			}
+			res = -EAGAIN;
 		}
+	} else {
+#ifdef HAVE_SO_ZEROCOPY
+		if (flow->zc)
+			res = zerocopy_complete_send(flow, res);
+#endif /* HAVE_SO_ZEROCOPY */
+		/* Unlike plain sends, sendmsg() operations complete with
+		 * EAGAIN on a non-blocking socket whose buffer is full.
+		 * Retrying right away would spin */
+		flow->uring_send_blocked = (res == -EAGAIN);
+	}
 
-		if (flow->fd != -1) {
-			if (FD_ISSET(flow->fd, efds)) {
-				int error_number, rc;
-				socklen_t error_number_size =
-					sizeof(error_number);
-				DEBUG_MSG(LOG_DEBUG, "sock of flow %d in efds",
-					  flow->id);
-				rc = getsockopt(flow->fd, SOL_SOCKET,
-						SO_ERROR,
-						(void *)&error_number,
-						&error_number_size);
-				if (rc == -1) {
-					warn("failed to get errno for"
-					     "non-blocking connect");
-					goto remove;
-				}
-				if (error_number != 0) {
-					warnc(error_number, "connect");
-					goto remove;
-				}
+	if (res < 0 && res != -EAGAIN && res != -EINTR) {
+		DEBUG_MSG(LOG_WARNING, "send failed on flow %d: %s", flow->id,
+			  strerror(-res));
+		flow_error(flow, "premature end of test: %s", strerror(-res));
+		abort_flow(flow);
+		return;
+	}
+
+#ifdef HAVE_SENDFILE
+	if (flow->payload_fd != -1 && res >= 0) {
+		if (write_data(flow) == -1) {
+			abort_flow(flow);
+			return;
+		}
+		res = -EAGAIN;
+	}
+#endif /* HAVE_SENDFILE */
+
+	if (res == 0) {
+		DEBUG_MSG(LOG_CRIT, "flow %d sent zero bytes. what does that "
+			  "mean?", flow->id);
+		return;
+	}
+
+	/* The linked header was sent before the payload */
+	if (res > 0)
+		res += flow->uring_send_header;
+
+	if (res > 0 && account_write(flow, res) == -1) {
+		abort_flow(flow);
+		return;
+	}
+
+	/* Keep a send in flight as long as blocks are due, otherwise wait
+	 * for the next one */
+	if (prepare_wfds(now, flow))
+		uring_send(flow);
+	else
+		wake_flow_at(flow, &flow->next_write_block_timestamp);
+}
+
+/* Handle the completion of a receive operation */
+static void uring_received(struct flow *flow, int res, struct timespec *now)
+{
+	if (res < 0 && res != -EAGAIN && res != -EINTR) {
+		DEBUG_MSG(LOG_WARNING, "receive failed on flow %d: %s",
+			  flow->id, strerror(-res));
+		flow_error(flow, "Premature end of test: %s", strerror(-res));
+		abort_flow(flow);
+		return;
+	}
+
+#ifdef HAVE_TCP_ZEROCOPY_RECEIVE
+	if (flow->zr && res >= 0) {
+		if (read_data(flow) == -1) {
+			abort_flow(flow);
+			return;
+		}
+		res = -EAGAIN;
+	}
+#endif /* HAVE_TCP_ZEROCOPY_RECEIVE */
+
+	if (res >= 0) {
+		/* Payload was received with MSG_TRUNC, see uring_recv() */
+		bool discarded = flow->settings.discard &&
+				 flow->current_block_bytes_read >=
+				 (unsigned)MIN_BLOCK_SIZE;
+
+		gettime(&flow->recv_time);
+		if (account_read(flow, res) == -1) {
+			abort_flow(flow);
+			return;
+		}
+		if (discarded)
+			foreach(int *i, INTERVAL, FINAL)
+				flow->statistics[*i].bytes_discarded += res;
+
+		if (flow->current_block_bytes_read >= (unsigned)MIN_BLOCK_SIZE) {
+			int requested_response_block_size =
+				parse_block_header(flow);
+			if (flow->current_block_bytes_read >=
+			    flow->current_read_block_size)
+				finish_read_block(flow,
+						  requested_response_block_size);
+		}
+	}
+
+	if (prepare_rfds(now, flow) == 1)
+		uring_recv(flow);
+}
+
+/* Dispatch the completion of an operation to its flow */
+static void uring_complete(struct io_uring_cqe *cqe, struct timespec *now)
+{
+	uint64_t data = io_uring_cqe_get_data64(cqe);
+	struct flow *flow = (struct flow *)(uintptr_t)(data & ~URING_OP_MASK);
+	enum uring_op op = data & URING_OP_MASK;
+
+	if (!flow)
+		return;
+
+	flow->uring_pending &= ~op;
+
+	if (flow->uring_retired) {
+		if (!flow->uring_pending) {
+			free_flow_blocks(flow);
+			free(flow);
+		}
+		return;
+	}
+
+	switch (op) {
+	case URING_RECV:
+		foreach(int *i, INTERVAL, FINAL)
+			flow->statistics[*i].wakeups++;
+		uring_received(flow, cqe->res, now);
+		break;
+	case URING_SEND:
+		foreach(int *i, INTERVAL, FINAL)
+			flow->statistics[*i].wakeups++;
+		uring_sent(flow, cqe->res, now);
+		break;
+	case URING_POLL:
+		process_flow(flow, true, false, false);
+		break;
+	}
+}
+
+/**
+ * Completion based event loop of a worker using io_uring.
+ *
+ * Instead of waiting for readiness, the receive and send operations of all
+ * flows are queued and submitted to the kernel together with a single system
+ * call, which also reaps the completions of the previous batch.
+ *
+ * @param[in] worker worker to run the event loop for
+ */
+static void uring_loop(struct worker *worker)
+{
+	struct timespec wait;
+	bool wait_for_requests = false;
+
+	for (;;) {
+		if (!wait_for_requests) {
+			struct io_uring_sqe *sqe = uring_get_sqe(worker);
+			if (sqe) {
+				io_uring_prep_poll_add(sqe, worker->pipe[0],
+						       POLLIN);
+				io_uring_sqe_set_data64(sqe, URING_POLL);
+				wait_for_requests = true;
 			}
-			if (FD_ISSET(flow->fd, wfds))
-				if (write_data(flow) == -1) {
-					DEBUG_MSG(LOG_ERR, "write_data() failed");
-					goto remove;
-				}
+		}
 
-			if (FD_ISSET(flow->fd, rfds))
-				if (read_data(flow) == -1) {
-					DEBUG_MSG(LOG_ERR, "read_data() failed");
-					goto remove;
-				}
+		/* Same housekeeping as with epoll, driven by the timers */
+		gettime_mono(&worker->now);
+		expire_timers(worker);
+
+		bool need_timeout = next_timeout(worker, &wait);
+		struct __kernel_timespec timeout = {
+			.tv_sec = wait.tv_sec,
+			.tv_nsec = wait.tv_nsec,
+		};
+		struct io_uring_cqe *cqe;
+
+		int rc = io_uring_submit_and_wait_timeout(&worker->ring, &cqe,
+							  1, need_timeout ?
+							  &timeout : NULL,
+							  NULL);
+		if (rc < 0 && rc != -ETIME && rc != -EINTR && rc != -EBUSY)
+			critc(-rc, "io_uring_submit_and_wait_timeout() failed");
+
+		/* All completions of the batch are handled at the same time */
+		gettime_mono(&worker->now);
+		bool have_requests = false;
+		unsigned head, count = 0;
+		io_uring_for_each_cqe(&worker->ring, head, cqe) {
+			count++;
+			if (io_uring_cqe_get_data64(cqe) == URING_POLL) {
+				have_requests = true;
+				continue;
+			}
+			uring_complete(cqe, &worker->now);
 		}
-		continue;
-remove:
-		if (flow->fd != -1) {
-			flow->statistics[FINAL].has_tcp_info =
-				get_tcp_info(flow,
-					     &flow->statistics[FINAL].tcp_info)
-					? 0 : 1;
+		io_uring_cq_advance(&worker->ring, count);
+		DEBUG_MSG(LOG_DEBUG, "worker %u reaped %u completions",
+			  worker->id, count);
+
+		/* Requests may remove flows, thus process them last */
+		if (have_requests) {
+			process_requests(worker);
+			wait_for_requests = false;
 		}
-		flow->pmtu = get_pmtu(flow->fd);
-		report_flow(flow, FINAL);
-		uninit_flow(flow);
-		DEBUG_MSG(LOG_ERR, "removing flow %d", flow->id);
-		remove_flow(flow);
 	}
 }
+#endif /* HAVE_LIBURING */
 
-void* daemon_main(void* ptr __attribute__((unused)))
+void* daemon_main(void* ptr)
 {
-	struct timespec timeout;
-	for (;;) {
-		int need_timeout = prepare_fds();
+	struct worker *worker = ptr;
 
-		timeout.tv_sec = 0;
-		timeout.tv_nsec = DEFAULT_SELECT_TIMEOUT;
-		DEBUG_MSG(LOG_DEBUG, "calling pselect() need_timeout: %i",
-			  need_timeout);
-		int rc = pselect(maxfd + 1, &rfds, &wfds, &efds,
-				 need_timeout ? &timeout : 0, NULL);
-		if (rc < 0) {
-			if (errno == EINTR)
-				continue;
-			crit("pselect() failed");
-		}
-		DEBUG_MSG(LOG_DEBUG, "pselect() finished");
+	bind_worker_to_core(worker);
 
-		if (FD_ISSET(daemon_pipe[0], &rfds))
-			process_requests();
+#ifdef HAVE_LIBURING
+	if (worker->uring)
+		uring_loop(worker);
+#endif /* HAVE_LIBURING */
+	event_loop(worker);
 
-		timer_check();
-		process_select(&rfds, &wfds, &efds);
-	}
+	return NULL;
 }
 
-void add_report(struct report* report)
+void add_report(struct worker *worker, struct report* report)
 {
 	DEBUG_MSG(LOG_DEBUG, "add_report trying to lock mutex");
-	pthread_mutex_lock(&mutex);
+	pthread_mutex_lock(&worker->mutex);
 	DEBUG_MSG(LOG_DEBUG, "add_report aquired mutex");
 	/* Do not keep too much data */
-	if (pending_reports >= 250 && report->type != FINAL) {
+	if (worker->pending_reports >= 250 && report->type != FINAL) {
 		free(report);
-		pthread_mutex_unlock(&mutex);
+		pthread_mutex_unlock(&worker->mutex);
 		return;
 	}
 
 	report->next = 0;
 
-	if (reports_last)
-		reports_last->next = report;
+	if (worker->reports_last)
+		worker->reports_last->next = report;
 	else
-		reports = report;
+		worker->reports = report;
 
-	reports_last = report;
-	pending_reports++;
+	worker->reports_last = report;
+	worker->pending_reports++;
 
-	pthread_mutex_unlock(&mutex);
+	pthread_mutex_unlock(&worker->mutex);
 	DEBUG_MSG(LOG_DEBUG, "add_report unlocked mutex");
 }
 
+/* Collects the reports of all workers. The worker collection starts with is
+ * rotated, so no worker can starve the others */
 struct report* get_reports(int *has_more)
 {
 	const unsigned max_reports = 50;
+	static unsigned first_worker = 0;
 
-	struct report* ret;
-	DEBUG_MSG(LOG_DEBUG, "get_reports trying to lock mutex");
-	pthread_mutex_lock(&mutex);
-	DEBUG_MSG(LOG_DEBUG, "get_reports aquired mutex");
-	ret = reports;
-
-	if (pending_reports <= max_reports) {
-		*has_more = 0;
-		pending_reports = 0;
-		reports = NULL;
-		reports_last = 0;
-	} else {
-		/* Split off first 50 items */
-		struct report* tmp;
-		for (unsigned i = 0; i < max_reports - 1; i++)
-			reports = reports->next;
-		tmp = reports->next;
-		reports->next = 0;
-		reports = tmp;
+	struct report *ret = NULL, *ret_last = NULL;
+	unsigned num_reports = 0;
+
+	*has_more = 0;
+
+	for (unsigned i = 0; i < num_workers; i++) {
+		struct worker *worker =
+			&workers[(first_worker + i) % num_workers];
 
-		pending_reports -= max_reports;
-		*has_more = 1;
+		DEBUG_MSG(LOG_DEBUG, "get_reports trying to lock mutex");
+		pthread_mutex_lock(&worker->mutex);
+		DEBUG_MSG(LOG_DEBUG, "get_reports aquired mutex");
+
+		while (worker->reports && num_reports < max_reports) {
+			struct report *report = worker->reports;
+
+			worker->reports = report->next;
+			worker->pending_reports--;
+			report->next = NULL;
+
+			if (ret_last)
+				ret_last->next = report;
+			else
+				ret = report;
+			ret_last = report;
+			num_reports++;
+		}
+		if (!worker->reports)
+			worker->reports_last = NULL;
+		else
+			*has_more = 1;
+
+		pthread_mutex_unlock(&worker->mutex);
+		DEBUG_MSG(LOG_DEBUG, "get_reports unlocked mutex");
 	}
 
-	pthread_mutex_unlock(&mutex);
-	DEBUG_MSG(LOG_DEBUG, "get_reports unlocked mutex");
+	if (num_workers)
+		first_worker = (first_worker + 1) % num_workers;
+
 	return ret;
 }
 
@@ -903,6 +2447,14 @@ void init_flow(struct flow* flow, int is_source)
 	flow->state = is_source ? GRIND_WAIT_CONNECT : GRIND_WAIT_ACCEPT;
 	flow->fd = -1;
 	flow->listenfd_data = -1;
+	flow->crr_listenfd = -1;
+	fg_heap_node_init(&flow->timer, flow);
+#ifdef HAVE_EPOLL
+	flow->watched_fd = -1;
+#endif /* HAVE_EPOLL */
+#ifdef HAVE_SENDFILE
+	flow->payload_fd = -1;
+#endif /* HAVE_SENDFILE */
 
 	flow->current_read_block_size = MIN_BLOCK_SIZE;
 	flow->current_write_block_size = MIN_BLOCK_SIZE;
@@ -914,64 +2466,438 @@ void init_flow(struct flow* flow, int is_source)
 	foreach(int *i, INTERVAL, FINAL) {
 		flow->statistics[*i].bytes_read = 0;
 		flow->statistics[*i].bytes_written = 0;
+		flow->statistics[*i].bytes_discarded = 0;
 
 		flow->statistics[*i].request_blocks_read = 0;
 		flow->statistics[*i].request_blocks_written = 0;
 		flow->statistics[*i].response_blocks_read = 0;
 		flow->statistics[*i].response_blocks_written = 0;
+		flow->statistics[*i].zerocopy_sends = 0;
+		flow->statistics[*i].zerocopy_copied = 0;
+		flow->statistics[*i].wakeups = 0;
+		flow->statistics[*i].budget_exhausted = 0;
+		flow->statistics[*i].connects = 0;
+		flow->statistics[*i].connect_failures = 0;
+		flow->statistics[*i].connect_time_min = FLT_MAX;
+		flow->statistics[*i].connect_time_max = FLT_MIN;
+		flow->statistics[*i].connect_time_sum = 0.0F;
 
 		flow->statistics[*i].rtt_min = FLT_MAX;
 		flow->statistics[*i].rtt_max = FLT_MIN;
 		flow->statistics[*i].rtt_sum = 0.0F;
+		flow->statistics[*i].iat_samples = 0;
 		flow->statistics[*i].iat_min = FLT_MAX;
 		flow->statistics[*i].iat_max = FLT_MIN;
 		flow->statistics[*i].iat_sum = 0.0F;
 		flow->statistics[*i].delay_min = FLT_MAX;
 		flow->statistics[*i].delay_max = FLT_MIN;
 		flow->statistics[*i].delay_sum = 0.0F;
+		flow->statistics[*i].sched_delay_max = FLT_MIN;
+		flow->statistics[*i].sched_delay_sum = 0.0F;
+		flow->statistics[*i].sched_rtt_max = FLT_MIN;
+		flow->statistics[*i].sched_rtt_sum = 0.0F;
+		flow->statistics[*i].kernel_blocks = 0;
+		flow->statistics[*i].kernel_iat_samples = 0;
+		flow->statistics[*i].kernel_iat_min = FLT_MAX;
+		flow->statistics[*i].kernel_iat_max = FLT_MIN;
+		flow->statistics[*i].kernel_iat_sum = 0.0F;
+		flow->statistics[*i].kernel_delay_min = FLT_MAX;
+		flow->statistics[*i].kernel_delay_max = FLT_MIN;
+		flow->statistics[*i].kernel_delay_sum = 0.0F;
+		for (int stage = 0; stage < TX_STAGES; stage++) {
+			flow->statistics[*i].tx_samples[stage] = 0;
+			flow->statistics[*i].tx_min[stage] = FLT_MAX;
+			flow->statistics[*i].tx_max[stage] = FLT_MIN;
+			flow->statistics[*i].tx_sum[stage] = 0.0F;
+		}
 	}
 
 	DEBUG_MSG(LOG_NOTICE, "called init flow %d", flow->id);
 }
 
+/**
+ * Decide whether the write block prepared at @p now ends the batch of blocks
+ * sent with MSG_MORE.
+ *
+ * Flushing at the end of each burst, the batch ends if the next block is not
+ * due yet or falls after the end of the write duration.
+ *
+ * @param[in,out] flow flow sending the block
+ * @param[in] now point in time the block was prepared
+ * @return true if the block has to be sent without MSG_MORE
+ */
+static bool end_of_batch(struct flow *flow, const struct timespec *now)
+{
+	if (flow->settings.msg_more != MSG_MORE_BURST)
+		return ++flow->corked_blocks >=
+		       (unsigned)flow->settings.msg_more;
+
+	struct timespec next = flow->next_write_block_timestamp;
+	time_add(&next, flow->interpacket_gap);
+	if (flow->settings.duration[WRITE] >= 0 &&
+	    !time_is_after(&flow->stop_timestamp[WRITE], &next))
+		return true;
+	return time_is_after(&next, now);
+}
+
+/* Returns true if the request blocks of @p flow follow a schedule */
+static inline bool flow_paced(const struct flow *flow)
+{
+	const struct trafgen_options *gap =
+		&flow->settings.interpacket_gap_trafgen_options;
+
+	return flow->settings.write_rate || gap->param_one || gap->param_two;
+}
+
+/* Serialize the header of a new request block into the write block */
+static void prepare_write_block(struct flow *flow)
+{
+	int response_block_size = 0;
+	struct timespec *data = (struct timespec *)
+				(flow->write_block + 2 * (sizeof (int32_t)));
+	const struct timespec *now = &flow->worker->now;
+
+	flow->current_write_block_size = next_request_block_size(flow);
+	response_block_size = next_response_block_size(flow);
+	flow->interpacket_gap = next_interpacket_gap(flow);
+	/* serialize data:
+	 * this_block_size */
+	((struct block *)flow->write_block)->this_block_size =
+		htonl(flow->current_write_block_size);
+	/* requested_block_size */
+	((struct block *)flow->write_block)->request_block_size =
+		htonl(response_block_size);
+	/* write rtt data (will be echoed back by the receiver
+	 * in the response packet). The receiver may be another host, thus
+	 * the block carries wall-clock time */
+	gettime(data);
+	/* A paced block sent late still counts its latency from when it was
+	 * due, otherwise falling behind would hide the queueing delay. The
+	 * schedule is kept in monotonic time, the lateness carries over */
+	((struct block *)flow->write_block)->scheduled = *data;
+	if (flow_paced(flow) &&
+	    time_is_after(now, &flow->next_write_block_timestamp))
+		time_add_ns(&((struct block *)flow->write_block)->scheduled,
+			    -time_diff_ns(&flow->next_write_block_timestamp,
+					  now));
+
+	if (flow->settings.msg_more) {
+		flow->write_more = !end_of_batch(flow, now);
+		if (!flow->write_more)
+			flow->corked_blocks = 0;
+	}
+
+	DEBUG_MSG(LOG_DEBUG, "wrote new request data to out "
+		  "buffer bs = %d, rqs = %d, on flow %d",
+		  ntohl(((struct block *)flow->write_block)->this_block_size),
+		  ntohl(((struct block *)flow->write_block)->request_block_size),
+		  flow->id);
+#ifdef HAVE_SO_TIMESTAMPING
+	if (flow->tx)
+		txstamp_prepare_block(flow);
+#endif /* HAVE_SO_TIMESTAMPING */
+}
+
+/**
+ * Describe the rest of a block being sent.
+ *
+ * The header is taken from a write block or the response queue, the payload
+ * from the payload shared by all flows.
+ *
+ * @param[in] header header of the block
+ * @param[in] payload payload of the flow sending the block
+ * @param[in] offset number of bytes of the block already sent
+ * @param[in] size size of the block
+ * @param[out] iov header and payload part of the rest of the block
+ * @return number of parts, i.e. entries of @p iov used
+ */
+static int block_iov(const char *header, const char *payload,
+		     unsigned offset, unsigned size, struct iovec *iov)
+{
+	int parts = 0;
+
+	if (offset < (unsigned)MIN_BLOCK_SIZE) {
+		iov[parts].iov_base = (char *)header + offset;
+		iov[parts++].iov_len = MIN_BLOCK_SIZE - offset;
+		offset = MIN_BLOCK_SIZE;
+	}
+	if (offset < size) {
+		iov[parts].iov_base = (char *)payload + offset;
+		iov[parts++].iov_len = size - offset;
+	}
+
+	return parts;
+}
+
+/**
+ * Account @p bytes of the write block being sent.
+ *
+ * Once the block is complete, the next one is scheduled.
+ *
+ * @param[in,out] flow flow that sent data
+ * @param[in] bytes number of bytes sent
+ * @return 0 on success, -1 if the flow exceeded its congestion limit
+ */
+static int account_write(struct flow *flow, int bytes)
+{
+	DEBUG_MSG(LOG_DEBUG, "flow %d sent %d request bytes of %u "
+		  "(before = %u)", flow->id, bytes,
+		  flow->current_write_block_size,
+		  flow->current_block_bytes_written);
+
+	foreach(int *i, INTERVAL, FINAL)
+		flow->statistics[*i].bytes_written += bytes;
+
+	flow->current_block_bytes_written += bytes;
+
+	if (flow->current_block_bytes_written >=
+	    flow->current_write_block_size) {
+		assert(flow->current_block_bytes_written ==
+		       flow->current_write_block_size);
+		/* we just finished writing a block */
+		flow->current_block_bytes_written = 0;
+		flow->last_block_written = flow->worker->now;
+
+		foreach(int *i, INTERVAL, FINAL)
+			flow->statistics[*i].request_blocks_written++;
+
+		/* The block occupies the pipeline until its response is
+		 * read */
+		struct block *block = (struct block *)flow->write_block;
+		if (pipeline_depth(flow) &&
+		    (int)ntohl(block->request_block_size) >=
+		    (signed)MIN_BLOCK_SIZE)
+			flow->requests_outstanding++;
+
+		/* if we calculated a non-zero packet add relative time
+		 * to the next write stamp which is then checked in the
+		 * select call */
+		if (flow->interpacket_gap) {
+			time_add(&flow->next_write_block_timestamp,
+				 flow->interpacket_gap);
+			if (time_is_after(&flow->last_block_written,
+					  &flow->next_write_block_timestamp)) {
+				DEBUG_MSG(LOG_WARNING, "incipient "
+					  "congestion on flow %u new "
+					  "block scheduled %.6lfs before now",
+					   flow->id,
+					   time_diff(&flow->next_write_block_timestamp,
+						     &flow->last_block_written));
+				flow->congestion_counter++;
+				if (flow->congestion_counter >
+				    CONGESTION_LIMIT &&
+				    flow->settings.flow_control)
+					return -1;
+			}
+		}
+		/* Blocks batched with MSG_MORE are flushed together */
+		if (flow->settings.cork && !flow->write_more &&
+		    toggle_tcp_cork(flow->fd) == -1)
+			DEBUG_MSG(LOG_NOTICE, "failed to recork test "
+				  "socket for flow %d: %s",
+				  flow->id, strerror(errno));
+#ifdef HAVE_EPOLL
+		/* Request blocks are sent on the connections in turn */
+		if (flow->conns)
+			flow->conns->writer = (flow->conns->writer + 1) %
+					      flow->conns->count;
+#endif /* HAVE_EPOLL */
+	}
+
+	return 0;
+}
+
+#ifdef HAVE_SENDFILE
+/**
+ * Send the rest of the current write block, taking the payload from the
+ * payload file.
+ *
+ * The header is sent from the write block, the payload with sendfile()
+ * starting where the previous block ended. At the end of the file, sending
+ * continues from its beginning.
+ *
+ * @param[in,out] flow flow to send data on
+ * @return number of bytes sent, -1 on failure with errno set
+ */
+static int send_file_block(struct flow *flow)
+{
+	unsigned offset = flow->current_block_bytes_written;
+	int sent = 0, rc;
+
+	if (offset < (unsigned)MIN_BLOCK_SIZE) {
+		/* Let the header share a segment with the payload */
+		rc = send(flow->fd, flow->write_block + offset,
+			  MIN_BLOCK_SIZE - offset,
+			  flow->current_write_block_size > (unsigned)MIN_BLOCK_SIZE
+			  ? MSG_MORE : 0);
+		if (rc <= 0)
+			return rc;
+		sent += rc;
+		offset += rc;
+		if (offset < (unsigned)MIN_BLOCK_SIZE)
+			return sent;
+	}
+
+	while (offset < flow->current_write_block_size) {
+		size_t count = MIN(flow->current_write_block_size - offset,
+				   flow->payload_size - flow->payload_offset);
+		rc = sendfile(flow->fd, flow->payload_fd,
+			      &flow->payload_offset, count);
+		if (rc == -1 || rc == 0) {
+			if (rc == 0)
+				errno = EIO;
+			return (sent && errno == EAGAIN) ? sent : -1;
+		}
+		if (flow->payload_offset >= flow->payload_size)
+			flow->payload_offset = 0;
+		sent += rc;
+		offset += rc;
+		if ((size_t)rc < count)
+			break;
+	}
+
+	return sent;
+}
+#endif /* HAVE_SENDFILE */
+
+/* Amount of data the budget of @p flow is charged for in @p direction */
+static uint64_t budget_used(const struct flow *flow, enum io_t direction)
+{
+	const struct statistics *stats = &flow->statistics[FINAL];
+
+	if (!flow->settings.budget_blocks)
+		return direction == WRITE ? stats->bytes_written
+					  : stats->bytes_read;
+	return direction == WRITE ? stats->request_blocks_written
+				  : stats->request_blocks_read +
+				    stats->response_blocks_read;
+}
+
+/**
+ * Start a round of moving data of a pushy flow in @p direction.
+ *
+ * The flows of a worker are scheduled by deficit round-robin. Every time a
+ * flow is ready, its budget is refilled. Budget left from a round that ended
+ * because the socket had no more data to move is dropped, a budget overdrawn
+ * by the last operation is carried over.
+ *
+ * @param[in,out] flow flow to move data of
+ * @param[in] direction direction data is moved in
+ */
+static void budget_start(struct flow *flow, enum io_t direction)
+{
+	if (!flow->settings.pushy || !flow->settings.budget)
+		return;
+
+	flow->deficit[direction] = MIN(flow->deficit[direction], 0) +
+				   flow->settings.budget;
+	flow->budget_mark[direction] = budget_used(flow, direction);
+}
+
+/**
+ * Check if a flow may move more data in @p direction in the current round.
+ *
+ * @param[in,out] flow flow moving data
+ * @param[in] direction direction data is moved in
+ * @return true if the flow is pushy and has budget left
+ */
+static bool budget_left(struct flow *flow, enum io_t direction)
+{
+	if (!flow->settings.pushy)
+		return false;
+	if (!flow->settings.budget)
+		return true;
+
+	int64_t used = budget_used(flow, direction) -
+		       flow->budget_mark[direction];
+	if (used < flow->deficit[direction])
+		return true;
+
+	/* Yield to the other flows of the worker */
+	flow->deficit[direction] -= used;
+	foreach(int *i, INTERVAL, FINAL)
+		flow->statistics[*i].budget_exhausted++;
+	return false;
+}
+
+/**
+ * Send the rest of the hello of a source to the shared listener of its
+ * destination.
+ *
+ * @param[in,out] flow source flow with a connected data socket
+ * @return 0 on success, even if the hello is not sent completely yet, -1 on
+ * failure with the flow error set
+ */
+static int send_hello(struct flow *flow)
+{
+	const char *hello = flow->source_settings.hello;
+	ssize_t rc = send(flow->fd, hello + HELLO_SIZE - flow->hello_left,
+			  flow->hello_left, 0);
+
+	if (rc == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
+		flow_error(flow, "failed to send hello: %s", strerror(errno));
+		return -1;
+	}
+
+	flow->hello_left -= rc;
+	return 0;
+}
+
 static int write_data(struct flow *flow)
 {
 	int rc = 0;
-	int response_block_size = 0;
-	double interpacket_gap = .0;
+	struct iovec iov[2];
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	budget_start(flow, WRITE);
+
 	for (;;) {
 
-		/* fill buffer with new data */
+		/* fill buffer with new data, unless responses are waiting
+		 * to be sent or received */
 		if (flow->current_block_bytes_written == 0) {
-			flow->current_write_block_size =
-				next_request_block_size(flow);
-			response_block_size = next_response_block_size(flow);
-			/* serialize data:
-			 * this_block_size */
-			((struct block *)flow->write_block)->this_block_size =
-				htonl(flow->current_write_block_size);
-			/* requested_block_size */
-			((struct block *)flow->write_block)->request_block_size =
-				htonl(response_block_size);
-			/* write rtt data (will be echoed back by the receiver
-			 * in the response packet) */
-			gettime((struct timespec *)
-				(flow->write_block + 2 * (sizeof (int32_t))));
-
-			DEBUG_MSG(LOG_DEBUG, "wrote new request data to out "
-				  "buffer bs = %d, rqs = %d, on flow %d",
-				  ntohl(((struct block *)flow->write_block)->this_block_size),
-				  ntohl(((struct block *)flow->write_block)->request_block_size),
-				  flow->id);
+			if (flow->responses_queued || pipeline_full(flow))
+				break;
+			prepare_write_block(flow);
+		}
+#ifdef HAVE_EPOLL
+		if (flow->conns)
+			connections_switch(flow, flow->conns->writer);
+#endif /* HAVE_EPOLL */
+
+#ifdef HAVE_SENDFILE
+		if (flow->payload_fd != -1)
+			rc = send_file_block(flow);
+		else
+#endif /* HAVE_SENDFILE */
+#ifdef HAVE_SO_ZEROCOPY
+		if (flow->zc)
+			rc = zerocopy_send(flow);
+		else
+#endif /* HAVE_SO_ZEROCOPY */
+		{
+			msg.msg_iovlen = block_iov(flow->write_block,
+						   flow->payload,
+						   flow->current_block_bytes_written,
+						   flow->current_write_block_size,
+						   iov);
+#ifdef HAVE_SO_TIMESTAMPING
+			if (flow->tx)
+				txstamp_attach(flow, &msg);
+#endif /* HAVE_SO_TIMESTAMPING */
+			rc = sendmsg(flow->fd, &msg,
+				     flow->write_more ? MSG_MORE : 0);
 		}
-
-		rc = write(flow->fd,
-			   flow->write_block +
-			   flow->current_block_bytes_written,
-			   flow->current_write_block_size -
-			   flow->current_block_bytes_written);
 
 		if (rc == -1) {
+			/* Without a Fast Open cookie only the SYN was sent,
+			 * the block follows once the connection is up */
+			if (errno == EINPROGRESS)
+				break;
 			if (errno == EAGAIN) {
 				logging(LOG_WARNING, "write queue limit hit for "
 					"flow %d", flow->id);
@@ -991,67 +2917,96 @@ static int write_data(struct flow *flow)
 			return rc;
 		}
 
-		DEBUG_MSG(LOG_DEBUG, "flow %d sent %d request bytes of %u "
-			  "(before = %u)", flow->id, rc,
-			  flow->current_write_block_size,
-			  flow->current_block_bytes_written);
+		if (account_write(flow, rc) == -1)
+			return -1;
 
-		foreach(int *i, INTERVAL, FINAL)
-			flow->statistics[*i].bytes_written += rc;
+		if (!budget_left(flow, WRITE))
+			break;
+	}
+	return 0;
+}
+
+/**
+ * Account @p bytes received into the read block.
+ *
+ * @param[in,out] flow flow that received data
+ * @param[in] bytes number of bytes received, 0 if the peer shut down
+ * @return @p bytes, or -1 if the peer shut down the connection unexpectedly
+ */
+static int account_read(struct flow *flow, int bytes)
+{
+	/* The source of a CRR flow closes each connection after its
+	 * transaction */
+	if (bytes == 0 && flow->settings.crr &&
+	    flow->endpoint == DESTINATION) {
+		flow->crr_done = 1;
+		return 0;
+	}
 
-		flow->current_block_bytes_written += rc;
+	if (bytes == 0) {
+		DEBUG_MSG(LOG_ERR, "server shut down test socket of flow %d",
+			  flow->id);
+		if (!flow->finished[READ] || !flow->settings.shutdown)
+			warnx("premature shutdown of server flow");
+		flow->finished[READ] = 1;
+		return -1;
+	}
 
-		if (flow->current_block_bytes_written >=
-		    flow->current_write_block_size) {
-			assert(flow->current_block_bytes_written ==
-			       flow->current_write_block_size);
-			/* we just finished writing a block */
-			flow->current_block_bytes_written = 0;
-			gettime(&flow->last_block_written);
+	DEBUG_MSG(LOG_DEBUG, "flow %d received %u bytes", flow->id, bytes);
 
-			foreach(int *i, INTERVAL, FINAL)
-				flow->statistics[*i].request_blocks_written++;
-
-			interpacket_gap = next_interpacket_gap(flow);
-
-			/* if we calculated a non-zero packet add relative time
-			 * to the next write stamp which is then checked in the
-			 * select call */
-			if (interpacket_gap) {
-				time_add(&flow->next_write_block_timestamp,
-					 interpacket_gap);
-				if (time_is_after(&flow->last_block_written,
-						  &flow->next_write_block_timestamp)) {
-					char timestamp[30] = "";
-					ctimespec_r(&flow->next_write_block_timestamp,
-						    timestamp, sizeof(timestamp), true);
-					DEBUG_MSG(LOG_WARNING, "incipient "
-						  "congestion on flow %u new "
-						  "block scheduled for %s, "
-						  "%.6lfs before now",
-						   flow->id, timestamp,
-						   time_diff(&flow->next_write_block_timestamp,
-							     &flow->last_block_written));
-					flow->congestion_counter++;
-					if (flow->congestion_counter >
-					    CONGESTION_LIMIT &&
-					    flow->settings.flow_control)
-						return -1;
-				}
-			}
-			if (flow->settings.cork && toggle_tcp_cork(flow->fd) == -1)
-				DEBUG_MSG(LOG_NOTICE, "failed to recork test "
-					  "socket for flow %d: %s",
-					  flow->id, strerror(errno));
-		}
+	flow->current_block_bytes_read += bytes;
 
-		if (!flow->settings.pushy)
-			break;
+	foreach(int *i, INTERVAL, FINAL)
+		flow->statistics[*i].bytes_read += bytes;
+
+	return bytes;
+}
+
+/**
+ * Take the kernel receive timestamp of the data just received from the
+ * control messages of @p msg.
+ *
+ * For TCP, the kernel stamps the data with the arrival of the last segment it
+ * was read from.
+ *
+ * @param[in,out] flow flow that received the data
+ * @param[in] msg message header of the receive call
+ */
+static void read_rx_timestamp(struct flow *flow, struct msghdr *msg)
+{
+	flow->rx_timestamp.tv_sec = 0;
+	flow->rx_timestamp.tv_nsec = 0;
+	if (!flow->settings.timestamping)
+		return;
+
+#ifdef HAVE_SO_TIMESTAMPING
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg;
+	     cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		struct scm_timestamping stamps;
+
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_TIMESTAMPING)
+			continue;
+		memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+		/* Only the software timestamp is taken from the system clock,
+		 * the sender stamps the blocks with */
+		flow->rx_timestamp = stamps.ts[0];
 	}
-	return 0;
+#else /* HAVE_SO_TIMESTAMPING */
+	UNUSED_ARGUMENT(msg);
+#endif /* HAVE_SO_TIMESTAMPING */
 }
 
-static inline int try_read_n_bytes(struct flow *flow, int bytes)
+/**
+ * Read up to @p bytes of the current block.
+ *
+ * @param[in,out] flow flow to read data from
+ * @param[in] bytes maximum number of bytes to read
+ * @param[in] flags flags passed to recvmsg(). With MSG_TRUNC, Linux drops
+ * the data without copying it
+ * @return number of bytes read, -1 on failure or if the peer shut down
+ */
+static inline int try_read_n_bytes(struct flow *flow, int bytes, int flags)
 {
 	int rc;
 	struct iovec iov;
@@ -1061,10 +3016,20 @@ static inline int try_read_n_bytes(struct flow *flow, int bytes)
 	char cbuf[512];
 	struct cmsghdr *cmsg;
 #else /* DEBUG */
-	char cbuf[16];
+	char cbuf[RECV_CONTROL_SIZE];
 #endif /* DEBUG */
-	iov.iov_base = flow->read_block +
-		       flow->current_block_bytes_read;
+	/* Only the header is kept, the payload is received into the buffer
+	 * of the worker */
+	if (flow->current_block_bytes_read < (unsigned)MIN_BLOCK_SIZE) {
+		iov.iov_base = flow->read_block +
+			       flow->current_block_bytes_read;
+		bytes = MIN(bytes, MIN_BLOCK_SIZE -
+			    (int)flow->current_block_bytes_read);
+	} else {
+		iov.iov_base = flow->worker->recv_buffer;
+		if (!(flags & MSG_TRUNC))
+			bytes = MIN(bytes, RECV_BUFFER_SIZE);
+	}
 	iov.iov_len = bytes;
 	/* no name required */
 	msg.msg_name = NULL;
@@ -1074,128 +3039,361 @@ static inline int try_read_n_bytes(struct flow *flow, int bytes)
 	msg.msg_control = cbuf;
 	msg.msg_controllen = sizeof(cbuf);
 
-	rc = recvmsg(flow->fd, &msg, 0);
+	rc = recvmsg(flow->fd, &msg, flags);
+
+	DEBUG_MSG(LOG_DEBUG, "tried reading %d bytes, got %d", bytes, rc);
+
+	if (rc == -1) {
+		if (errno == EAGAIN)
+			flow_error(flow, "Premature end of test: %s",
+				   strerror(errno));
+		return -1;
+	}
+
+	gettime(&flow->recv_time);
+	read_rx_timestamp(flow, &msg);
+	if (account_read(flow, rc) == -1)
+		return -1;
+
+	if (flags & MSG_TRUNC)
+		foreach(int *i, INTERVAL, FINAL)
+			flow->statistics[*i].bytes_discarded += rc;
+
+#ifdef DEBUG
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		DEBUG_MSG(LOG_NOTICE, "flow %d received cmsg: type = %u, len = %u",
+			  flow->id, cmsg->cmsg_type, (socklen_t) cmsg->cmsg_len);
+#endif /* DEBUG */
+
+	return rc;
+}
+
+/**
+ * Parse the header of the block in the read block.
+ *
+ * @param[in,out] flow flow that received the header
+ * @return requested response block size, -1 for a response block
+ */
+static int parse_block_header(struct flow *flow)
+{
+	int optint = 0;
+	int requested_response_block_size = 0;
+
+	/* parse and check current block size for validity */
+	optint = ntohl( ((struct block *)flow->read_block)->this_block_size );
+	if (optint >= MIN_BLOCK_SIZE &&
+	    optint <= flow->settings.maximum_block_size )
+		flow->current_read_block_size = optint;
+	else
+		logging(LOG_WARNING, "flow %d parsed illegal cbs %d, "
+			"ignoring (max: %d)", flow->id, optint,
+			flow->settings.maximum_block_size);
+
+	/* parse and check current request size for validity */
+	optint = ntohl( ((struct block *)flow->read_block)->request_block_size );
+	if (optint == -1 || optint == 0  ||
+	    (optint >= MIN_BLOCK_SIZE &&
+	     optint <= flow->settings.maximum_block_size))
+		requested_response_block_size = optint;
+	else
+		logging(LOG_WARNING, "flow %d parsed illegal qbs %d, "
+			"ignoring (max: %d)", flow->id, optint,
+			flow->settings.maximum_block_size);
+#ifdef DEBUG
+	if (requested_response_block_size == -1) {
+		DEBUG_MSG(LOG_NOTICE, "processing response block on "
+			  "flow %d size: %d", flow->id,
+			  flow->current_read_block_size);
+	} else {
+		DEBUG_MSG(LOG_NOTICE, "processing request block on "
+			  "flow %d size: %d, request: %d", flow->id,
+			  flow->current_read_block_size,
+			  requested_response_block_size);
+	}
+#endif /* DEBUG */
+
+	return requested_response_block_size;
+}
+
+/**
+ * Free the pipeline slot of the request block answered by the response just
+ * read.
+ *
+ * If the pipeline was full, the next request block is due now at the
+ * earliest, so the interpacket gap counts from the response. The flow is
+ * woken up to send it. A CRR flow closes its connection first, see
+ * next_connection().
+ *
+ * @param[in,out] flow flow that read a response block
+ */
+static void release_request(struct flow *flow)
+{
+	bool full = pipeline_full(flow);
+
+	flow->requests_outstanding--;
+	if (!full)
+		return;
+
+	if (time_is_after(&flow->worker->now,
+			  &flow->next_write_block_timestamp))
+		flow->next_write_block_timestamp = flow->worker->now;
+	if (flow->settings.crr) {
+		flow->crr_done = 1;
+		return;
+	}
+	wake_flow_at(flow, &flow->next_write_block_timestamp);
+}
+
+/**
+ * Process a completely received block.
+ *
+ * @param[in,out] flow flow that received the block
+ * @param[in] requested_response_block_size response block size requested by
+ * the block, -1 if the block is a response block itself
+ */
+static void finish_read_block(struct flow *flow,
+			      int requested_response_block_size)
+{
+	assert(flow->current_block_bytes_read ==
+			flow->current_read_block_size);
+	flow->current_block_bytes_read = 0;
+
+	/* process_rtt(), process_iat() and process_delay() take the time of
+	 * the receive call that completed the block */
+	if (requested_response_block_size == -1) {
+		/* this is a response block, consider DATA as
+		 * RTT  */
+		foreach(int *i, INTERVAL, FINAL)
+			flow->statistics[*i].response_blocks_read++;
+		process_rtt(flow);
+		if (flow->requests_outstanding)
+			release_request(flow);
+	} else {
+		/* this is a request block, calculate IAT */
+		foreach(int *i, INTERVAL, FINAL)
+			flow->statistics[*i].request_blocks_read++;
+		process_iat(flow);
+		process_delay(flow);
+		if (flow->rx_timestamp.tv_sec || flow->rx_timestamp.tv_nsec)
+			process_rx_timestamp(flow);
+
+		/* send response if requested */
+		if (requested_response_block_size >=
+		    (signed)MIN_BLOCK_SIZE && !flow->finished[READ])
+			send_response(flow,
+				      requested_response_block_size);
+	}
+}
+
+/**
+ * Account @p len bytes of the received data stream at @p data.
+ *
+ * Only the block headers are copied into the read block to be parsed, the
+ * payload is just counted.
+ *
+ * @param[in,out] flow flow that received the data
+ * @param[in] data received data
+ * @param[in] len number of bytes received
+ */
+static void consume_data(struct flow *flow, const char *data, unsigned len)
+{
+	while (len) {
+		unsigned bytes;
+
+		if (flow->current_block_bytes_read < (unsigned)MIN_BLOCK_SIZE) {
+			bytes = MIN(len, MIN_BLOCK_SIZE -
+				    flow->current_block_bytes_read);
+			memcpy(flow->read_block +
+			       flow->current_block_bytes_read, data, bytes);
+		} else {
+			bytes = MIN(len, flow->current_read_block_size -
+				    flow->current_block_bytes_read);
+		}
+		account_read(flow, bytes);
+		data += bytes;
+		len -= bytes;
+
+		if (flow->current_block_bytes_read < (unsigned)MIN_BLOCK_SIZE)
+			continue;
+
+		int requested_response_block_size = parse_block_header(flow);
+		if (flow->current_block_bytes_read >=
+		    flow->current_read_block_size)
+			finish_read_block(flow, requested_response_block_size);
+	}
+}
+
+#ifdef HAVE_TCP_ZEROCOPY_RECEIVE
+/**
+ * Receive data by mapping it with TCP_ZEROCOPY_RECEIVE.
+ *
+ * Data that cannot be mapped, e.g. the unaligned tail of a segment, is
+ * copied. If the kernel refuses to map data at all, the flow falls back to
+ * copying for good.
+ *
+ * @param[in,out] flow flow to receive data on
+ * @return number of bytes received, -1 on failure or if the peer shut down
+ */
+static int read_mapped_data(struct flow *flow)
+{
+	int rc = 0;
+
+	budget_start(flow, READ);
+	for (;;) {
+		unsigned copy = 0;
+		int mapped = zerocopy_receive(flow, &copy);
+
+		if (mapped == -1 && errno != EAGAIN) {
+			logging(LOG_WARNING, "unable to map received data of "
+				"flow %d, copying from now on: %s", flow->id,
+				strerror(errno));
+			zerocopy_receive_free(flow);
+			return rc;
+		}
+		if (mapped > 0) {
+			gettime(&flow->recv_time);
+			consume_data(flow, flow->zr->area, mapped);
+			rc += mapped;
+		}
 
-	DEBUG_MSG(LOG_DEBUG, "tried reading %d bytes, got %d", bytes, rc);
+		/* Copy what cannot be mapped. Also detects the shutdown of
+		 * the peer if nothing was mapped */
+		if (mapped <= 0 || copy) {
+			int bytes = recv(flow->fd, flow->zr->copy,
+					 copy ? MIN(copy, ZEROCOPY_RECEIVE_COPY)
+					      : ZEROCOPY_RECEIVE_COPY, 0);
+			if (bytes == -1) {
+				if (errno == EAGAIN)
+					break;
+				flow_error(flow, "Premature end of test: %s",
+					   strerror(errno));
+				return -1;
+			}
+			/* Peer shut down the connection */
+			if (!bytes)
+				return account_read(flow, bytes);
+			gettime(&flow->recv_time);
+			consume_data(flow, flow->zr->copy, bytes);
+			rc += bytes;
+		}
 
-	if (rc == -1) {
-		if (errno == EAGAIN)
-			flow_error(flow, "Premature end of test: %s",
-				   strerror(errno));
-		return -1;
+		if (!budget_left(flow, READ))
+			break;
 	}
+	return rc;
+}
+#endif /* HAVE_TCP_ZEROCOPY_RECEIVE */
 
-	if (rc == 0) {
-		DEBUG_MSG(LOG_ERR, "server shut down test socket of flow %d",
-			  flow->id);
-		if (!flow->finished[READ] || !flow->settings.shutdown)
-			warnx("premature shutdown of server flow");
-		flow->finished[READ] = 1;
-		return -1;
-	}
+/**
+ * Receive the data stream of @p flow in large chunks.
+ *
+ * Instead of reading the header and the payload of each block separately,
+ * the data is received into the buffer of the worker and all blocks in it are
+ * processed in one pass. A flow that is not pushy receives one chunk per
+ * call, a pushy flow drains the socket. With TCP_INQ the kernel tells how
+ * much data is left, which sizes the last receive and saves the final one
+ * that would fail.
+ *
+ * @param[in,out] flow flow to receive data on
+ * @return number of bytes received, -1 on failure or if the peer shut down
+ */
+static int read_stream_data(struct flow *flow)
+{
+	char *buffer = flow->worker->recv_buffer;
+	char cbuf[RECV_CONTROL_SIZE];
+	struct iovec iov;
+	struct msghdr msg;
+	int rc = 0;
 
-	DEBUG_MSG(LOG_DEBUG, "flow %d received %u bytes", flow->id, rc);
+	iov.iov_base = buffer;
+	iov.iov_len = RECV_BUFFER_SIZE;
 
-	flow->current_block_bytes_read += rc;
+	budget_start(flow, READ);
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cbuf;
+		msg.msg_controllen = sizeof(cbuf);
 
-	foreach(int *i, INTERVAL, FINAL)
-		flow->statistics[*i].bytes_read += rc;
+		int bytes = recvmsg(flow->fd, &msg, 0);
 
-#ifdef DEBUG
-	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
-		DEBUG_MSG(LOG_NOTICE, "flow %d received cmsg: type = %u, len = %u",
-			  flow->id, cmsg->cmsg_type, (socklen_t) cmsg->cmsg_len);
-#endif /* DEBUG */
+		DEBUG_MSG(LOG_DEBUG, "tried reading %zu bytes, got %d",
+			  iov.iov_len, bytes);
+
+		if (bytes == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			flow_error(flow, "Premature end of test: %s",
+				   strerror(errno));
+			return -1;
+		}
+		/* Peer shut down the connection */
+		if (!bytes)
+			return account_read(flow, bytes);
+		gettime(&flow->recv_time);
+		read_rx_timestamp(flow, &msg);
+		consume_data(flow, buffer, bytes);
+		rc += bytes;
+
+		if (!budget_left(flow, READ))
+			break;
 
+#ifdef HAVE_TCP_INQ
+		int inq = -1;
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg))
+			if (cmsg->cmsg_level == SOL_TCP &&
+			    cmsg->cmsg_type == TCP_CM_INQ)
+				memcpy(&inq, CMSG_DATA(cmsg), sizeof(inq));
+		if (!inq)
+			break;
+		if (inq > 0)
+			iov.iov_len = MIN(inq, RECV_BUFFER_SIZE);
+#endif /* HAVE_TCP_INQ */
+	}
 	return rc;
 }
 
 static int read_data(struct flow *flow)
 {
 	int rc = 0;
-	int optint = 0;
 	int requested_response_block_size = 0;
 
+#ifdef HAVE_TCP_ZEROCOPY_RECEIVE
+	if (flow->zr)
+		return read_mapped_data(flow);
+#endif /* HAVE_TCP_ZEROCOPY_RECEIVE */
+	/* Discarding needs to know where the payload of a block starts */
+	if (!flow->settings.discard)
+		return read_stream_data(flow);
+
+	budget_start(flow, READ);
 	for (;;) {
 		/* make sure to read block header for new block */
 		if (flow->current_block_bytes_read < MIN_BLOCK_SIZE) {
 			rc = try_read_n_bytes(flow,
-					      MIN_BLOCK_SIZE-flow->current_block_bytes_read);
+					      MIN_BLOCK_SIZE-flow->current_block_bytes_read,
+					      0);
 			if (flow->current_block_bytes_read < MIN_BLOCK_SIZE)
 				break;
 		}
 		/* parse data and update status */
+		requested_response_block_size = parse_block_header(flow);
 
-		/* parse and check current block size for validity */
-		optint = ntohl( ((struct block *)flow->read_block)->this_block_size );
-		if (optint >= MIN_BLOCK_SIZE &&
-		    optint <= flow->settings.maximum_block_size )
-			flow->current_read_block_size = optint;
-		else
-			logging(LOG_WARNING, "flow %d parsed illegal cbs %d, "
-				"ignoring (max: %d)", flow->id, optint,
-				flow->settings.maximum_block_size);
-
-		/* parse and check current request size for validity */
-		optint = ntohl( ((struct block *)flow->read_block)->request_block_size );
-		if (optint == -1 || optint == 0  ||
-		    (optint >= MIN_BLOCK_SIZE &&
-		     optint <= flow->settings.maximum_block_size))
-			requested_response_block_size = optint;
-		else
-			logging(LOG_WARNING, "flow %d parsed illegal qbs %d, "
-				"ignoring (max: %d)", flow->id, optint,
-				flow->settings.maximum_block_size);
-#ifdef DEBUG
-		if (requested_response_block_size == -1) {
-			DEBUG_MSG(LOG_NOTICE, "processing response block on "
-				  "flow %d size: %d", flow->id,
-				  flow->current_read_block_size);
-		} else {
-			DEBUG_MSG(LOG_NOTICE, "processing request block on "
-				  "flow %d size: %d, request: %d", flow->id,
-				  flow->current_read_block_size,
-				  requested_response_block_size);
-		}
-#endif /* DEBUG */
 		/* read rest of block, if we have more to read */
 		if (flow->current_block_bytes_read <
 		    flow->current_read_block_size)
 			rc += try_read_n_bytes(flow,
 					       flow->current_read_block_size -
-					       flow->current_block_bytes_read);
+					       flow->current_block_bytes_read,
+					       flow->settings.discard ? MSG_TRUNC : 0);
 
 		if (flow->current_block_bytes_read >=
-		    flow->current_read_block_size ) {
-			assert(flow->current_block_bytes_read ==
-					flow->current_read_block_size);
-			flow->current_block_bytes_read = 0;
-
-			/* TODO process_rtt(), process_iat(), and
-			 * process_delay () call all gettime().
-			 * Quite inefficient... */
-
-			if (requested_response_block_size == -1) {
-				/* this is a response block, consider DATA as
-				 * RTT  */
-				foreach(int *i, INTERVAL, FINAL)
-					flow->statistics[*i].response_blocks_read++;
-				process_rtt(flow);
-			} else {
-				/* this is a request block, calculate IAT */
-				foreach(int *i, INTERVAL, FINAL)
-					flow->statistics[*i].request_blocks_read++;
-				process_iat(flow);
-				process_delay(flow);
-
-				/* send response if requested */
-				if (requested_response_block_size >=
-				    (signed)MIN_BLOCK_SIZE && !flow->finished[READ])
-					send_response(flow,
-						      requested_response_block_size);
-			}
-		}
-		if (!flow->settings.pushy)
+		    flow->current_read_block_size )
+			finish_read_block(flow, requested_response_block_size);
+
+		if (flow->crr_done || !budget_left(flow, READ))
 			break;
 	}
 	return rc;
@@ -1203,13 +3401,14 @@ static int read_data(struct flow *flow)
 
 static void process_rtt(struct flow* flow)
 {
-	double current_rtt = .0;
-	struct timespec now;
+	double current_rtt = .0, sched_rtt = .0;
+	const struct timespec *now = &flow->recv_time;
 	struct timespec *data = (struct timespec *)
 		(flow->read_block + 2*(sizeof (int32_t)));
 
-	gettime(&now);
-	current_rtt = time_diff(data, &now);
+	current_rtt = time_diff(data, now);
+	sched_rtt = time_diff(&((struct block *)flow->read_block)->scheduled,
+			      now);
 
 	if (current_rtt < 0) {
 		logging(LOG_CRIT, "received malformed rtt block of flow %d "
@@ -1217,14 +3416,19 @@ static void process_rtt(struct flow* flow)
 		current_rtt = NAN;
 	}
 
-	flow->last_block_read = now;
-
 	if (!isnan(current_rtt)) {
 		foreach(int *i, INTERVAL, FINAL) {
 			ASSIGN_MIN(flow->statistics[*i].rtt_min, current_rtt);
 			ASSIGN_MAX(flow->statistics[*i].rtt_max, current_rtt);
 			flow->statistics[*i].rtt_sum += current_rtt;
 		}
+		/* A block is never sent before it is due */
+		ASSIGN_MAX(sched_rtt, current_rtt);
+		foreach(int *i, INTERVAL, FINAL) {
+			ASSIGN_MAX(flow->statistics[*i].sched_rtt_max,
+				   sched_rtt);
+			flow->statistics[*i].sched_rtt_sum += sched_rtt;
+		}
 	}
 
 	DEBUG_MSG(LOG_NOTICE, "processed RTT of flow %d (%.3lfms)",
@@ -1234,16 +3438,19 @@ static void process_rtt(struct flow* flow)
 static void process_iat(struct flow* flow)
 {
 	double current_iat = .0;
-	struct timespec now;
-
-	gettime(&now);
+	const struct timespec *now = &flow->recv_time;
 
 	if (flow->last_block_read.tv_sec ||
 	    flow->last_block_read.tv_nsec)
-		current_iat = time_diff(&flow->last_block_read, &now);
+		current_iat = time_diff(&flow->last_block_read, now);
 	else
 		current_iat = NAN;
 
+	/* The blocks after the first one completed by the same receive call
+	 * arrived together with it */
+	if (!current_iat)
+		return;
+
 	if (current_iat < 0) {
 		logging(LOG_CRIT, "calculated malformed iat of flow %d "
 			"(iat = %.3lfms) (clock skew?), ignoring",
@@ -1251,10 +3458,11 @@ static void process_iat(struct flow* flow)
 		current_iat = NAN;
 	}
 
-	flow->last_block_read = now;
+	flow->last_block_read = *now;
 
 	if (!isnan(current_iat)) {
 		foreach(int *i, INTERVAL, FINAL) {
+			flow->statistics[*i].iat_samples++;
 			ASSIGN_MIN(flow->statistics[*i].iat_min, current_iat);
 			ASSIGN_MAX(flow->statistics[*i].iat_max, current_iat);
 			flow->statistics[*i].iat_sum += current_iat;
@@ -1264,15 +3472,29 @@ static void process_iat(struct flow* flow)
 		  flow->id, current_iat * 1e3);
 }
 
+/* Offset of the wall clock of this daemon to the one of the source daemon of
+ * @p flow at @p tp, 0 if unknown */
+static inline double peer_clock_offset(const struct flow *flow,
+				       const struct timespec *tp)
+{
+	if (!flow->clock_error)
+		return 0;
+	return flow->clock_offset +
+	       flow->clock_drift * time_diff(&flow->clock_reference, tp);
+}
+
 static void process_delay(struct flow* flow)
 {
-	double current_delay = .0;
-	struct timespec now;
+	double current_delay = .0, sched_delay = .0;
+	const struct timespec *now = &flow->recv_time;
 	struct timespec *data = (struct timespec *)
 		(flow->read_block + 2*(sizeof (int32_t)));
 
-	gettime(&now);
-	current_delay = time_diff(data, &now);
+	double offset = peer_clock_offset(flow, now);
+
+	current_delay = time_diff(data, now) - offset;
+	sched_delay = time_diff(&((struct block *)flow->read_block)->scheduled,
+				now) - offset;
 
 	if (current_delay < 0) {
 		logging(LOG_NOTICE, "calculated malformed delay of flow "
@@ -1289,89 +3511,221 @@ static void process_delay(struct flow* flow)
 				   current_delay);
 			flow->statistics[*i].delay_sum += current_delay;
 		}
+		ASSIGN_MAX(sched_delay, current_delay);
+		foreach(int *i, INTERVAL, FINAL) {
+			ASSIGN_MAX(flow->statistics[*i].sched_delay_max,
+				   sched_delay);
+			flow->statistics[*i].sched_delay_sum += sched_delay;
+		}
 	}
 
 	DEBUG_MSG(LOG_NOTICE, "processed delay of flow %d (%.3lfms)",
 		  flow->id, current_delay * 1e3);
 }
 
-static void send_response(struct flow* flow, int requested_response_block_size)
+/* Account the IAT and delay of the request block just read by its kernel
+ * receive timestamp, which leaves out the time until the daemon read it */
+static void process_rx_timestamp(struct flow *flow)
 {
-	int rc;
-	int try = 0;
+	double current_iat = NAN, current_delay = .0;
+	const struct timespec *arrival = &flow->rx_timestamp;
 
-	assert(!flow->current_block_bytes_written);
+	current_delay = time_diff(&((struct block *)flow->read_block)->data,
+				  arrival) - peer_clock_offset(flow, arrival);
+	if (flow->last_block_arrival.tv_sec ||
+	    flow->last_block_arrival.tv_nsec)
+		current_iat = time_diff(&flow->last_block_arrival, arrival);
+	flow->last_block_arrival = *arrival;
 
-	/* write requested block size as current size */
-	((struct block *)flow->write_block)->this_block_size =
-		htonl(requested_response_block_size);
-	/* rqs = -1 indicates response block */
-	((struct block *)flow->write_block)->request_block_size = htonl(-1);
-	/* copy rtt data from received block to response block (echo back) */
-	((struct block *)flow->write_block)->data =
-		((struct block *)flow->read_block)->data;
-	/* workaround for 64bit sender and 32bit receiver: we check if the
-	 * timespec is 64bit and then echo the missing 32bit back, too */
-	if ((((struct block *)flow->write_block)->data.tv_sec) ||
-	    ((struct block *)flow->write_block)->data.tv_nsec)
-		((struct block *)flow->write_block)->data2 =
-			((struct block *)flow->read_block)->data2;
-
-	DEBUG_MSG(LOG_DEBUG, "wrote new response data to out buffer bs = %d, "
-		  "rqs = %d on flow %d",
-		  ntohl(((struct block *)flow->write_block)->this_block_size),
-		  ntohl(((struct block *)flow->write_block)->request_block_size),
-		  flow->id);
+	if (current_delay < 0) {
+		logging(LOG_NOTICE, "calculated malformed kernel delay of flow "
+			"%d (delay = %.3lfms) (clocks out-of-sync?), ignoring",
+			flow->id, current_delay * 1e3);
+		current_delay = NAN;
+	}
+	/* The system clock may have been stepped back, and the blocks after
+	 * the first one of the same receive call share its timestamp */
+	if (current_iat <= 0)
+		current_iat = NAN;
 
-	/* send data out until block is finished (or abort if 0 zero bytes are
-	 * send CONGESTION_LIMIT times) */
-	for (;;) {
-		rc = write(flow->fd,
-			   flow->write_block + flow->current_block_bytes_written,
-			   requested_response_block_size -
-				flow->current_block_bytes_written);
+	foreach(int *i, INTERVAL, FINAL) {
+		flow->statistics[*i].kernel_blocks++;
+		if (!isnan(current_iat)) {
+			flow->statistics[*i].kernel_iat_samples++;
+			ASSIGN_MIN(flow->statistics[*i].kernel_iat_min,
+				   current_iat);
+			ASSIGN_MAX(flow->statistics[*i].kernel_iat_max,
+				   current_iat);
+			flow->statistics[*i].kernel_iat_sum += current_iat;
+		}
+		if (!isnan(current_delay)) {
+			ASSIGN_MIN(flow->statistics[*i].kernel_delay_min,
+				   current_delay);
+			ASSIGN_MAX(flow->statistics[*i].kernel_delay_max,
+				   current_delay);
+			flow->statistics[*i].kernel_delay_sum += current_delay;
+		}
+	}
+
+	DEBUG_MSG(LOG_NOTICE, "processed kernel IAT and delay of flow %d "
+		  "(%.3lfms, %.3lfms)", flow->id, current_iat * 1e3,
+		  current_delay * 1e3);
+}
+
+/* Make room for more queued response blocks of @p flow */
+static int grow_response_queue(struct flow *flow)
+{
+	unsigned size = flow->responses_size ? 2 * flow->responses_size
+					     : RESPONSE_QUEUE_SIZE;
+	struct block *responses = realloc(flow->responses,
+					  size * sizeof(*responses));
 
-		DEBUG_MSG(LOG_NOTICE, "send %d bytes response (rqs %d) on flow "
-			  "%d", rc, requested_response_block_size,flow->id);
+	if (!responses)
+		return -1;
+
+	/* Unwrap the full ring, its front follows its back now */
+	memcpy(responses + flow->responses_size, responses,
+	       flow->responses_head * sizeof(*responses));
+	flow->responses = responses;
+#ifdef HAVE_EPOLL
+	if (flow->conns && connections_grow_responses(flow, size) == -1)
+		return -1;
+#endif /* HAVE_EPOLL */
+	flow->responses_size = size;
+	return 0;
+}
+
+/**
+ * Send the queued response blocks of @p flow until the socket is full.
+ *
+ * No response is started while a request block is partially sent, since it
+ * would interleave with the request block.
+ *
+ * @param[in,out] flow flow to send the response blocks of
+ * @return 0 on success, -1 on failure
+ */
+static int send_queued_responses(struct flow *flow)
+{
+	struct iovec iov[2];
+	int rc = 0;
+#ifdef HAVE_EPOLL
+	unsigned current = flow->conns ? flow->conns->current : 0;
+#endif /* HAVE_EPOLL */
+
+	while (flow->responses_queued && !flow->current_block_bytes_written) {
+		const struct block *response =
+			&flow->responses[flow->responses_head];
+		unsigned size = ntohl(response->this_block_size);
+#ifdef HAVE_EPOLL
+		/* A response goes back on the connection of its request */
+		if (flow->conns)
+			connections_switch(flow, flow->conns->responses[
+						 flow->responses_head]);
+#endif /* HAVE_EPOLL */
+		rc = writev(flow->fd, iov,
+			    block_iov((const char *)response, flow->payload,
+				      flow->response_bytes_written, size,
+				      iov));
+
+		DEBUG_MSG(LOG_NOTICE, "send %d bytes response (rqs %u) on flow "
+			  "%d", rc, size, flow->id);
 
 		if (rc == -1) {
 			if (errno == EAGAIN) {
-				DEBUG_MSG(LOG_DEBUG, "%s, still trying to send "
-					  "response block (write queue hit "
-					  "limit)", strerror(errno));
-				try++;
-				if (try >= CONGESTION_LIMIT &&
-				    !flow->current_block_bytes_written) {
-					logging(LOG_WARNING, "tried to send "
-						"response block %d times without "
-						"success, dropping (%s)",
-						try, strerror(errno));
-						break;
-				}
-			} else {
-				logging(LOG_WARNING, "premature end of test: "
-					"%s, abort flow", strerror(errno));
-				flow->finished[READ] = 1;
-				break;
-			}
-		} else {
-			flow->current_block_bytes_written += rc;
-			foreach(int *i, INTERVAL, FINAL)
-				flow->statistics[*i].bytes_written += rc;
-
-			if (flow->current_block_bytes_written >=
-			    (unsigned)requested_response_block_size) {
-				assert(flow->current_block_bytes_written ==
-					(unsigned)requested_response_block_size);
-				/* just finish sending response block */
-				flow->current_block_bytes_written = 0;
-				gettime(&flow->last_block_written);
-				foreach(int *i, INTERVAL, FINAL)
-					flow->statistics[*i].response_blocks_written++;
+				rc = 0;
 				break;
 			}
+			logging(LOG_WARNING, "premature end of test: %s, abort "
+				"flow", strerror(errno));
+			flow->finished[READ] = 1;
+			break;
 		}
+
+		foreach(int *i, INTERVAL, FINAL)
+			flow->statistics[*i].bytes_written += rc;
+		flow->response_bytes_written += rc;
+		if (flow->response_bytes_written < size)
+			continue;
+
+		/* just finish sending response block */
+		flow->response_bytes_written = 0;
+		flow->responses_head = (flow->responses_head + 1) %
+				       flow->responses_size;
+		flow->responses_queued--;
+		flow->last_block_written = flow->worker->now;
+		foreach(int *i, INTERVAL, FINAL)
+			flow->statistics[*i].response_blocks_written++;
+	}
+
+#ifdef HAVE_EPOLL
+	/* Receiving continues on the connection of the request */
+	if (flow->conns)
+		connections_switch(flow, current);
+#endif /* HAVE_EPOLL */
+	return rc == -1 ? -1 : 0;
+}
+
+/**
+ * Queue a response block to the request block just read.
+ *
+ * The response is sent right away as far as the socket takes it, the rest
+ * once the socket becomes writable.
+ *
+ * @param[in,out] flow flow that read the request block
+ * @param[in] requested_response_block_size size of the response block
+ */
+static void send_response(struct flow* flow, int requested_response_block_size)
+{
+	if (flow->responses_queued == flow->responses_size &&
+	    grow_response_queue(flow) == -1) {
+		logging(LOG_WARNING, "dropping response block of flow %d, "
+			"out of memory", flow->id);
+		return;
+	}
+
+	struct block *response = &flow->responses[(flow->responses_head +
+						   flow->responses_queued) %
+						  flow->responses_size];
+
+	/* write requested block size as current size */
+	response->this_block_size = htonl(requested_response_block_size);
+	/* rqs = -1 indicates response block */
+	response->request_block_size = htonl(-1);
+	/* copy rtt data from received block to response block (echo back) */
+	response->data = ((struct block *)flow->read_block)->data;
+	response->scheduled = ((struct block *)flow->read_block)->scheduled;
+#ifdef HAVE_EPOLL
+	if (flow->conns)
+		flow->conns->responses[response - flow->responses] =
+			flow->conns->current;
+#endif /* HAVE_EPOLL */
+	flow->responses_queued++;
+
+	DEBUG_MSG(LOG_DEBUG, "queued response block bs = %d on flow %d, %u "
+		  "responses queued", requested_response_block_size, flow->id,
+		  flow->responses_queued);
+
+	bool send_idle = true;
+#ifdef HAVE_LIBURING
+	/* An io_uring send may be in flight for a new request block */
+	send_idle = !(flow->uring_pending & URING_SEND);
+#endif /* HAVE_LIBURING */
+	if (send_idle)
+		send_queued_responses(flow);
+	if (!flow->responses_queued)
+		return;
+
+	/* Wait for the socket becoming writable */
+#ifdef HAVE_LIBURING
+	if (flow->worker->uring) {
+		if (send_idle)
+			uring_send(flow);
+		return;
 	}
+#endif /* HAVE_LIBURING */
+#ifdef HAVE_EPOLL
+	watch_flow(flow, flow->watched_events | EPOLLOUT);
+#endif /* HAVE_EPOLL */
 }
 
 
@@ -1420,6 +3774,142 @@ int apply_extra_socket_options(struct flow *flow)
 	return 0;
 }
 
+/**
+ * Check whether the daemon can handle a flow with @p settings.
+ *
+ * The connections of CRR flows and flows with many connections are set up
+ * and switched by the select or epoll loop, which neither io_uring nor the
+ * zerocopy state of a flow follow. Many connections are only feasible with
+ * epoll.
+ *
+ * @param[in] settings settings of the flow to add
+ * @return NULL if the flow can be added, otherwise the reason why not
+ */
+const char *unsupported_flow(const struct flow_settings *settings)
+{
+	bool uring = false;
+	bool zerocopy = settings->zerocopy || settings->zerocopy_receive;
+
+#ifdef HAVE_LIBURING
+	uring = use_io_uring;
+#endif /* HAVE_LIBURING */
+
+	if (settings->crr && (uring || zerocopy))
+		return "CRR flows are not supported with io_uring or zerocopy";
+	if (settings->connections > 1) {
+#ifndef HAVE_EPOLL
+		return "flows with many connections need epoll";
+#endif /* HAVE_EPOLL */
+		/* A block sent with MSG_MORE would be held back until the
+		 * next block on the same connection */
+		if (uring || zerocopy || settings->crr || settings->msg_more)
+			return "flows with many connections are not supported "
+			       "with io_uring, zerocopy, CRR or MSG_MORE";
+	}
+	/* Each connection would have to introduce itself with a hello */
+	if (settings->shared_listener &&
+	    (uring || settings->crr || settings->connections > 1))
+		return "shared listeners are not supported with io_uring, "
+		       "CRR or many connections";
+	/* Only the copying receive calls return the timestamps */
+	if (settings->timestamping && (uring || settings->zerocopy_receive))
+		return "SO_TIMESTAMPING is not supported with io_uring or "
+		       "TCP_ZEROCOPY_RECEIVE";
+	if (settings->tx_timestamps) {
+#ifndef HAVE_SO_TIMESTAMPING
+		return "transmit timestamps need SO_TIMESTAMPING";
+#endif /* HAVE_SO_TIMESTAMPING */
+		/* The timestamps are requested along with a sendmsg() and
+		 * keyed by the offset in the stream of a single connection */
+		if (uring || settings->zerocopy || *settings->payload_file ||
+		    settings->crr || settings->connections > 1)
+			return "transmit timestamps are not supported with "
+			       "io_uring, zerocopy, a payload file, CRR or "
+			       "many connections";
+	}
+	return NULL;
+}
+
+/**
+ * Get the payload shared by all flows sending blocks of up to @p size bytes.
+ *
+ * The payload consists of zeros, or with byte counting of the block offset of
+ * each byte modulo 256. A larger payload replaces the current one, but the
+ * old one is never released since flows may still send from it.
+ *
+ * @param[in] size maximum block size of the flow
+ * @param[in] byte_counting whether the payload counts the bytes of a block
+ * @return payload holding each byte at its offset in a block, NULL if out of
+ * memory
+ */
+const char *get_shared_payload(int size, int byte_counting)
+{
+	const char *data;
+
+	pthread_mutex_lock(&shared_payload_mutex);
+	struct shared_payload *payload = &shared_payloads[!!byte_counting];
+	if (payload->size < size) {
+		int new_size = MAX(size, 2 * payload->size);
+		char *new_data = calloc(1, new_size);
+		if (!new_data) {
+			pthread_mutex_unlock(&shared_payload_mutex);
+			return NULL;
+		}
+		if (byte_counting)
+			for (int i = 0; i < new_size; i++)
+				new_data[i] = (unsigned char)(i & 0xff);
+		payload->data = new_data;
+		payload->size = new_size;
+	}
+	data = payload->data;
+	pthread_mutex_unlock(&shared_payload_mutex);
+
+	return data;
+}
+
+/**
+ * Open the file the payload of the write blocks of @p flow is sent from.
+ *
+ * Does nothing if the flow sends its payload from memory.
+ *
+ * @param[in,out] flow flow to open the payload file for
+ * @return 0 on success, -1 on failure with the flow error set
+ */
+int open_payload_file(struct flow *flow)
+{
+	if (!*flow->settings.payload_file)
+		return 0;
+
+#ifdef HAVE_SENDFILE
+	struct stat st;
+
+	flow->payload_fd = open(flow->settings.payload_file, O_RDONLY);
+	if (flow->payload_fd == -1) {
+		flow_error(flow, "Unable to open payload file %s: %s",
+			   flow->settings.payload_file, strerror(errno));
+		return -1;
+	}
+	if (fstat(flow->payload_fd, &st) == -1) {
+		flow_error(flow, "Unable to stat payload file %s: %s",
+			   flow->settings.payload_file, strerror(errno));
+		return -1;
+	}
+	if (!S_ISREG(st.st_mode) || !st.st_size) {
+		flow_error(flow, "Payload file %s is not a non-empty regular "
+			   "file", flow->settings.payload_file);
+		return -1;
+	}
+	flow->payload_size = st.st_size;
+	flow->payload_offset = 0;
+
+	return 0;
+#else /* HAVE_SENDFILE */
+	flow_error(flow, "Unable to send payload from file: sendfile() not "
+		   "supported");
+	return -1;
+#endif /* HAVE_SENDFILE */
+}
+
 /* Set the TCP options on the data socket */
 int set_flow_tcp_options(struct flow *flow)
 {
@@ -1442,6 +3932,39 @@ int set_flow_tcp_options(struct flow *flow)
 			   strerror(errno));
 		return -1;
 	}
+	if (flow->settings.zerocopy && set_so_zerocopy(flow->fd) == -1) {
+		flow_error(flow, "Unable to set SO_ZEROCOPY: %s",
+			   strerror(errno));
+		return -1;
+	}
+#ifdef HAVE_SO_ZEROCOPY
+	/* sendfile() sends the payload file without copying anyway */
+	if (flow->settings.zerocopy && !*flow->settings.payload_file &&
+	    zerocopy_init(flow) == -1) {
+		flow_error(flow, "Unable to set up zerocopy transmission: %s",
+			   strerror(errno));
+		return -1;
+	}
+#endif /* HAVE_SO_ZEROCOPY */
+	if (flow->settings.zerocopy_receive) {
+#ifdef HAVE_TCP_ZEROCOPY_RECEIVE
+		if (zerocopy_receive_init(flow) == -1) {
+			flow_error(flow, "Unable to map receive area for "
+				   "TCP_ZEROCOPY_RECEIVE: %s", strerror(errno));
+			return -1;
+		}
+#else /* HAVE_TCP_ZEROCOPY_RECEIVE */
+		flow_error(flow, "Unable to use TCP_ZEROCOPY_RECEIVE: %s",
+			   strerror(ENOPROTOOPT));
+		return -1;
+#endif /* HAVE_TCP_ZEROCOPY_RECEIVE */
+	}
+	if (flow->settings.timestamping &&
+	    set_so_timestamping(flow->fd, 1, 0) == -1) {
+		flow_error(flow, "Unable to set SO_TIMESTAMPING: %s",
+			   strerror(errno));
+		return -1;
+	}
 	if (flow->settings.cork && set_tcp_cork(flow->fd) == -1) {
 		flow_error(flow, "Unable to set TCP_CORK: %s",
 			   strerror(errno));
@@ -1479,20 +4002,158 @@ int set_flow_tcp_options(struct flow *flow)
 			   strerror(errno));
 		return -1;
 	}
+	if (flow->settings.notsent_lowat &&
+	    set_tcp_notsent_lowat(flow->fd,
+				  flow->settings.notsent_lowat) == -1) {
+		flow_error(flow, "Unable to set TCP_NOTSENT_LOWAT: %s",
+			   strerror(errno));
+		return -1;
+	}
+	if (flow->settings.rcvlowat &&
+	    set_so_rcvlowat(flow->fd, flow->settings.rcvlowat) == -1) {
+		flow_error(flow, "Unable to set SO_RCVLOWAT: %s",
+			   strerror(errno));
+		return -1;
+	}
 	if (apply_extra_socket_options(flow) == -1)
 		return -1;
 
+	/* Optional, only saves a receive call per readable event */
+	if (set_tcp_inq(flow->fd) == -1)
+		DEBUG_MSG(LOG_NOTICE, "unable to set TCP_INQ on flow %d: %s",
+			  flow->id, strerror(errno));
+
 	return 0;
 }
 
-/* Dispatch an incoming request to daemon thread */
-int dispatch_request(struct request *request, int type)
+/**
+ * Initialize a worker.
+ *
+ * Creates the wakeup pipe and event backend of the worker. The worker thread
+ * itself is started by running daemon_main() on it.
+ *
+ * @param[out] worker worker to initialize
+ * @param[in] id index of the worker
+ * @param[in] core CPU core to bind the worker to, -1 for none
+ */
+void init_worker(struct worker *worker, unsigned id, int core)
+{
+	int flags;
+
+	memset(worker, 0, sizeof(struct worker));
+	worker->id = id;
+	worker->core = core;
+
+	if (pipe(worker->pipe) == -1)
+		crit("could not create pipe");
+
+	if ((flags = fcntl(worker->pipe[0], F_GETFL, 0)) == -1)
+		flags = 0;
+	fcntl(worker->pipe[0], F_SETFL, flags | O_NONBLOCK);
+
+	pthread_mutex_init(&worker->mutex, NULL);
+	fg_list_init(&worker->flows);
+	fg_heap_init(&worker->timers);
+
+	worker->recv_buffer = malloc(RECV_BUFFER_SIZE);
+	if (!worker->recv_buffer)
+		crit("could not allocate receive buffer");
+
+#ifdef HAVE_EPOLL
+	worker->epollfd = epoll_create1(EPOLL_CLOEXEC);
+	worker->listen_epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if (worker->epollfd == -1 || worker->listen_epollfd == -1)
+		crit("epoll_create1() failed");
+#endif /* HAVE_EPOLL */
+
+#ifdef HAVE_LIBURING
+	/* Fall back to the readiness based event loop */
+	if (use_io_uring)
+		worker->uring = (init_uring(worker) == 0);
+#endif /* HAVE_LIBURING */
+}
+
+/* Number of flows handled by @p worker, safe to call from any thread */
+static unsigned worker_num_flows(struct worker *worker)
+{
+	pthread_mutex_lock(&worker->mutex);
+	unsigned num_flows = worker->num_flows;
+	pthread_mutex_unlock(&worker->mutex);
+
+	return num_flows;
+}
+
+/**
+ * Number of flows handled by all workers.
+ *
+ * The workers keep adding and removing flows, so the result is only a
+ * snapshot.
+ */
+unsigned daemon_num_flows(void)
+{
+	unsigned num_flows = 0;
+
+	for (unsigned i = 0; i < num_workers; i++)
+		num_flows += worker_num_flows(&workers[i]);
+
+	return num_flows;
+}
+
+/**
+ * Choose the worker a new flow is assigned to.
+ *
+ * A flow that requests a specific CPU core is assigned to the worker bound to
+ * it, otherwise the placement policy decides.
+ *
+ * @param[in] settings settings of the new flow
+ * @param[in,out] request request to report an error with
+ * @return worker for the flow, NULL on error
+ */
+static struct worker *select_worker(const struct flow_settings *settings,
+				    struct request *request)
+{
+	static unsigned next_worker = 0;
+	struct worker *worker = NULL;
+
+	if (settings->cpu >= 0) {
+		for (unsigned i = 0; i < num_workers; i++)
+			if (workers[i].core == settings->cpu)
+				return &workers[i];
+		request_error(request, "No worker bound to CPU core %d",
+			      settings->cpu);
+		return NULL;
+	}
+
+	switch (placement_policy) {
+	case PLACEMENT_LEAST_LOADED:
+		{
+			unsigned least_flows = 0;
+			for (unsigned i = 0; i < num_workers; i++) {
+				unsigned num_flows =
+					worker_num_flows(&workers[i]);
+				if (!worker || num_flows < least_flows) {
+					worker = &workers[i];
+					least_flows = num_flows;
+				}
+			}
+		}
+		break;
+	case PLACEMENT_ROUND_ROBIN:
+	default:
+		worker = &workers[next_worker++ % num_workers];
+		break;
+	}
+
+	return worker;
+}
+
+/* Hand a request to a worker and wait until the worker has processed it */
+static int dispatch_to_worker(struct worker *worker, struct request *request)
 {
 	pthread_cond_t cond;
 
-	request->error = NULL;
-	request->type = type;
 	request->next = NULL;
+	request->done = 0;
 
 	/* Create synchronization mutex */
 	if (pthread_cond_init(&cond, NULL)) {
@@ -1501,21 +4162,117 @@ int dispatch_request(struct request *request, int type)
 	}
 	request->condition = &cond;
 
-	pthread_mutex_lock(&mutex);
+	pthread_mutex_lock(&worker->mutex);
 
-	if (!requests) {
-		requests = request;
-		requests_last = request;
+	if (!worker->requests) {
+		worker->requests = request;
+		worker->requests_last = request;
 	} else {
-		requests_last->next = request;
-		requests_last = request;
+		worker->requests_last->next = request;
+		worker->requests_last = request;
 	}
-	if (write(daemon_pipe[1], &type, 1) != 1) /* Doesn't matter what we write */
+	/* Doesn't matter what we write */
+	if (write(worker->pipe[1], &request->type, 1) != 1) {
+		pthread_mutex_unlock(&worker->mutex);
+		pthread_cond_destroy(&cond);
+		request_error(request, "Could not wake up worker thread");
 		return -1;
-	/* Wait until the daemon thread has processed the request */
-	pthread_cond_wait(&cond, &mutex);
+	}
+	/* Wait until the worker thread has processed the request */
+	while (!request->done)
+		pthread_cond_wait(&cond, &worker->mutex);
+
+	pthread_mutex_unlock(&worker->mutex);
+	pthread_cond_destroy(&cond);
+
+	return 0;
+}
+
+/* Dispatch a request concerning a single flow to the worker handling it */
+static void dispatch_to_flow(struct request *request)
+{
+	bool found = false;
+
+	/* The flow may be on any worker (or even on two of them, if both
+	 * endpoints are handled by this daemon) */
+	for (unsigned i = 0; i < num_workers; i++) {
+		dispatch_to_worker(&workers[i], request);
+		if (!request->error) {
+			found = true;
+			continue;
+		}
+		free(request->error);
+		request->error = NULL;
+	}
+	if (!found)
+		request_error(request, "Unknown flow id");
+}
+
+/* Dispatch an incoming request to the worker threads */
+int dispatch_request(struct request *request, int type)
+{
+	struct worker *worker = NULL;
+
+	request->error = NULL;
+	request->type = type;
+
+	pthread_mutex_lock(&dispatch_mutex);
+
+	switch (type) {
+	case REQUEST_ADD_DESTINATION:
+		worker = select_worker(&((struct request_add_flow_destination *)
+					 request)->settings, request);
+		if (worker)
+			dispatch_to_worker(worker, request);
+		break;
+	case REQUEST_ADD_SOURCE:
+		worker = select_worker(&((struct request_add_flow_source *)
+					 request)->settings, request);
+		if (worker)
+			dispatch_to_worker(worker, request);
+		break;
+	case REQUEST_START_FLOWS:
+		{
+			struct request_start_flows *r =
+				(struct request_start_flows *)request;
+			struct timespec now;
+
+			/* The flows are scheduled by the monotonic clock, the
+			 * start they are armed for is given in wall-clock
+			 * time */
+			gettime_mono(&r->start);
+			if (r->start_at.tv_sec || r->start_at.tv_nsec) {
+				gettime(&now);
+				time_add_ns(&r->start,
+					    time_diff_ns(&now, &r->start_at));
+			}
+		}
+		for (unsigned i = 0; i < num_workers && !request->error; i++)
+			dispatch_to_worker(&workers[i], request);
+		break;
+	case REQUEST_STOP_FLOW:
+		if (((struct request_stop_flow *)request)->flow_id == -1) {
+			for (unsigned i = 0; i < num_workers; i++)
+				dispatch_to_worker(&workers[i], request);
+			break;
+		}
+		dispatch_to_flow(request);
+		break;
+	case REQUEST_SET_CLOCK:
+		dispatch_to_flow(request);
+		break;
+	case REQUEST_GET_STATUS:
+		((struct request_get_status *)request)->started = 0;
+		((struct request_get_status *)request)->num_flows = 0;
+		for (unsigned i = 0; i < num_workers; i++)
+			dispatch_to_worker(&workers[i], request);
+		break;
+	default:
+		dispatch_to_worker(&workers[0], request);
+		break;
+	}
 
-	pthread_mutex_unlock(&mutex);
+	pthread_mutex_unlock(&dispatch_mutex);
 
 	if (request->error)
 		return -1;
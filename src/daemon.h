@@ -34,12 +34,20 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/select.h>
+#include <pthread.h>
+#include <stdbool.h>
 
 #ifdef HAVE_LIBGSL
 #include <gsl/gsl_rng.h>
 #endif /* HAVE_LIBGSL */
 
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif /* HAVE_LIBURING */
+
 #include "common.h"
+#include "fg_heap.h"
 #include "fg_list.h"
 
 #include <xmlrpc-c/base.h>
@@ -47,9 +55,6 @@
 #include <xmlrpc-c/server_abyss.h>
 #include <xmlrpc-c/util.h>
 
-/** Time select() will block waiting for a file descriptor to become ready. */
-#define DEFAULT_SELECT_TIMEOUT  10000000
-
 enum flow_state_t
 {
 	/* SOURCE */
@@ -66,27 +71,135 @@ struct flow_source_settings
 	int destination_port;
 
 	int late_connect;
+	/** Hello sent ahead of the data to a shared listener of the
+	 * destination daemon, empty if the destination has its own listen
+	 * socket. */
+	char hello[HELLO_SIZE + 1];
 
 	pthread_cond_t* add_source_condition;
 };
 
+struct worker;
+#ifdef HAVE_EPOLL
+struct connections;
+struct handoff;
+struct hello_socket;
+#endif /* HAVE_EPOLL */
+#ifdef HAVE_SO_ZEROCOPY
+struct zerocopy;
+#endif /* HAVE_SO_ZEROCOPY */
+#ifdef HAVE_TCP_ZEROCOPY_RECEIVE
+struct zerocopy_receive;
+#endif /* HAVE_TCP_ZEROCOPY_RECEIVE */
+#ifdef HAVE_SO_TIMESTAMPING
+struct txstamp;
+#endif /* HAVE_SO_TIMESTAMPING */
+
 struct flow
 {
 	int id;
 
+	/** Worker thread this flow is handled by. */
+	struct worker *worker;
+	/** Element of this flow in the flow list of its worker. */
+	const struct list_node *list_node;
+	/** Next flow in the same bucket of the flow index of its worker. */
+	struct flow *index_next;
+
 	enum flow_state_t state;
 	enum endpoint_t endpoint;
 
 	int fd;
 	int listenfd_data;
 
+#ifdef HAVE_EPOLL
+	/** Socket of this flow currently registered with epoll, or -1. */
+	int watched_fd;
+	/** Events the daemon currently waits for on @p watched_fd. */
+	uint32_t watched_events;
+	/** Connections of a flow with many connections, NULL if the flow
+	 * has a single data connection. The data socket refers to one of
+	 * them at a time. */
+	struct connections *conns;
+#endif /* HAVE_EPOLL */
+
+#ifdef HAVE_LIBURING
+	/** io_uring operations of this flow currently in flight. */
+	unsigned uring_pending;
+	/** Number of header bytes sent by a send linked to the pending
+	 * send of the payload. */
+	unsigned uring_send_header;
+	/** The last send found the socket buffer full, wait for it to become
+	 * writable before sending again. */
+	bool uring_send_blocked;
+	/** The pending send operation only polls for writability. */
+	bool uring_send_polling;
+	/** Flow has been removed while io_uring operations were in flight.
+	 * It is freed once they completed. */
+	char uring_retired;
+#endif /* HAVE_LIBURING */
+
+#ifdef HAVE_SO_ZEROCOPY
+	/** Zerocopy state of the flow, NULL if it copies its blocks. */
+	struct zerocopy *zc;
+#endif /* HAVE_SO_ZEROCOPY */
+
+#ifdef HAVE_TCP_ZEROCOPY_RECEIVE
+	/** Mapped receive state of the flow, NULL if it copies received
+	 * data. */
+	struct zerocopy_receive *zr;
+#endif /* HAVE_TCP_ZEROCOPY_RECEIVE */
+
+#ifdef HAVE_SO_TIMESTAMPING
+	/** Transmit timestamp state of the flow, NULL if it samples no
+	 * blocks. */
+	struct txstamp *tx;
+#endif /* HAVE_SO_TIMESTAMPING */
+
+#ifdef HAVE_SENDFILE
+	/** File the payload of the write blocks is sent from, or -1. */
+	int payload_fd;
+	/** Size of the payload file. */
+	off_t payload_size;
+	/** Offset in the payload file the next payload byte is sent from. */
+	off_t payload_offset;
+#endif /* HAVE_SENDFILE */
+
 	struct flow_settings settings;
 	struct flow_source_settings source_settings;
 
+	/* The points in time the flow is scheduled by are taken from the
+	 * monotonic clock, see gettime_mono() */
 	struct timespec start_timestamp[2];
 	struct timespec stop_timestamp[2];
+	/** The flow waits for the start it was armed for. */
+	bool start_armed;
+	/** Time the flow started after the start it was armed for, in
+	 * seconds. */
+	double start_error;
+	/** Wall-clock time the last request block was read. */
 	struct timespec last_block_read;
 	struct timespec last_block_written;
+	/** Wall-clock time the last receive call returned. The blocks it
+	 * completed count as read at this time. */
+	struct timespec recv_time;
+	/** Kernel receive timestamp of the data returned by the last receive
+	 * call, zero if it carried none (option -O SO_TIMESTAMPING). */
+	struct timespec rx_timestamp;
+	/** Kernel receive timestamp of the last request block read. */
+	struct timespec last_block_arrival;
+
+	/** Offset of the wall clock of this daemon to the one of the source
+	 * daemon at @p clock_reference, in seconds. Estimated by the
+	 * controller and subtracted from the one-way delays. */
+	double clock_offset;
+	/** Drift of @p clock_offset, in seconds per second. */
+	double clock_drift;
+	/** Error bound of @p clock_offset in seconds, 0 if no estimate is
+	 * known. */
+	double clock_error;
+	/** Wall-clock time the estimate was received. */
+	struct timespec clock_reference;
 
 	struct timespec first_report_time;
 	struct timespec last_report_time;
@@ -94,8 +207,29 @@ struct flow
 
 	struct timespec next_write_block_timestamp;
 
+	/** Earliest point in time the worker has to look after this flow
+	 * again, e.g. to write the next block or to report. */
+	struct heap_node timer;
+
+	/** Header of the block currently received. The payload is not
+	 * kept. */
 	char *read_block;
+	/** Header of the block currently sent. */
 	char *write_block;
+	/** Payload of the blocks sent, shared with the other flows. Holds each
+	 * byte at its offset in the block, the part of the header is unused. */
+	const char *payload;
+
+	/** Headers of the response blocks waiting to be sent, a ring. */
+	struct block *responses;
+	/** Number of headers the ring of responses can hold. */
+	unsigned responses_size;
+	/** Position of the response sent next in the ring. */
+	unsigned responses_head;
+	/** Number of queued response blocks. */
+	unsigned responses_queued;
+	/** Number of bytes sent of the response sent next. */
+	unsigned response_bytes_written;
 
 	unsigned current_write_block_size;
 	unsigned current_read_block_size;
@@ -103,6 +237,26 @@ struct flow
 	unsigned current_block_bytes_read;
 	unsigned current_block_bytes_written;
 
+	/** Gap between the current write block and the next one, drawn when
+	 * the current block is prepared. */
+	double interpacket_gap;
+	/** Send the current write block with MSG_MORE since more blocks
+	 * follow before the next flush. */
+	char write_more;
+	/** Number of write blocks sent with MSG_MORE since the last flush. */
+	unsigned corked_blocks;
+
+	/** Budget of a pushy flow left for the current round per direction,
+	 * negative if the last operation overdrew it. */
+	int64_t deficit[2];
+	/** Amount of data moved per direction when the current round
+	 * started. */
+	uint64_t budget_mark[2];
+
+	/** Number of request blocks sent whose response has not been read
+	 * yet. Only counted if the pipeline depth is limited. */
+	unsigned requests_outstanding;
+
 	unsigned short requested_server_test_port;
 
 	unsigned real_listen_send_buffer_size;
@@ -111,6 +265,25 @@ struct flow
 	char connect_called;
 	char finished[2];
 
+	/** Number of bytes of the hello of a source still to be sent before
+	 * the data. */
+	unsigned hello_left;
+	/** Nonce of the hello a destination waits for on a shared
+	 * listener. */
+	uint32_t hello_nonce;
+
+	/** Listen socket of a CRR destination while it serves a
+	 * connection. */
+	int crr_listenfd;
+	/** Point in time the current connection of a CRR source was
+	 * initiated. */
+	struct timespec crr_connect_start;
+	/** The CRR source waits for its connection to become usable. */
+	char crr_connecting;
+	/** The current connection of a CRR flow served its transaction and
+	 * is closed once the event at hand is handled. */
+	char crr_done;
+
 	int pmtu;
 
 	unsigned congestion_counter;
@@ -123,17 +296,46 @@ struct flow
 #ifdef HAVE_UNSIGNED_LONG_LONG_INT
 		unsigned long long bytes_read;
 		unsigned long long bytes_written;
+		/** Received payload bytes dropped without copying them. */
+		unsigned long long bytes_discarded;
 #else /* HAVE_UNSIGNED_LONG_LONG_INT */
 		long bytes_read;
 		long bytes_written;
+		long bytes_discarded;
 #endif /* HAVE_UNSIGNED_LONG_LONG_INT */
 		unsigned request_blocks_read;
 		unsigned request_blocks_written;
 		unsigned response_blocks_read;
 		unsigned response_blocks_written;
+		/** Number of sends of a zerocopy flow. */
+		unsigned zerocopy_sends;
+		/** Number of zerocopy sends that were copied nevertheless. */
+		unsigned zerocopy_copied;
+		/** Number of events handled on the data socket. */
+		unsigned wakeups;
+		/** Number of rounds a pushy flow yielded to other flows since
+		 * its budget was used up. */
+		unsigned budget_exhausted;
+		/** Number of connections established by a CRR flow. */
+		unsigned connects;
+		/** Number of connects of a CRR flow that failed for lack of
+		 * a local port. */
+		unsigned connect_failures;
+		/** Minimum time from connect() until the connection is
+		 * usable. */
+		double connect_time_min;
+		/** Maximum time from connect() until the connection is
+		 * usable. */
+		double connect_time_max;
+		/** Accumulated time from connect() until the connection is
+		 * usable. */
+		double connect_time_sum;
 
 		/* TODO Create an array for IAT / RTT and delay */
 
+		/** Number of interarrival times taken. Blocks completed by
+		 * the same receive call as the one before have none. */
+		unsigned iat_samples;
 		/** Minimum interarrival time. */
 		double iat_min;
 		/** Maximum interarrival time. */
@@ -152,6 +354,49 @@ struct flow
 		double rtt_max;
 		/** Accumulated round-trip time. */
 		double rtt_sum;
+		/** Maximum one-way delay from the scheduled send time,
+		 * including the time the block waited to be sent. */
+		double sched_delay_max;
+		/** Accumulated one-way delay from the scheduled send
+		 * time. */
+		double sched_delay_sum;
+		/** Maximum round-trip time from the scheduled send time. */
+		double sched_rtt_max;
+		/** Accumulated round-trip time from the scheduled send
+		 * time. */
+		double sched_rtt_sum;
+		/** Number of request blocks with a kernel receive
+		 * timestamp. */
+		unsigned kernel_blocks;
+		/** Number of interarrival times taken by the kernel receive
+		 * timestamps. */
+		unsigned kernel_iat_samples;
+		/** Minimum interarrival time by the kernel receive
+		 * timestamps. */
+		double kernel_iat_min;
+		/** Maximum interarrival time by the kernel receive
+		 * timestamps. */
+		double kernel_iat_max;
+		/** Accumulated interarrival time by the kernel receive
+		 * timestamps. */
+		double kernel_iat_sum;
+		/** Minimum one-way delay by the kernel receive timestamps. */
+		double kernel_delay_min;
+		/** Maximum one-way delay by the kernel receive timestamps. */
+		double kernel_delay_max;
+		/** Accumulated one-way delay by the kernel receive
+		 * timestamps. */
+		double kernel_delay_sum;
+		/** Number of request blocks that passed each transmit
+		 * stage, by the transmit timestamps of the sampled blocks. */
+		unsigned tx_samples[TX_STAGES];
+		/** Minimum time a block spent in each transmit stage. */
+		double tx_min[TX_STAGES];
+		/** Maximum time a block spent in each transmit stage. */
+		double tx_max[TX_STAGES];
+		/** Accumulated time the blocks spent in each transmit
+		 * stage. */
+		double tx_sum[TX_STAGES];
 
 		int has_tcp_info;
 		struct fg_tcp_info tcp_info;
@@ -176,6 +421,7 @@ struct flow
 #define REQUEST_STOP_FLOW 3
 #define REQUEST_GET_STATUS 4
 #define REQUEST_GET_UUID 5
+#define REQUEST_SET_CLOCK 6
 struct request
 {
 	char type;
@@ -183,12 +429,13 @@ struct request
 	/* We signal this condition once the daemon thread
 	 * has processed the request */
 	pthread_cond_t* condition;
+	/** Set by the worker once the request has been processed. */
+	char done;
 
 	char* error;
 
 	struct request *next;
 };
-extern struct request *requests, *requests_last;
 
 struct request_add_flow_destination
 {
@@ -201,6 +448,9 @@ struct request_add_flow_destination
 	int listen_data_port;
 	int real_listen_send_buffer_size;
 	int real_listen_read_buffer_size;
+	/** Hello the source has to send to a shared listener, empty if the
+	 * flow has its own listen socket. */
+	char hello[HELLO_SIZE + 1];
 };
 
 struct request_add_flow_source
@@ -221,7 +471,12 @@ struct request_start_flows
 {
 	struct request r;
 
-	int start_timestamp;
+	/** Wall-clock time the flows are armed to start at, zero to start
+	 * them right away. */
+	struct timespec start_at;
+
+	/** Common start time of the flows of all workers. */
+	struct timespec start;
 };
 
 struct request_stop_flow
@@ -244,6 +499,22 @@ struct request_get_uuid
 	char server_uuid[38]; /**< UUID from the daemon. */
 };
 
+/** Estimated offset of the clock of the source daemon of a flow. */
+struct request_set_clock
+{
+	struct request r;
+
+	/** ID of the destination flow. */
+	int flow_id;
+	/** Offset of the wall clock of this daemon to the one of the source
+	 * daemon now, in seconds. */
+	double offset;
+	/** Drift of the offset, in seconds per second. */
+	double drift;
+	/** Error bound of the offset, in seconds. */
+	double error;
+};
+
 struct request_get_status
 {
 	struct request r;
@@ -252,17 +523,95 @@ struct request_get_status
 	int num_flows;
 };
 
-extern pthread_t daemon_thread;
+/** Policies to distribute new flows among the worker threads. */
+enum placement_policy {
+	/** Assign flows to the workers in turn. */
+	PLACEMENT_ROUND_ROBIN = 0,
+	/** Assign a flow to the worker currently handling the fewest flows. */
+	PLACEMENT_LEAST_LOADED,
+};
 
-/* Through this pipe we wakeup the thread from select */
-extern int daemon_pipe[2];
+/**
+ * A worker thread of the daemon.
+ *
+ * Each worker runs its own event loop on its own share of the flows. Flows
+ * never migrate between workers.
+ */
+struct worker
+{
+	/** Index of the worker. */
+	unsigned id;
+	/** CPU core the worker is bound to, -1 if not bound. */
+	int core;
+
+	pthread_t thread;
+
+	/** Through this pipe we wakeup the worker from select. */
+	int pipe[2];
+
+	/** Protects the request and report queues of the worker. */
+	pthread_mutex_t mutex;
+	struct request *requests, *requests_last;
+
+	struct linked_list flows;
+	/** Number of flows in @p flows, protected by the mutex. Other threads
+	 * read this instead of the list owned by the worker. */
+	unsigned num_flows;
+	char started;
+
+	/** Hash index of the flows by flow ID and endpoint. */
+	struct flow **flow_index;
+	/** Number of buckets of the flow index, a power of two. */
+	size_t flow_index_size;
+
+	/** Timers of the flows, ordered by expiry. */
+	struct min_heap timers;
+	/** Monotonic time of the current iteration of the event loop. Taken
+	 * once before the worker waits and once after, the flows handled in
+	 * between are scheduled by it. */
+	struct timespec now;
+
+	struct report *reports, *reports_last;
+	unsigned pending_reports;
+
+	/** Buffer the flows of the worker receive their data stream into.
+	 * It holds no data between two receives. */
+	char *recv_buffer;
+
+#ifdef HAVE_EPOLL
+	/** The epoll instance of the worker. */
+	int epollfd;
+	/** epoll instance of the sockets of the shared listeners of the
+	 * worker and of the connections waiting for their hello. */
+	int listen_epollfd;
+	/** Accepted connections waiting for their hello. */
+	struct hello_socket *hellos;
+	/** Connections accepted by other workers for flows of this worker,
+	 * protected by the mutex. */
+	struct handoff *handoffs;
+#else /* HAVE_EPOLL */
+	fd_set rfds, wfds, efds;
+	int maxfd;
+#endif /* HAVE_EPOLL */
+
+#ifdef HAVE_LIBURING
+	/** The worker uses io_uring for the flow sockets. */
+	bool uring;
+	/** The io_uring instance of the worker. */
+	struct io_uring ring;
+	/** The receive buffer is registered with the io_uring as fixed
+	 * buffer 0. */
+	bool uring_fixed_recv;
+#endif /* HAVE_LIBURING */
+};
 
-extern char started;
-extern pthread_mutex_t mutex;
-extern struct linked_list flows;
-extern struct report* reports;
-extern struct report* reports_last;
-extern unsigned pending_reports;
+extern struct worker *workers;
+extern unsigned num_workers;
+extern enum placement_policy placement_policy;
+#ifdef HAVE_LIBURING
+extern bool use_io_uring;
+extern bool use_registered_buffers;
+#endif /* HAVE_LIBURING */
 
 /* Gets 50 reports. There may be more pending but there's a limit on how
  * large a reply can get */
@@ -271,11 +620,18 @@ struct report* get_reports(int *has_more);
 extern char *dump_prefix;
 extern char *dump_dir;
 
+void init_worker(struct worker *worker, unsigned id, int core);
+unsigned daemon_num_flows(void);
 void *daemon_main(void* ptr);
-void add_report(struct report* report);
+int add_flow(struct worker *worker, struct flow *flow);
+void add_report(struct worker *worker, struct report* report);
 void flow_error(struct flow *flow, const char *fmt, ...);
 void request_error(struct request *request, const char *fmt, ...);
 int set_flow_tcp_options(struct flow *flow);
+int open_payload_file(struct flow *flow);
+const char *get_shared_payload(int size, int byte_counting);
+void unwatch_flow(struct flow *flow);
+const char *unsupported_flow(const struct flow_settings *settings);
 
 /** Dispatch a request to daemon loop.
  * Is called by the rpc server to feed in requests to the daemon. */
@@ -60,6 +60,11 @@
 #include "fg_math.h"
 #include "fg_log.h"
 #include "daemon.h"
+#include "destination.h"
+#include "fg_definitions.h"
+#include "fg_connections.h"
+#include "fg_listener.h"
+#include "fg_txstamp.h"
 
 #ifdef HAVE_LIBPCAP
 #include "fg_pcap.h"
@@ -127,7 +132,18 @@ static int create_listen_socket(struct flow *flow, char *bind_addr,
 	if (flow->settings.cc_alg)
 		set_congestion_control(fd, flow->settings.cc_alg);
 
-	if (listen(fd, 0) < 0) {
+	if (flow->settings.crr == CRR_FASTOPEN &&
+	    set_tcp_fastopen(fd, SOMAXCONN) == -1) {
+		flow_error(flow, "Unable to set TCP_FASTOPEN: %s",
+			   strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	/* The connections of a CRR flow may arrive before the previous one
+	 * is closed, those of a flow with many connections all at once */
+	if (listen(fd, flow->settings.crr || flow->settings.connections > 1 ?
+		   SOMAXCONN : 0) < 0) {
 		logging(LOG_ALERT, "listen failed: %s", strerror(errno));
 		flow_error(flow, "listen failed: %s", strerror(errno));
 		return -1;
@@ -153,18 +169,31 @@ static int create_listen_socket(struct flow *flow, char *bind_addr,
  * To set the flow options and settings as destination endpoint. Listening port
  * created and send back to the controller in the same request structure
  *
+ * @param[in,out] worker worker thread the flow is assigned to
  * @param[in,out] request contain the test option and parameter for destination source endpoint 
  */
-void add_flow_destination(struct request_add_flow_destination *request)
+void add_flow_destination(struct worker *worker,
+			  struct request_add_flow_destination *request)
 {
 	struct flow *flow;
 	unsigned short server_data_port;
 
-	if (fg_list_size(&flows) >= MAX_FLOWS_DAEMON) {
+	/* Only a flow on a shared listener needs a hello */
+	request->hello[0] = 0;
+
+	unsigned num_flows = daemon_num_flows();
+
+	if (num_flows >= MAX_FLOWS_DAEMON) {
 		logging(LOG_WARNING, "can not accept another flow, already "
-			"handling %zu flows", fg_list_size(&flows));
+			"handling %u flows", num_flows);
 		request_error(&request->r, "Can not accept another flow, "
-			     "already handling %zu flows.", fg_list_size(&flows));
+			     "already handling %u flows.", num_flows);
+		return;
+	}
+
+	const char *unsupported = unsupported_flow(&request->settings);
+	if (unsupported) {
+		request_error(&request->r, "%s", unsupported);
 		return;
 	}
 
@@ -175,13 +204,18 @@ void add_flow_destination(struct request_add_flow_destination *request)
 	}
 
 	init_flow(flow, 0);
+	flow->worker = worker;
 
 	flow->settings = request->settings;
-	flow->write_block = calloc(1, flow->settings.maximum_block_size );
-	flow->read_block = calloc(1, flow->settings.maximum_block_size );
+	/* Only the block headers are kept per flow */
+	flow->write_block = calloc(1, MIN_BLOCK_SIZE);
+	flow->read_block = calloc(1, MIN_BLOCK_SIZE);
+	flow->payload = get_shared_payload(flow->settings.maximum_block_size,
+					   flow->settings.byte_counting);
 	/* Controller flow ID is set in the daemon */
 	flow->id=flow->settings.flow_id;
-	if (flow->write_block == NULL || flow->read_block == NULL) {
+	if (flow->write_block == NULL || flow->read_block == NULL ||
+	    flow->payload == NULL) {
 		logging(LOG_ALERT, "could not allocate memory for read/write "
 			"blocks");
 		request_error(&request->r, "could not allocate memory "
@@ -190,16 +224,40 @@ void add_flow_destination(struct request_add_flow_destination *request)
 		return;
 	}
 
-	if (flow->settings.byte_counting) {
-		int byte_idx;
-		for (byte_idx = 0; byte_idx < flow->settings.maximum_block_size;
-		     byte_idx++)
-			*(flow->write_block + byte_idx) =
-				(unsigned char)(byte_idx & 0xff);
+	if (open_payload_file(flow) == -1) {
+		logging(LOG_ALERT, "could not open payload file: %s",
+			flow->error);
+		request_error(&request->r, "%s", flow->error);
+		uninit_flow(flow);
+		return;
 	}
 
-	/* Create listen socket for data connection */
-	if ((flow->listenfd_data =
+#ifdef HAVE_EPOLL
+	if (flow->settings.connections > 1 && connections_init(flow) == -1) {
+		request->r.error = flow->error;
+		flow->error = NULL;
+		uninit_flow(flow);
+		return;
+	}
+#endif /* HAVE_EPOLL */
+
+	/* Create listen socket for data connection, unless the source
+	 * introduces its connection to the shared listener with a hello */
+	if (flow->settings.shared_listener) {
+#ifdef HAVE_EPOLL
+		if (listener_join(flow, request->hello,
+				  &server_data_port) == -1) {
+			request->r.error = flow->error;
+			flow->error = NULL;
+			uninit_flow(flow);
+			return;
+		}
+#else /* HAVE_EPOLL */
+		request_error(&request->r, "shared listeners need epoll");
+		uninit_flow(flow);
+		return;
+#endif /* HAVE_EPOLL */
+	} else if ((flow->listenfd_data =
 			create_listen_socket(flow,
 					     flow->settings.bind_address[0]
 						? flow->settings.bind_address : 0,
@@ -211,6 +269,7 @@ void add_flow_destination(struct request_add_flow_destination *request)
 		uninit_flow(flow);
 		return;
 	} else {
+#ifndef HAVE_EPOLL
 		/* FIXME: currently we use portable select() API, which
 		 * is limited by the number of bits in an fd_set */
 		if (flow->listenfd_data >= FD_SETSIZE) {
@@ -221,19 +280,29 @@ void add_flow_destination(struct request_add_flow_destination *request)
 			uninit_flow(flow);
 			return;
 		}
+#endif /* HAVE_EPOLL */
 		DEBUG_MSG(LOG_WARNING, "listening on %s port %u for data "
 			  "connection (fd=%u)", flow->settings.bind_address,
 			  server_data_port, flow->listenfd_data);
 	}
 
-	flow->real_listen_send_buffer_size =
-		set_window_size_directed(flow->listenfd_data,
-					 flow->settings.requested_send_buffer_size,
-					 SO_SNDBUF);
-	flow->real_listen_receive_buffer_size =
-		set_window_size_directed(flow->listenfd_data,
-					 flow->settings.requested_read_buffer_size,
-					 SO_RCVBUF);
+	/* The buffers of a connection from a shared listener are only sized
+	 * once it is handed over */
+	if (flow->listenfd_data == -1) {
+		flow->real_listen_send_buffer_size =
+			flow->settings.requested_send_buffer_size;
+		flow->real_listen_receive_buffer_size =
+			flow->settings.requested_read_buffer_size;
+	} else {
+		flow->real_listen_send_buffer_size =
+			set_window_size_directed(flow->listenfd_data,
+						 flow->settings.requested_send_buffer_size,
+						 SO_SNDBUF);
+		flow->real_listen_receive_buffer_size =
+			set_window_size_directed(flow->listenfd_data,
+						 flow->settings.requested_read_buffer_size,
+						 SO_RCVBUF);
+	}
 
 	request->listen_data_port = (int)server_data_port;
 	request->real_listen_send_buffer_size =
@@ -242,7 +311,13 @@ void add_flow_destination(struct request_add_flow_destination *request)
 		flow->real_listen_receive_buffer_size;
 	request->flow_id = flow->id;
 
-	fg_list_push_back(&flows, flow);
+	if (add_flow(worker, flow) == -1) {
+		logging(LOG_ALERT, "could not allocate memory for flow");
+		request_error(&request->r, "could not allocate memory for "
+			      "flow");
+		uninit_flow(flow);
+		return;
+	}
 
 	return;
 }
@@ -251,12 +326,10 @@ int accept_data(struct flow *flow)
 {
 	struct sockaddr_storage caddr;
 	socklen_t addrlen = sizeof(caddr);
-	unsigned real_send_buffer_size;
-	unsigned real_receive_buffer_size;
 
-	flow->fd = accept(flow->listenfd_data, (struct sockaddr *)&caddr,
-			  &addrlen);
-	if (flow->fd == -1) {
+	int fd = accept(flow->listenfd_data, (struct sockaddr *)&caddr,
+			&addrlen);
+	if (fd == -1) {
 		/* try again later .... */
 		if (errno == EINTR || errno == EAGAIN)
 			return 0;
@@ -264,6 +337,19 @@ int accept_data(struct flow *flow)
 		return -1;
 	}
 
+	return add_data_connection(flow, fd, (struct sockaddr *)&caddr,
+				   addrlen);
+}
+
+int add_data_connection(struct flow *flow, int fd,
+			const struct sockaddr *addr, socklen_t addr_len)
+{
+	unsigned real_send_buffer_size;
+	unsigned real_receive_buffer_size;
+
+	flow->fd = fd;
+
+#ifndef HAVE_EPOLL
 	/* FIXME: currently we use portable select() API, which
 	 * is limited by the number of bits in an fd_set */
 	if (flow->fd >= FD_SETSIZE) {
@@ -274,17 +360,42 @@ int accept_data(struct flow *flow)
 		close(flow->fd);
 		return -1;
 	}
+#endif /* HAVE_EPOLL */
+
+	unsigned accepted = 1, connections = 1;
+#ifdef HAVE_EPOLL
+	if (flow->conns) {
+		if (connections_add(flow, flow->fd) == -1)
+			return -1;
+		accepted = flow->conns->count;
+		connections = flow->conns->size;
+	}
+#endif /* HAVE_EPOLL */
+
+	/* A flow with many connections listens until all of them arrived */
+	if (accepted == connections && flow->listenfd_data != -1) {
+		unwatch_flow(flow);
+		/* A CRR flow accepts the next connection once this one is
+		 * closed */
+		if (flow->settings.crr)
+			flow->crr_listenfd = flow->listenfd_data;
+		else if (close(flow->listenfd_data) == -1)
+			logging(LOG_WARNING, "close() failed");
+		flow->listenfd_data = -1;
+	}
 
-	if (close(flow->listenfd_data) == -1)
-		logging(LOG_WARNING, "close() failed");
-	flow->listenfd_data = -1;
-
-	logging(LOG_NOTICE, "client %s connected for testing (fd=%u)",
-		fg_nameinfo((struct sockaddr *)&caddr, addrlen), flow->fd);
-
+	/* Only the first connection of a flow is of interest here */
+	if (!flow->statistics[FINAL].connects && accepted == 1) {
+		logging(LOG_NOTICE, "client %s connected for testing (fd=%u)",
+			fg_nameinfo(addr, addr_len),
+			flow->fd);
 #ifdef HAVE_LIBPCAP
-	fg_pcap_go(flow);
+		fg_pcap_go(flow);
 #endif /* HAVE_LIBPCAP */
+	}
+	if (flow->settings.crr)
+		foreach(int *i, INTERVAL, FINAL)
+			flow->statistics[*i].connects++;
 
 	real_send_buffer_size =
 		set_window_size_directed(flow->fd,
@@ -313,8 +424,13 @@ int accept_data(struct flow *flow)
 	}
 	if (set_flow_tcp_options(flow) == -1)
 		return -1;
+#ifdef HAVE_SO_TIMESTAMPING
+	if (flow->settings.tx_timestamps && txstamp_init(flow) == -1)
+		return -1;
+#endif /* HAVE_SO_TIMESTAMPING */
 	DEBUG_MSG(LOG_NOTICE, "data socket accepted");
-	flow->state = GRIND;
+	if (accepted == connections)
+		flow->state = GRIND;
 	flow->connect_called = 1;
 
 	return 0;
@@ -32,7 +32,20 @@
 #include "config.h"
 #endif /* HAVE_CONFIG_H */
 
-void add_flow_destination(struct request_add_flow_destination *request);
+void add_flow_destination(struct worker *worker,
+			  struct request_add_flow_destination *request);
 int accept_data(struct flow *flow);
+/**
+ * Use the connection with socket @p fd as data connection of @p flow.
+ *
+ * @param[in,out] flow destination flow waiting for its data connection
+ * @param[in] fd socket of the accepted connection, owned by the flow
+ * afterwards
+ * @param[in] addr address of the peer
+ * @param[in] addr_len length of @p addr
+ * @return 0 on success, -1 on failure
+ */
+int add_data_connection(struct flow *flow, int fd,
+			const struct sockaddr *addr, socklen_t addr_len);
 
 #endif /* _DESTINATION_H_ */
@@ -0,0 +1,336 @@
+/**
+ * @file fg_connections.c
+ * @brief Flows with many connections in the Flowgrind daemon
+ */
+
+/*
+ * Copyright (C) 2026 Flowgrind authors.
+ *
+ * This file is part of Flowgrind.
+ *
+ * Flowgrind is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Flowgrind is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Flowgrind.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif /* HAVE_EPOLL */
+
+#include "debug.h"
+#include "fg_definitions.h"
+#include "fg_log.h"
+#include "fg_connections.h"
+
+#ifdef HAVE_EPOLL
+/** Number of connections admitted by the daemon but not yet established. */
+static unsigned long connections_pending;
+/** Protects the number of pending connections. */
+static pthread_mutex_t admission_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Number of files the daemon has open, -1 if unknown */
+static long open_files(void)
+{
+#ifdef __LINUX__
+	long count = 0;
+	DIR *dir = opendir("/proc/self/fd");
+
+	if (!dir)
+		return -1;
+	while (readdir(dir))
+		count++;
+	closedir(dir);
+
+	/* Without ".", ".." and the descriptor of the directory itself */
+	return count - 3;
+#else /* __LINUX__ */
+	return -1;
+#endif /* __LINUX__ */
+}
+
+/* Memory available for new connections in bytes, -1 if unknown */
+static double available_memory(void)
+{
+#ifdef __LINUX__
+	char line[256];
+	unsigned long long kbytes;
+	FILE *meminfo = fopen("/proc/meminfo", "r");
+
+	if (meminfo) {
+		while (fgets(line, sizeof(line), meminfo))
+			if (sscanf(line, "MemAvailable: %llu kB",
+				   &kbytes) == 1) {
+				fclose(meminfo);
+				return kbytes * 1024.0;
+			}
+		fclose(meminfo);
+	}
+#endif /* __LINUX__ */
+#ifdef _SC_AVPHYS_PAGES
+	long pages = sysconf(_SC_AVPHYS_PAGES);
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	if (pages > 0 && page_size > 0)
+		return (double)pages * page_size;
+#endif /* _SC_AVPHYS_PAGES */
+	return -1;
+}
+
+/* Check if @p size more connections fit into the limits of the daemon */
+static int admit(struct flow *flow, unsigned size)
+{
+	struct rlimit rl;
+	unsigned long needed = connections_pending + size;
+
+	long open = open_files();
+	if (open >= 0 && getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+	    rl.rlim_cur != RLIM_INFINITY &&
+	    open + needed + CONNECTION_FD_RESERVE > rl.rlim_cur) {
+		flow_error(flow, "Not enough file descriptors for %u "
+			   "connections: %ld of %llu in use, %lu more "
+			   "connections pending", size, open,
+			   (unsigned long long)rl.rlim_cur,
+			   connections_pending);
+		return -1;
+	}
+
+	double memory = (double)needed *
+			(CONNECTION_MEMORY + sizeof(struct connection));
+	double available = available_memory();
+	if (available >= 0 && memory > available) {
+		flow_error(flow, "Not enough memory for %u connections: "
+			   "%.0f MiB needed, %.0f MiB available", size,
+			   memory / (1 << 20), available / (1 << 20));
+		return -1;
+	}
+
+	return 0;
+}
+
+int connections_init(struct flow *flow)
+{
+	unsigned size = flow->settings.connections;
+	struct connections *conns;
+
+	pthread_mutex_lock(&admission_mutex);
+	if (admit(flow, size) == -1) {
+		pthread_mutex_unlock(&admission_mutex);
+		return -1;
+	}
+
+	conns = calloc(1, sizeof(*conns) + size * sizeof(struct connection));
+	if (!conns) {
+		pthread_mutex_unlock(&admission_mutex);
+		flow_error(flow, "Could not allocate memory for %u "
+			   "connections", size);
+		return -1;
+	}
+
+	conns->epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if (conns->epollfd == -1) {
+		pthread_mutex_unlock(&admission_mutex);
+		flow_error(flow, "Could not create epoll instance for the "
+			   "connections: %s", strerror(errno));
+		free(conns);
+		return -1;
+	}
+
+	connections_pending += size;
+	pthread_mutex_unlock(&admission_mutex);
+
+	conns->size = size;
+	conns->polled = -1;
+	flow->conns = conns;
+	return 0;
+}
+
+void connections_free(struct flow *flow)
+{
+	struct connections *conns = flow->conns;
+
+	if (!conns)
+		return;
+
+	/* The data socket of the flow refers to one of the connections */
+	if (conns->count && flow->fd == conns->conn[conns->current].fd)
+		flow->fd = -1;
+	for (unsigned i = 0; i < conns->count; i++)
+		close(conns->conn[i].fd);
+	close(conns->epollfd);
+
+	pthread_mutex_lock(&admission_mutex);
+	connections_pending -= conns->size - conns->count;
+	pthread_mutex_unlock(&admission_mutex);
+
+	free(conns->responses);
+	free(conns);
+	flow->conns = NULL;
+}
+
+int connections_add(struct flow *flow, int fd)
+{
+	struct connections *conns = flow->conns;
+	struct connection *conn = &conns->conn[conns->count];
+
+	conn->fd = fd;
+	conn->events = 0;
+	conn->block_bytes_read = 0;
+	conn->read_block_size = MIN_BLOCK_SIZE;
+
+	if (connections_watch(flow, conns->count, EPOLLIN) == -1) {
+		flow_error(flow, "Could not watch connection %u: %s",
+			   conns->count, strerror(errno));
+		return -1;
+	}
+
+	pthread_mutex_lock(&admission_mutex);
+	connections_pending--;
+	pthread_mutex_unlock(&admission_mutex);
+
+	/* The flow has not received anything yet on its first connection */
+	if (!conns->count++)
+		flow->fd = fd;
+	else
+		connections_switch(flow, conns->count - 1);
+
+	DEBUG_MSG(LOG_DEBUG, "added connection %u of %u to flow %d (fd=%d)",
+		  conns->count, conns->size, flow->id, fd);
+	return 0;
+}
+
+void connections_switch(struct flow *flow, unsigned index)
+{
+	struct connections *conns = flow->conns;
+	struct connection *conn;
+
+	if (index == conns->current)
+		return;
+
+	conn = &conns->conn[conns->current];
+	conn->block_bytes_read = flow->current_block_bytes_read;
+	conn->read_block_size = flow->current_read_block_size;
+	if (conn->block_bytes_read)
+		memcpy(&conn->header, flow->read_block,
+		       MIN(conn->block_bytes_read, (unsigned)MIN_BLOCK_SIZE));
+
+	conns->current = index;
+	conn = &conns->conn[index];
+	flow->fd = conn->fd;
+	flow->current_block_bytes_read = conn->block_bytes_read;
+	flow->current_read_block_size = conn->read_block_size;
+	if (conn->block_bytes_read)
+		memcpy(flow->read_block, &conn->header,
+		       MIN(conn->block_bytes_read, (unsigned)MIN_BLOCK_SIZE));
+}
+
+int connections_watch(struct flow *flow, unsigned index, uint32_t events)
+{
+	struct connection *conn = &flow->conns->conn[index];
+	struct epoll_event ev = { .events = events, .data.u32 = index };
+	int op;
+
+	if (events == conn->events)
+		return 0;
+
+	if (!conn->events)
+		op = EPOLL_CTL_ADD;
+	else if (!events)
+		op = EPOLL_CTL_DEL;
+	else
+		op = EPOLL_CTL_MOD;
+
+	if (epoll_ctl(flow->conns->epollfd, op, conn->fd, &ev) == -1)
+		return -1;
+
+	conn->events = events;
+	return 0;
+}
+
+void connections_poll_out(struct flow *flow, bool want_write)
+{
+	struct connections *conns = flow->conns;
+	int target = -1;
+
+	/* No response is started while a request block is partially sent */
+	if (want_write && conns->count)
+		target = flow->responses_queued &&
+			 !flow->current_block_bytes_written ?
+			 (int)conns->responses[flow->responses_head] :
+			 (int)conns->writer;
+
+	if (target == conns->polled)
+		return;
+
+	if (conns->polled != -1 &&
+	    connections_watch(flow, conns->polled,
+			      conns->conn[conns->polled].events &
+			      ~EPOLLOUT) == -1)
+		logging(LOG_WARNING, "failed to stop polling connection %d "
+			"of flow %d: %s", conns->polled, flow->id,
+			strerror(errno));
+	conns->polled = -1;
+
+	if (target == -1)
+		return;
+
+	if (connections_watch(flow, target,
+			      conns->conn[target].events | EPOLLOUT) == -1) {
+		logging(LOG_WARNING, "failed to poll connection %d of flow "
+			"%d: %s", target, flow->id, strerror(errno));
+		return;
+	}
+	conns->polled = target;
+}
+
+int connections_grow_responses(struct flow *flow, unsigned size)
+{
+	struct connections *conns = flow->conns;
+	unsigned *responses = realloc(conns->responses,
+				      size * sizeof(*responses));
+
+	if (!responses)
+		return -1;
+
+	/* Unwrap the ring like the one of the response blocks */
+	memcpy(responses + flow->responses_size, responses,
+	       flow->responses_head * sizeof(*responses));
+	conns->responses = responses;
+	return 0;
+}
+
+int connections_shutdown(struct flow *flow, int how)
+{
+	int rc = 0;
+
+	for (unsigned i = 0; i < flow->conns->count; i++)
+		if (shutdown(flow->conns->conn[i].fd, how) == -1)
+			rc = -1;
+	return rc;
+}
+#endif /* HAVE_EPOLL */
@@ -0,0 +1,180 @@
+/**
+ * @file fg_connections.h
+ * @brief Flows with many connections in the Flowgrind daemon
+ */
+
+/*
+ * Copyright (C) 2026 Flowgrind authors.
+ *
+ * This file is part of Flowgrind.
+ *
+ * Flowgrind is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Flowgrind is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Flowgrind.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _FG_CONNECTIONS_H_
+#define _FG_CONNECTIONS_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "daemon.h"
+
+#ifdef HAVE_EPOLL
+/** Estimated memory of an idle connection, mostly taken by its socket in
+ * the kernel, in bytes. */
+#define CONNECTION_MEMORY 4096
+/** Number of file descriptors kept free for the control connections and
+ * flows with a single connection. */
+#define CONNECTION_FD_RESERVE 64
+
+/**
+ * A connection of a flow with many connections.
+ *
+ * Only the state needed to resume receiving a block is kept per connection.
+ * While the data socket of the flow refers to the connection, this state is
+ * held by the flow itself, see connections_switch().
+ */
+struct connection {
+	/** Data socket of the connection. */
+	int fd;
+	/** Events the socket is registered for, 0 if not registered. */
+	uint32_t events;
+	/** Number of bytes received of the current block. */
+	unsigned block_bytes_read;
+	/** Size of the block currently received. */
+	unsigned read_block_size;
+	/** Received part of the header of the current block. */
+	struct block header;
+};
+
+/**
+ * Connections of a flow with many connections.
+ *
+ * Settings, traffic generation and statistics are shared by all connections
+ * of the flow. The flow sends its request blocks on its connections in turn
+ * and each response block on the connection its request came in on. The
+ * sockets of the connections are registered with an epoll instance of the
+ * flow, which in turn is watched by the worker in place of a data socket.
+ */
+struct connections {
+	/** epoll instance the sockets of the connections are registered
+	 * with. */
+	int epollfd;
+	/** Number of connections the flow is made of. */
+	unsigned size;
+	/** Number of connections established so far. */
+	unsigned count;
+	/** Connection the data socket of the flow refers to. */
+	unsigned current;
+	/** Connection the current or next request block is sent on. */
+	unsigned writer;
+	/** Connection waited on to become writable, -1 if none. */
+	int polled;
+	/** Connection of each queued response block, indexed like the ring
+	 * of response blocks of the flow. */
+	unsigned *responses;
+	/** The connections, the first #count of them are established. */
+	struct connection conn[];
+};
+
+/**
+ * Admit the connections of @p flow and set up their state.
+ *
+ * The connections are only admitted if the daemon may open enough files for
+ * them and if the memory they are estimated to take is available.
+ *
+ * @param[in,out] flow flow with many connections to set up
+ * @return 0 on success, -1 on failure with the flow error set
+ */
+int connections_init(struct flow *flow);
+
+/**
+ * Close the connections of @p flow and release their state.
+ *
+ * @param[in,out] flow flow whose connections are closed
+ */
+void connections_free(struct flow *flow);
+
+/**
+ * Add the established connection with socket @p fd to @p flow.
+ *
+ * The data socket of the flow refers to the new connection afterwards.
+ *
+ * @param[in,out] flow flow the connection belongs to
+ * @param[in] fd data socket of the connection
+ * @return 0 on success, -1 on failure with the flow error set
+ */
+int connections_add(struct flow *flow, int fd);
+
+/**
+ * Let the data socket of @p flow refer to connection @p index.
+ *
+ * The receive state of the connection referred to so far is saved, the one
+ * of connection @p index restored.
+ *
+ * @param[in,out] flow flow to switch the connection of
+ * @param[in] index connection to switch to
+ */
+void connections_switch(struct flow *flow, unsigned index);
+
+/**
+ * Change the events the flow waits for on connection @p index.
+ *
+ * @param[in,out] flow flow the connection belongs to
+ * @param[in] index connection to (re)register
+ * @param[in] events epoll events to wait for, 0 to wait for none
+ * @return 0 on success, -1 on failure with errno set
+ */
+int connections_watch(struct flow *flow, unsigned index, uint32_t events);
+
+/**
+ * Wait for the connection the next data of @p flow is sent on to become
+ * writable.
+ *
+ * This is the connection of the first queued response block, or the one of
+ * the next request block.
+ *
+ * @param[in,out] flow flow with data to send
+ * @param[in] want_write wait for writability at all
+ */
+void connections_poll_out(struct flow *flow, bool want_write);
+
+/**
+ * Make room for @p size queued response blocks of @p flow.
+ *
+ * Must be called before the ring of response blocks of the flow is resized.
+ *
+ * @param[in,out] flow flow whose response queue grows
+ * @param[in] size new size of the ring of response blocks
+ * @return 0 on success, -1 if out of memory
+ */
+int connections_grow_responses(struct flow *flow, unsigned size);
+
+/**
+ * Shut down all connections of @p flow.
+ *
+ * @param[in] flow flow whose connections are shut down
+ * @param[in] how directions to shut down, as for shutdown()
+ * @return 0 on success, -1 if one of the connections failed
+ */
+int connections_shutdown(struct flow *flow, int how);
+#endif /* HAVE_EPOLL */
+
+#endif /* _FG_CONNECTIONS_H_ */
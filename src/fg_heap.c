@@ -0,0 +1,192 @@
+/**
+ * @file fg_heap.c
+ * @brief Binary min-heap of points in time
+ */
+
+/*
+ * Copyright (C) 2026 Flowgrind authors.
+ *
+ * This file is part of Flowgrind.
+ *
+ * Flowgrind is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Flowgrind is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Flowgrind.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+
+#include "fg_heap.h"
+
+/** Initial number of nodes the heap can hold. */
+#define HEAP_INITIAL_CAPACITY 64
+
+/* Returns true if key of node @p a is before the key of node @p b */
+static inline bool node_before(const struct heap_node *a,
+			       const struct heap_node *b)
+{
+	return a->key.tv_sec < b->key.tv_sec ||
+	       (a->key.tv_sec == b->key.tv_sec &&
+		a->key.tv_nsec < b->key.tv_nsec);
+}
+
+static inline void place_node(struct min_heap * const heap,
+			      struct heap_node *node, size_t pos)
+{
+	heap->nodes[pos] = node;
+	node->index = pos;
+}
+
+/* Move node at @p pos towards the top until the heap property holds */
+static void sift_up(struct min_heap * const heap, size_t pos)
+{
+	struct heap_node *node = heap->nodes[pos];
+
+	while (pos) {
+		size_t parent = (pos - 1) / 2;
+		if (!node_before(node, heap->nodes[parent]))
+			break;
+		place_node(heap, heap->nodes[parent], pos);
+		pos = parent;
+	}
+	place_node(heap, node, pos);
+}
+
+/* Move node at @p pos towards the bottom until the heap property holds */
+static void sift_down(struct min_heap * const heap, size_t pos)
+{
+	struct heap_node *node = heap->nodes[pos];
+
+	for (;;) {
+		size_t child = 2 * pos + 1;
+		if (child >= heap->size)
+			break;
+		if (child + 1 < heap->size &&
+		    node_before(heap->nodes[child + 1], heap->nodes[child]))
+			child++;
+		if (!node_before(heap->nodes[child], node))
+			break;
+		place_node(heap, heap->nodes[child], pos);
+		pos = child;
+	}
+	place_node(heap, node, pos);
+}
+
+int fg_heap_init(struct min_heap * const heap)
+{
+	if (!heap)
+		return -1;
+
+	heap->nodes = NULL;
+	heap->size = 0;
+	heap->capacity = 0;
+
+	return 0;
+}
+
+void fg_heap_node_init(struct heap_node * const node, void * const data)
+{
+	node->key.tv_sec = 0;
+	node->key.tv_nsec = 0;
+	node->data = data;
+	node->index = -1;
+}
+
+bool fg_heap_contains(const struct heap_node * const node)
+{
+	return node->index != -1;
+}
+
+struct heap_node *fg_heap_top(const struct min_heap * const heap)
+{
+	if (!heap || !heap->size)
+		return NULL;
+
+	return heap->nodes[0];
+}
+
+int fg_heap_update(struct min_heap * const heap, struct heap_node * const node,
+		   const struct timespec *key)
+{
+	if (!heap || !node)
+		return -1;
+
+	node->key = *key;
+
+	if (fg_heap_contains(node)) {
+		size_t pos = node->index;
+		if (pos && node_before(node, heap->nodes[(pos - 1) / 2]))
+			sift_up(heap, pos);
+		else
+			sift_down(heap, pos);
+		return 0;
+	}
+
+	if (heap->size == heap->capacity) {
+		size_t capacity = heap->capacity ? 2 * heap->capacity
+						 : HEAP_INITIAL_CAPACITY;
+		struct heap_node **nodes = realloc(heap->nodes,
+						   capacity * sizeof(*nodes));
+		if (!nodes)
+			return -2;
+		heap->nodes = nodes;
+		heap->capacity = capacity;
+	}
+
+	heap->nodes[heap->size] = node;
+	sift_up(heap, heap->size++);
+
+	return 0;
+}
+
+void fg_heap_remove(struct min_heap * const heap, struct heap_node * const node)
+{
+	if (!heap || !node || !fg_heap_contains(node))
+		return;
+
+	size_t pos = node->index;
+	struct heap_node *last = heap->nodes[--heap->size];
+
+	node->index = -1;
+	if (last == node)
+		return;
+
+	/* Fill the gap with the last node and restore the heap property */
+	place_node(heap, last, pos);
+	if (pos && node_before(last, heap->nodes[(pos - 1) / 2]))
+		sift_up(heap, pos);
+	else
+		sift_down(heap, pos);
+}
+
+size_t fg_heap_size(const struct min_heap * const heap)
+{
+	if (!heap)
+		return 0;
+
+	return heap->size;
+}
+
+void fg_heap_free(struct min_heap * const heap)
+{
+	if (!heap)
+		return;
+
+	for (size_t i = 0; i < heap->size; i++)
+		heap->nodes[i]->index = -1;
+	free(heap->nodes);
+	fg_heap_init(heap);
+}
@@ -0,0 +1,134 @@
+/**
+ * @file fg_heap.h
+ * @brief Binary min-heap of points in time
+ */
+
+/*
+ * Copyright (C) 2026 Flowgrind authors.
+ *
+ * This file is part of Flowgrind.
+ *
+ * Flowgrind is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Flowgrind is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Flowgrind.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _FG_HEAP_H_
+#define _FG_HEAP_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/**
+ * Single element in a min-heap.
+ *
+ * The node is embedded into the user defined data, thus inserting and
+ * removing elements never allocates memory for the node itself.
+ */
+struct heap_node {
+	/** Point in time the heap is ordered by. */
+	struct timespec key;
+	/** Pointer to user defined data stored with this node. */
+	void *data;
+	/** Position of the node in the heap, -1 if not in a heap. */
+	int index;
+};
+
+/** A binary min-heap. The node with the earliest key is on top. */
+struct min_heap {
+	/** Array of the nodes in heap order. */
+	struct heap_node **nodes;
+	/** Number of nodes stored in the heap. */
+	size_t size;
+	/** Number of nodes the array can hold without being resized. */
+	size_t capacity;
+};
+
+/**
+ * Initializes the heap by setting its size to 0.
+ *
+ * @param[in] heap heap to initialize
+ * @return zero on success, non-zero otherwise
+ */
+int fg_heap_init(struct min_heap * const heap);
+
+/**
+ * Initializes a heap node which is not yet part of any heap.
+ *
+ * @param[in] node node to initialize
+ * @param[in] data user defined data stored with this node
+ */
+void fg_heap_node_init(struct heap_node * const node, void * const data);
+
+/**
+ * Returns true if @p node is currently part of a heap.
+ *
+ * @param[in] node node to check
+ * @return true or false
+ */
+bool fg_heap_contains(const struct heap_node * const node);
+
+/**
+ * Returns the node with the earliest key.
+ *
+ * The node is not removed from the heap.
+ *
+ * @param[in] heap heap to operate on
+ * @return a pointer to the top node of @p heap, NULL if the heap is empty
+ */
+struct heap_node *fg_heap_top(const struct min_heap * const heap);
+
+/**
+ * Inserts @p node into the heap or moves it to its new position.
+ *
+ * Must be called whenever the key of a node has changed.
+ *
+ * @param[in] heap heap to operate on
+ * @param[in] node node to insert or reposition
+ * @param[in] key new key of the node
+ * @return zero on success, non-zero otherwise
+ */
+int fg_heap_update(struct min_heap * const heap, struct heap_node * const node,
+		   const struct timespec *key);
+
+/**
+ * Removes @p node from the heap.
+ *
+ * Removing a node that is not part of the heap is a no-op.
+ *
+ * @param[in] heap heap to operate on
+ * @param[in] node node to remove
+ */
+void fg_heap_remove(struct min_heap * const heap, struct heap_node * const node);
+
+/**
+ * Returns the number of nodes in the heap.
+ *
+ * @param[in] heap heap to operate on
+ * @return the number of nodes in the heap
+ */
+size_t fg_heap_size(const struct min_heap * const heap);
+
+/**
+ * Removes all nodes from the heap and releases its memory.
+ *
+ * @param[in] heap heap to operate on
+ */
+void fg_heap_free(struct min_heap * const heap);
+
+#endif /* _FG_HEAP_H_ */
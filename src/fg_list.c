@@ -77,6 +77,17 @@ int fg_list_remove(struct linked_list * const list, const void * const data)
 			return -4;
 	}
 
+	return fg_list_remove_node(list, node);
+}
+
+int fg_list_remove_node(struct linked_list * const list,
+			const struct list_node * const node)
+{
+	if (!list || !node)
+		return -1;
+	if (!list->head)
+		return -3;
+
 	if (list->head == node)
 		list->head = node->next;
 	if (list->tail == node)
@@ -86,7 +97,7 @@ int fg_list_remove(struct linked_list * const list, const void * const data)
 	if (node->next)
 		node->next->previous = node->previous;
 
-	free(node);
+	free((struct list_node *)node);
 	--list->size;
 
 	return 0;
@@ -92,6 +92,20 @@ const struct list_node* fg_list_back(struct linked_list * const list);
  */
 int fg_list_remove(struct linked_list * const list, const void * const data);
 
+/**
+ * Removes @p node from the list in constant time.
+ *
+ * It reduces the list size by one and destroys the element. The data
+ * contained in this element will not be modified. @p node must be an element
+ * of @p list, e.g. as returned by fg_list_back() right after inserting it.
+ *
+ * @param[in] list to operate on
+ * @param[in] node element to be removed
+ * @return zero on success, non-zero otherwise
+ */
+int fg_list_remove_node(struct linked_list * const list,
+			const struct list_node * const node);
+
 /**
  * Inserts a new element at the beginning of the list.
  *
@@ -0,0 +1,397 @@
+/**
+ * @file fg_listener.c
+ * @brief Listen sockets shared by the destination flows of the Flowgrind
+ * daemon
+ */
+
+/*
+ * Copyright (C) 2026 Flowgrind authors.
+ *
+ * This file is part of Flowgrind.
+ *
+ * Flowgrind is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Flowgrind is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Flowgrind.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif /* HAVE_EPOLL */
+
+#include "debug.h"
+#include "fg_log.h"
+#include "fg_socket.h"
+#include "fg_time.h"
+#include "fg_listener.h"
+
+unsigned short shared_listen_port = 0;
+
+#ifdef HAVE_EPOLL
+/** Marks the start of a hello, "FGHI". */
+#define HELLO_MAGIC 0x46474849U
+
+/** Maximum number of events handled per call of listener_accept(). */
+#define LISTENER_EVENTS 64
+
+/** Listen sockets shared by the destination flows with the same bind
+ * address. */
+struct listener {
+	/** Bind address, empty for any. */
+	char address[sizeof(((struct flow_settings *)0)->bind_address)];
+	/** Port the sockets are bound to. */
+	unsigned short port;
+
+	struct listener *next;
+
+	/** Listen socket of each worker. */
+	struct hello_socket sockets[];
+};
+
+/** Shared listeners of the daemon. */
+static struct listener *listeners = NULL;
+/** Number of hellos handed out, makes the nonce of each hello unique. */
+static uint32_t hellos_issued = 0;
+/** Protects the shared listeners and the hellos issued. */
+static pthread_mutex_t listener_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Close the listen sockets of @p listener opened so far */
+static void close_sockets(struct listener *listener)
+{
+	for (unsigned i = 0; i < num_workers; i++)
+		if (listener->sockets[i].fd != -1)
+			close(listener->sockets[i].fd);
+}
+
+/* Open a listen socket bound to @p addr that shares its port */
+static int open_socket(const struct sockaddr *addr, socklen_t addr_len)
+{
+	int one = 1;
+	int fd = socket(addr->sa_family, SOCK_STREAM, IPPROTO_TCP);
+
+	if (fd == -1)
+		return -1;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one,
+		       sizeof(one)) == -1 ||
+	    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one,
+		       sizeof(one)) == -1 ||
+	    bind(fd, addr, addr_len) == -1 ||
+	    listen(fd, SOMAXCONN) == -1 || set_non_blocking(fd) == -1) {
+		int saved_errno = errno;
+		close(fd);
+		errno = saved_errno;
+		return -1;
+	}
+
+#ifdef TCP_DEFER_ACCEPT
+	/* Most connections can be handed off right away once accepted */
+	int timeout = HELLO_TIMEOUT;
+	if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &timeout,
+		       sizeof(timeout)) == -1)
+		logging(LOG_WARNING, "failed to set TCP_DEFER_ACCEPT: %s",
+			strerror(errno));
+#endif /* TCP_DEFER_ACCEPT */
+
+	return fd;
+}
+
+/* Create the shared listener for the bind address @p address */
+static struct listener *create_listener(struct flow *flow,
+					const char *address)
+{
+	struct addrinfo hints, *res, *ai;
+	struct sockaddr_storage bound;
+	socklen_t bound_len = sizeof(bound);
+	char service[6];
+	int rc;
+
+	struct listener *listener = calloc(1, sizeof(struct listener) +
+					   num_workers *
+					   sizeof(struct hello_socket));
+	if (!listener) {
+		flow_error(flow, "could not allocate memory for listener");
+		return NULL;
+	}
+	strcpy(listener->address, address);
+	for (unsigned i = 0; i < num_workers; i++) {
+		listener->sockets[i].fd = -1;
+		listener->sockets[i].listener = listener;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags = address[0] ? 0 : AI_PASSIVE;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(service, sizeof(service), "%u", shared_listen_port);
+
+	if ((rc = getaddrinfo(address[0] ? address : NULL, service, &hints,
+			      &res)) != 0) {
+		flow_error(flow, "getaddrinfo() failed: %s",
+			   gai_strerror(rc));
+		free(listener);
+		return NULL;
+	}
+
+	/* The first socket determines the port of the others */
+	for (ai = res; ai; ai = ai->ai_next) {
+		listener->sockets[0].fd = open_socket(ai->ai_addr,
+						      ai->ai_addrlen);
+		if (listener->sockets[0].fd != -1)
+			break;
+	}
+	freeaddrinfo(res);
+	if (listener->sockets[0].fd == -1 ||
+	    getsockname(listener->sockets[0].fd, (struct sockaddr *)&bound,
+			&bound_len) == -1)
+		goto error;
+
+	for (unsigned i = 1; i < num_workers; i++) {
+		listener->sockets[i].fd =
+			open_socket((struct sockaddr *)&bound, bound_len);
+		if (listener->sockets[i].fd == -1)
+			goto error;
+	}
+
+	for (unsigned i = 0; i < num_workers; i++) {
+		struct epoll_event ev = {
+			.events = EPOLLIN,
+			.data.ptr = &listener->sockets[i],
+		};
+		if (epoll_ctl(workers[i].listen_epollfd, EPOLL_CTL_ADD,
+			      listener->sockets[i].fd, &ev) == -1)
+			goto error;
+		listener->sockets[i].watched = true;
+	}
+
+	listener->port = get_port(listener->sockets[0].fd);
+	logging(LOG_NOTICE, "listening on %s port %u for data connections "
+		"of all flows", address[0] ? address : "any address",
+		listener->port);
+	return listener;
+
+error:
+	flow_error(flow, "failed to create shared listener: %s",
+		   strerror(errno));
+	close_sockets(listener);
+	free(listener);
+	return NULL;
+}
+
+int listener_join(struct flow *flow, char hello[HELLO_SIZE + 1],
+		  unsigned short *port)
+{
+	struct listener *listener;
+
+	pthread_mutex_lock(&listener_mutex);
+	for (listener = listeners; listener; listener = listener->next)
+		if (!strcmp(listener->address, flow->settings.bind_address))
+			break;
+	if (!listener) {
+		listener = create_listener(flow, flow->settings.bind_address);
+		if (!listener) {
+			pthread_mutex_unlock(&listener_mutex);
+			return -1;
+		}
+		listener->next = listeners;
+		listeners = listener;
+	}
+	flow->hello_nonce = ++hellos_issued;
+	pthread_mutex_unlock(&listener_mutex);
+
+	snprintf(hello, HELLO_SIZE + 1, "%08" PRIx32 "%08x%08x%08" PRIx32,
+		 HELLO_MAGIC, flow->worker->id, (unsigned)flow->id,
+		 flow->hello_nonce);
+	*port = listener->port;
+	return 0;
+}
+
+/* Close an accepted connection that will not be handed off */
+static void drop_connection(struct hello_socket *hs, const char *reason)
+{
+	logging(LOG_WARNING, "dropping connection from %s: %s",
+		fg_nameinfo((struct sockaddr *)&hs->addr, hs->addr_len),
+		reason);
+	close(hs->fd);
+	hs->fd = -1;
+}
+
+/* Queue the connection for the worker of the flow its hello names */
+static void hand_off(struct worker *worker, struct hello_socket *hs)
+{
+	char text[HELLO_SIZE + 1];
+	unsigned magic, target, id, nonce;
+
+	memcpy(text, hs->hello, HELLO_SIZE);
+	text[HELLO_SIZE] = 0;
+	if (sscanf(text, "%8x%8x%8x%8x", &magic, &target, &id,
+		   &nonce) != 4 || magic != HELLO_MAGIC ||
+	    target >= num_workers) {
+		drop_connection(hs, "invalid hello");
+		return;
+	}
+
+	/* The connection is watched by the worker of its flow from now on */
+	if (hs->watched &&
+	    epoll_ctl(worker->listen_epollfd, EPOLL_CTL_DEL, hs->fd,
+		      NULL) == -1) {
+		drop_connection(hs, strerror(errno));
+		return;
+	}
+
+	struct handoff *handoff = malloc(sizeof(struct handoff));
+	if (!handoff) {
+		drop_connection(hs, "out of memory");
+		return;
+	}
+	handoff->fd = hs->fd;
+	handoff->flow_id = (int)id;
+	handoff->nonce = nonce;
+	handoff->addr = hs->addr;
+	handoff->addr_len = hs->addr_len;
+	hs->fd = -1;
+
+	DEBUG_MSG(LOG_DEBUG, "worker %u hands connection (fd=%d) of flow %d "
+		  "to worker %u", worker->id, handoff->fd, handoff->flow_id,
+		  target);
+
+	struct worker *owner = &workers[target];
+	pthread_mutex_lock(&owner->mutex);
+	handoff->next = owner->handoffs;
+	owner->handoffs = handoff;
+	/* Doesn't matter what we write */
+	if (write(owner->pipe[1], &magic, 1) != 1)
+		logging(LOG_WARNING, "could not wake up worker %u: %s",
+			owner->id, strerror(errno));
+	pthread_mutex_unlock(&owner->mutex);
+}
+
+/* Receive the rest of the hello of an accepted connection */
+static void receive_hello(struct worker *worker, struct hello_socket *hs)
+{
+	ssize_t rc = recv(hs->fd, hs->hello + hs->received,
+			  HELLO_SIZE - hs->received, 0);
+
+	if (rc == 0) {
+		drop_connection(hs, "closed before its hello");
+		return;
+	}
+	if (rc == -1 && errno != EAGAIN && errno != EWOULDBLOCK &&
+	    errno != EINTR) {
+		drop_connection(hs, strerror(errno));
+		return;
+	}
+	if (rc > 0)
+		hs->received += rc;
+
+	if (hs->received == HELLO_SIZE) {
+		hand_off(worker, hs);
+		return;
+	}
+
+	if (!hs->watched) {
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = hs };
+		if (epoll_ctl(worker->listen_epollfd, EPOLL_CTL_ADD, hs->fd,
+			      &ev) == -1) {
+			drop_connection(hs, strerror(errno));
+			return;
+		}
+		hs->watched = true;
+	}
+}
+
+/* Accept the connections pending on a listen socket of @p worker */
+static void accept_connections(struct worker *worker,
+			       struct hello_socket *listen_socket)
+{
+	for (;;) {
+		struct hello_socket *hs = calloc(1, sizeof(*hs));
+		if (!hs) {
+			logging(LOG_ALERT, "could not allocate memory for "
+				"connection");
+			return;
+		}
+		hs->addr_len = sizeof(hs->addr);
+		hs->fd = accept(listen_socket->fd, (struct sockaddr *)&hs->addr,
+				&hs->addr_len);
+		if (hs->fd == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK &&
+			    errno != EINTR)
+				logging(LOG_WARNING, "accept() failed: %s",
+					strerror(errno));
+			free(hs);
+			return;
+		}
+		set_non_blocking(hs->fd);
+		hs->accepted = worker->now;
+		hs->next = worker->hellos;
+		worker->hellos = hs;
+
+		receive_hello(worker, hs);
+	}
+}
+
+void listener_accept(struct worker *worker)
+{
+	struct epoll_event events[LISTENER_EVENTS];
+
+	int nfds = epoll_wait(worker->listen_epollfd, events, LISTENER_EVENTS,
+			      0);
+	if (nfds < 0) {
+		if (errno != EINTR)
+			logging(LOG_WARNING, "failed to wait on the shared "
+				"listeners: %s", strerror(errno));
+		return;
+	}
+
+	for (int i = 0; i < nfds; i++) {
+		struct hello_socket *hs = events[i].data.ptr;
+
+		if (hs->listener)
+			accept_connections(worker, hs);
+		else if (hs->fd != -1)
+			receive_hello(worker, hs);
+	}
+
+	/* Release the connections handed off or closed, and give up on
+	 * those that did not send their hello in time */
+	for (struct hello_socket **next = &worker->hellos; *next;) {
+		struct hello_socket *hs = *next;
+
+		if (hs->fd != -1 && time_diff(&hs->accepted, &worker->now) >
+				    HELLO_TIMEOUT)
+			drop_connection(hs, "no hello received");
+		if (hs->fd == -1) {
+			*next = hs->next;
+			free(hs);
+		} else {
+			next = &hs->next;
+		}
+	}
+}
+#endif /* HAVE_EPOLL */
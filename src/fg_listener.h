@@ -0,0 +1,123 @@
+/**
+ * @file fg_listener.h
+ * @brief Listen sockets shared by the destination flows of the Flowgrind
+ * daemon
+ */
+
+/*
+ * Copyright (C) 2026 Flowgrind authors.
+ *
+ * This file is part of Flowgrind.
+ *
+ * Flowgrind is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Flowgrind is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Flowgrind.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _FG_LISTENER_H_
+#define _FG_LISTENER_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "daemon.h"
+
+/** Port of the shared listeners, 0 for any free port (option -s of the
+ * daemon). */
+extern unsigned short shared_listen_port;
+
+#ifdef HAVE_EPOLL
+/** Time an accepted connection is given to send its hello, in seconds. */
+#define HELLO_TIMEOUT 10
+
+/** A connection accepted by a shared listener for a flow of a worker. */
+struct handoff {
+	/** Socket of the connection. */
+	int fd;
+	/** ID of the destination flow the hello names. */
+	int flow_id;
+	/** Nonce of the hello, tells flows with the same ID apart. */
+	uint32_t nonce;
+	/** Address of the peer. */
+	struct sockaddr_storage addr;
+	/** Length of @p addr. */
+	socklen_t addr_len;
+
+	struct handoff *next;
+};
+
+/**
+ * A listen socket of a shared listener, or a connection accepted on it that
+ * waits for its hello.
+ */
+struct hello_socket {
+	/** The socket, -1 once closed or handed off. */
+	int fd;
+	/** Listener this socket listens for, NULL for an accepted
+	 * connection. */
+	struct listener *listener;
+	/** The socket is registered with the epoll instance of the
+	 * listeners of its worker. */
+	bool watched;
+	/** Point in time the connection was accepted. */
+	struct timespec accepted;
+	/** Part of the hello received so far. */
+	char hello[HELLO_SIZE];
+	/** Number of bytes of the hello received so far. */
+	unsigned received;
+	/** Address of the peer. */
+	struct sockaddr_storage addr;
+	/** Length of @p addr. */
+	socklen_t addr_len;
+
+	struct hello_socket *next;
+};
+
+/**
+ * Let the destination @p flow accept its data connection on the shared
+ * listener for its bind address.
+ *
+ * The listener is created on first use, with a listen socket per worker, and
+ * kept for the lifetime of the daemon. The kernel spreads the incoming
+ * connections over these sockets, the connections are then handed over to the
+ * worker of the flow their hello names.
+ *
+ * @param[in,out] flow destination flow waiting for its data connection
+ * @param[out] hello hello the source has to send, #HELLO_SIZE characters
+ * @param[out] port port of the shared listener
+ * @return 0 on success, -1 on failure with the flow error set
+ */
+int listener_join(struct flow *flow, char hello[HELLO_SIZE + 1],
+		  unsigned short *port);
+
+/**
+ * Accept the connections pending on the shared listeners of @p worker and
+ * receive their hellos.
+ *
+ * Each connection whose hello is complete is queued for the worker of its
+ * flow, which is woken up to attach it. Connections that sent an invalid
+ * hello, or none within #HELLO_TIMEOUT, are closed.
+ *
+ * @param[in,out] worker worker whose listen epoll instance became readable
+ */
+void listener_accept(struct worker *worker);
+#endif /* HAVE_EPOLL */
+
+#endif /* _FG_LISTENER_H_ */
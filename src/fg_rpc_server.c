@@ -40,6 +40,7 @@
 #include "fg_log.h"
 #include "fg_error.h"
 #include "fg_definitions.h"
+#include "fg_time.h"
 #include "debug.h"
 #include "fg_rpc_server.h"
 
@@ -70,6 +71,8 @@ static xmlrpc_value * add_flow_source(xmlrpc_env * const env,
 	char* destination_host = 0;
 	char* cc_alg = 0;
 	char* bind_address = 0;
+	char* payload_file = 0;
+	char* hello = 0;
 	xmlrpc_value* extra_options = 0;
 
 	struct flow_settings settings;
@@ -97,7 +100,9 @@ static xmlrpc_value * add_flow_source(xmlrpc_env * const env,
 		"{s:i,s:i,s:i,s:i,s:i,*}"
 		"{s:s,*}" /* for LIBPCAP dumps */
 		"{s:i,s:A,*}"
-		"{s:s,s:i,s:i,*}"
+		"{s:i,*}" /* worker placement */
+		"{s:i,s:i,s:i,s:d,s:i,s:s,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,*}" /* data path */
+		"{s:s,s:i,s:i,s:s,*}"
 		")",
 
 		/* general settings */
@@ -153,10 +158,29 @@ static xmlrpc_value * add_flow_source(xmlrpc_env * const env,
 		"num_extra_socket_options", &settings.num_extra_socket_options,
 		"extra_socket_options", &extra_options,
 
+		"cpu", &settings.cpu,
+
+		"zerocopy", &settings.zerocopy,
+		"zerocopy_receive", &settings.zerocopy_receive,
+		"timestamping", &settings.timestamping,
+		"tx_timestamps", &settings.tx_timestamps,
+		"discard", &settings.discard,
+		"payload_file", &payload_file,
+		"msg_more", &settings.msg_more,
+		"notsent_lowat", &settings.notsent_lowat,
+		"rcvlowat", &settings.rcvlowat,
+		"budget", &settings.budget,
+		"budget_blocks", &settings.budget_blocks,
+		"pipeline", &settings.pipeline,
+		"crr", &settings.crr,
+		"connections", &settings.connections,
+		"shared_listener", &settings.shared_listener,
+
 		/* source settings */
 		"destination_address", &destination_host,
 		"destination_port", &source_settings.destination_port,
-		"late_connect", &source_settings.late_connect);
+		"late_connect", &source_settings.late_connect,
+		"hello", &hello);
 
 	if (env->fault_occurred)
 		goto cleanup;
@@ -168,18 +192,27 @@ static xmlrpc_value * add_flow_source(xmlrpc_env * const env,
 
 	/* Check for sanity */
 	if (strlen(bind_address) >= sizeof(settings.bind_address) - 1 ||
+		strlen(payload_file) >= sizeof(settings.payload_file) - 1 ||
 		settings.delay[WRITE] < 0 || settings.duration[WRITE] < 0 ||
 		settings.delay[READ] < 0 || settings.duration[READ] < 0 ||
 		settings.requested_send_buffer_size < 0 || settings.requested_read_buffer_size < 0 ||
 		settings.maximum_block_size < MIN_BLOCK_SIZE ||
 		strlen(destination_host) >= sizeof(source_settings.destination_host) - 1||
+		(strlen(hello) != 0 && strlen(hello) != HELLO_SIZE) ||
 		source_settings.destination_port <= 0 || source_settings.destination_port > 65535 ||
 		strlen(cc_alg) > TCP_CA_NAME_MAX ||
 		settings.num_extra_socket_options < 0 || settings.num_extra_socket_options > MAX_EXTRA_SOCKET_OPTIONS ||
 		xmlrpc_array_size(env, extra_options) != settings.num_extra_socket_options ||
 		settings.dscp < 0 || settings.dscp > 255 ||
 		settings.write_rate < 0 ||
-		settings.reporting_interval < 0) {
+		settings.reporting_interval < 0 ||
+		settings.cpu < -1 || settings.msg_more < MSG_MORE_BURST ||
+		settings.notsent_lowat < 0 || settings.rcvlowat < 0 ||
+		settings.budget < 0 || settings.pipeline < 0 ||
+		settings.crr < CRR_NONE || settings.crr > CRR_FASTOPEN ||
+		settings.connections < 0 ||
+		settings.connections > MAX_CONNECTIONS ||
+		settings.tx_timestamps < 0 || settings.tx_timestamps > 1) {
 		XMLRPC_FAIL(env, XMLRPC_TYPE_ERROR, "Flow settings incorrect");
 	}
 
@@ -223,8 +256,10 @@ static xmlrpc_value * add_flow_source(xmlrpc_env * const env,
 	}
 
 	strcpy(source_settings.destination_host, destination_host);
+	strcpy(source_settings.hello, hello);
 	strcpy(settings.cc_alg, cc_alg);
 	strcpy(settings.bind_address, bind_address);
+	strcpy(settings.payload_file, payload_file);
 
 	request = malloc(sizeof(struct request_add_flow_source));
 	request->settings = settings;
@@ -244,7 +279,7 @@ static xmlrpc_value * add_flow_source(xmlrpc_env * const env,
 cleanup:
 	if (request)
 		free_all(request->r.error, request);
-	free_all(destination_host, cc_alg, bind_address);
+	free_all(destination_host, cc_alg, bind_address, payload_file, hello);
 
 	if (extra_options)
 		xmlrpc_DECREF(extra_options);
@@ -284,6 +319,7 @@ static xmlrpc_value * add_flow_destination(xmlrpc_env * const env,
 	xmlrpc_value *ret = 0;
 	char* cc_alg = 0;
 	char* bind_address = 0;
+	char* payload_file = 0;
 	xmlrpc_value* extra_options = 0;
 
 	struct flow_settings settings;
@@ -310,6 +346,8 @@ static xmlrpc_value * add_flow_destination(xmlrpc_env * const env,
 		"{s:i,s:i,s:i,s:i,s:i,*}"
 		"{s:s,*}" /* For libpcap dumps */
 		"{s:i,s:A,*}"
+		"{s:i,*}" /* worker placement */
+		"{s:i,s:i,s:i,s:d,s:i,s:s,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,*}" /* data path */
 		")",
 
 		/* general settings */
@@ -363,7 +401,25 @@ static xmlrpc_value * add_flow_destination(xmlrpc_env * const env,
 		"ipmtudiscover", &settings.ipmtudiscover,
 		"dump_prefix", &dump_prefix,
 		"num_extra_socket_options", &settings.num_extra_socket_options,
-		"extra_socket_options", &extra_options);
+		"extra_socket_options", &extra_options,
+
+		"cpu", &settings.cpu,
+
+		"zerocopy", &settings.zerocopy,
+		"zerocopy_receive", &settings.zerocopy_receive,
+		"timestamping", &settings.timestamping,
+		"tx_timestamps", &settings.tx_timestamps,
+		"discard", &settings.discard,
+		"payload_file", &payload_file,
+		"msg_more", &settings.msg_more,
+		"notsent_lowat", &settings.notsent_lowat,
+		"rcvlowat", &settings.rcvlowat,
+		"budget", &settings.budget,
+		"budget_blocks", &settings.budget_blocks,
+		"pipeline", &settings.pipeline,
+		"crr", &settings.crr,
+		"connections", &settings.connections,
+		"shared_listener", &settings.shared_listener);
 
 	if (env->fault_occurred)
 		goto cleanup;
@@ -375,6 +431,7 @@ static xmlrpc_value * add_flow_destination(xmlrpc_env * const env,
 
 	/* Check for sanity */
 	if (strlen(bind_address) >= sizeof(settings.bind_address) - 1 ||
+		strlen(payload_file) >= sizeof(settings.payload_file) - 1 ||
 		settings.delay[WRITE] < 0 || settings.duration[WRITE] < 0 ||
 		settings.delay[READ] < 0 || settings.duration[READ] < 0 ||
 		settings.requested_send_buffer_size < 0 || settings.requested_read_buffer_size < 0 ||
@@ -382,7 +439,14 @@ static xmlrpc_value * add_flow_destination(xmlrpc_env * const env,
 		settings.write_rate < 0 ||
 		strlen(cc_alg) > TCP_CA_NAME_MAX ||
 		settings.num_extra_socket_options < 0 || settings.num_extra_socket_options > MAX_EXTRA_SOCKET_OPTIONS ||
-		xmlrpc_array_size(env, extra_options) != settings.num_extra_socket_options) {
+		xmlrpc_array_size(env, extra_options) != settings.num_extra_socket_options ||
+		settings.cpu < -1 || settings.msg_more < MSG_MORE_BURST ||
+		settings.notsent_lowat < 0 || settings.rcvlowat < 0 ||
+		settings.budget < 0 || settings.pipeline < 0 ||
+		settings.crr < CRR_NONE || settings.crr > CRR_FASTOPEN ||
+		settings.connections < 0 ||
+		settings.connections > MAX_CONNECTIONS ||
+		settings.tx_timestamps < 0 || settings.tx_timestamps > 1) {
 		XMLRPC_FAIL(env, XMLRPC_TYPE_ERROR, "Flow settings incorrect");
 	}
 
@@ -427,6 +491,7 @@ static xmlrpc_value * add_flow_destination(xmlrpc_env * const env,
 
 	strcpy(settings.cc_alg, cc_alg);
 	strcpy(settings.bind_address, bind_address);
+	strcpy(settings.payload_file, payload_file);
 	DEBUG_MSG(LOG_WARNING, "bind_address=%s", bind_address);
 	request = malloc(sizeof(struct request_add_flow_destination));
 	request->settings = settings;
@@ -436,16 +501,17 @@ static xmlrpc_value * add_flow_destination(xmlrpc_env * const env,
 		XMLRPC_FAIL(env, XMLRPC_INTERNAL_ERROR, request->r.error); /* goto cleanup on failure */
 
 	/* Return our result. */
-	ret = xmlrpc_build_value(env, "{s:i,s:i,s:i,s:i}",
+	ret = xmlrpc_build_value(env, "{s:i,s:i,s:i,s:i,s:s}",
 		"flow_id", request->flow_id,
 		"listen_data_port", request->listen_data_port,
 		"real_listen_send_buffer_size", request->real_listen_send_buffer_size,
-		"real_listen_read_buffer_size", request->real_listen_read_buffer_size);
+		"real_listen_read_buffer_size", request->real_listen_read_buffer_size,
+		"hello", request->hello);
 
 cleanup:
 	if (request)
 		free_all(request->r.error, request);
-	free_all(cc_alg, bind_address);
+	free_all(cc_alg, bind_address, payload_file);
 
 	if (extra_options)
 		xmlrpc_DECREF(extra_options);
@@ -481,8 +547,13 @@ static xmlrpc_value * start_flows(xmlrpc_env * const env,
 	if (env->fault_occurred)
 		goto cleanup;
 
+	/* The start timestamp of older controllers is not used, the flows
+	 * start right away */
+	UNUSED_ARGUMENT(start_timestamp);
+
 	request = malloc(sizeof(struct request_start_flows));
-	request->start_timestamp = start_timestamp;
+	request->start_at.tv_sec = 0;
+	request->start_at.tv_nsec = 0;
 	rc = dispatch_request((struct request*)request, REQUEST_START_FLOWS);
 
 	if (rc == -1)
@@ -504,6 +575,67 @@ cleanup:
 	return ret;
 }
 
+/**
+ * Arm the flows to start at a point in time given by the wall clock of this
+ * daemon.
+ *
+ * The controller arms all daemons with the same start, corrected for the
+ * offsets of their clocks, so that the flows of all daemons start together.
+ * The flows are started even if the start has passed already, the time they
+ * started late by is reported as start error.
+ */
+static xmlrpc_value * method_arm_flows(xmlrpc_env * const env,
+				       xmlrpc_value * const param_array,
+				       void * const user_data)
+{
+	UNUSED_ARGUMENT(user_data);
+
+	int rc;
+	xmlrpc_value *ret = 0;
+	int start_sec, start_nsec;
+	struct timespec now;
+	struct request_start_flows *request = 0;
+
+	DEBUG_MSG(LOG_WARNING, "method arm_flows called");
+
+	/* Parse our argument array. */
+	xmlrpc_decompose_value(env, param_array, "({s:i,s:i,*})",
+			       "start_tv_sec", &start_sec,
+			       "start_tv_nsec", &start_nsec);
+
+	if (env->fault_occurred)
+		goto cleanup;
+
+	if (start_sec <= 0 || start_nsec < 0 || start_nsec >= NSEC_PER_SEC)
+		XMLRPC_FAIL(env, XMLRPC_TYPE_ERROR, "Invalid start time");
+
+	gettime(&now);
+	request = malloc(sizeof(struct request_start_flows));
+	request->start_at.tv_sec = start_sec;
+	request->start_at.tv_nsec = start_nsec;
+	DEBUG_MSG(LOG_NOTICE, "arming flows to start in %.6lfs",
+		  time_diff(&now, &request->start_at));
+	rc = dispatch_request((struct request*)request, REQUEST_START_FLOWS);
+
+	if (rc == -1)
+		XMLRPC_FAIL(env, XMLRPC_INTERNAL_ERROR, request->r.error); /* goto cleanup on failure */
+
+	/* Return our result. */
+	ret = xmlrpc_build_value(env, "i", 0);
+
+cleanup:
+	if (request)
+		free_all(request->r.error, request);
+
+	if (env->fault_occurred)
+		logging(LOG_WARNING, "method arm_flows failed: %s",
+			env->fault_string);
+	else
+		DEBUG_MSG(LOG_WARNING, "method arm_flows successful");
+
+	return ret;
+}
+
 /**
  * To get the reports from the daemon.
  *
@@ -540,13 +672,21 @@ static xmlrpc_value * method_get_reports(xmlrpc_env * const env,
 		xmlrpc_value *rv = xmlrpc_build_value(env,
 			"("
 			"{s:i,s:i,s:i,s:i,s:i,s:i,s:i}" /* Report data & timeval */
-			"{s:i,s:i,s:i,s:i}" /* bytes */
-			"{s:i,s:i,s:i,s:i}" /* block counts */
+			"{s:i,s:i,s:i,s:i,s:i,s:i}" /* bytes */
+			"{s:i,s:i,s:i,s:i,s:i}" /* block counts */
 			"{s:d,s:d,s:d,s:d,s:d,s:d,s:d,s:d,s:d}" /* RTT, IAT, Delay */
+			"{s:d,s:d,s:d,s:d}" /* from schedule */
+			"{s:i,s:i,s:d,s:d,s:d,s:d,s:d,s:d}" /* kernel timestamps */
+			"{s:d,s:d}" /* clock offset */
+			"{s:d}" /* start error */
+			"{s:i,s:d,s:d,s:d,s:i,s:d,s:d,s:d,s:i,s:d,s:d,s:d}" /* transmit stages */
 			"{s:i,s:i}" /* MTU */
 			"{s:i,s:i,s:i,s:i,s:i}" /* TCP info */
 			"{s:i,s:i,s:i,s:i,s:i}" /* ...      */
 			"{s:i,s:i,s:i,s:i,s:i}" /* ...      */
+			"{s:i,s:i}" /* zerocopy */
+			"{s:i,s:i,s:i}" /* scheduling */
+			"{s:i,s:i,s:d,s:d,s:d,s:i,s:i}" /* connections */
 			"{s:i}"
 			")",
 
@@ -562,11 +702,14 @@ static xmlrpc_value * method_get_reports(xmlrpc_env * const env,
 			"bytes_read_low", (int32_t)(report->bytes_read & 0xFFFFFFFF),
 			"bytes_written_high", (int32_t)(report->bytes_written >> 32),
 			"bytes_written_low", (int32_t)(report->bytes_written & 0xFFFFFFFF),
+			"bytes_discarded_high", (int32_t)(report->bytes_discarded >> 32),
+			"bytes_discarded_low", (int32_t)(report->bytes_discarded & 0xFFFFFFFF),
 
 			"request_blocks_read", report->request_blocks_read,
 			"request_blocks_written", report->request_blocks_written,
 			"response_blocks_read", report->response_blocks_read,
 			"response_blocks_written", report->response_blocks_written,
+			"iat_samples", report->iat_samples,
 
 			"rtt_min", report->rtt_min,
 			"rtt_max", report->rtt_max,
@@ -577,6 +720,33 @@ static xmlrpc_value * method_get_reports(xmlrpc_env * const env,
 			"delay_min", report->delay_min,
 			"delay_max", report->delay_max,
 			"delay_sum", report->delay_sum,
+			"sched_delay_max", report->sched_delay_max,
+			"sched_delay_sum", report->sched_delay_sum,
+			"sched_rtt_max", report->sched_rtt_max,
+			"sched_rtt_sum", report->sched_rtt_sum,
+			"kernel_blocks", report->kernel_blocks,
+			"kernel_iat_samples", report->kernel_iat_samples,
+			"kernel_iat_min", report->kernel_iat_min,
+			"kernel_iat_max", report->kernel_iat_max,
+			"kernel_iat_sum", report->kernel_iat_sum,
+			"kernel_delay_min", report->kernel_delay_min,
+			"kernel_delay_max", report->kernel_delay_max,
+			"kernel_delay_sum", report->kernel_delay_sum,
+			"clock_offset", report->clock_offset,
+			"clock_error", report->clock_error,
+			"start_error", report->start_error,
+			"tx_sndbuf_samples", report->tx_samples[TX_SNDBUF],
+			"tx_sndbuf_min", report->tx_min[TX_SNDBUF],
+			"tx_sndbuf_max", report->tx_max[TX_SNDBUF],
+			"tx_sndbuf_sum", report->tx_sum[TX_SNDBUF],
+			"tx_qdisc_samples", report->tx_samples[TX_QDISC],
+			"tx_qdisc_min", report->tx_min[TX_QDISC],
+			"tx_qdisc_max", report->tx_max[TX_QDISC],
+			"tx_qdisc_sum", report->tx_sum[TX_QDISC],
+			"tx_ack_samples", report->tx_samples[TX_ACK],
+			"tx_ack_min", report->tx_min[TX_ACK],
+			"tx_ack_max", report->tx_max[TX_ACK],
+			"tx_ack_sum", report->tx_sum[TX_ACK],
 
 			"pmtu", report->pmtu,
 			"imtu", report->imtu,
@@ -599,6 +769,19 @@ static xmlrpc_value * method_get_reports(xmlrpc_env * const env,
 			"tcpi_ca_state", (int)report->tcp_info.tcpi_ca_state,
 			"tcpi_snd_mss", (int)report->tcp_info.tcpi_snd_mss,
 
+			"zerocopy_sends", report->zerocopy_sends,
+			"zerocopy_copied", report->zerocopy_copied,
+			"wakeups", report->wakeups,
+			"budget_exhausted", report->budget_exhausted,
+			"response_blocks_pending", report->response_blocks_pending,
+			"connects", report->connects,
+			"connect_failures", report->connect_failures,
+			"connect_time_min", report->connect_time_min,
+			"connect_time_max", report->connect_time_max,
+			"connect_time_sum", report->connect_time_sum,
+			"time_wait", report->time_wait,
+			"connections", report->connections,
+
 			"status", report->status
 		);
 
@@ -665,6 +848,103 @@ cleanup:
 	return ret;
 }
 
+/**
+ * Set the estimated offset of the clock of the source daemon of a destination
+ * flow.
+ *
+ * The one-way delays the flow measures from then on are corrected by the
+ * offset, which drifts at the given rate.
+ *
+ * @param[in,out] env XML-RPC environment object
+ * @param[in] param_array flow ID, offset, drift and error bound
+ * @param[in,out] user_data unused arg
+ * return xmlrpc_value XML-RPC value
+ */
+static xmlrpc_value * method_set_clock_offset(xmlrpc_env * const env,
+		   xmlrpc_value * const param_array,
+		   void * const user_data)
+{
+	UNUSED_ARGUMENT(user_data);
+
+	int rc;
+	xmlrpc_value *ret = 0;
+	struct request_set_clock *request = 0;
+
+	DEBUG_MSG(LOG_WARNING, "method set_clock_offset called");
+
+	request = malloc(sizeof(struct request_set_clock));
+	request->r.error = NULL;
+
+	/* Parse our argument array. */
+	xmlrpc_decompose_value(env, param_array, "({s:i,s:d,s:d,s:d,*})",
+		"flow_id", &request->flow_id,
+		"offset", &request->offset,
+		"drift", &request->drift,
+		"error", &request->error);
+
+	if (env->fault_occurred)
+		goto cleanup;
+
+	if (request->error <= 0)
+		XMLRPC_FAIL(env, XMLRPC_TYPE_ERROR,
+			    "Clock offset error bound must be positive");
+
+	rc = dispatch_request((struct request*)request, REQUEST_SET_CLOCK);
+
+	if (rc == -1)
+		XMLRPC_FAIL(env, XMLRPC_INTERNAL_ERROR, request->r.error); /* goto cleanup on failure */
+
+	/* Return our result. */
+	ret = xmlrpc_build_value(env, "()");
+
+cleanup:
+	if (request)
+		free_all(request->r.error, request);
+
+	if (env->fault_occurred)
+		logging(LOG_WARNING, "method set_clock_offset failed: %s",
+			env->fault_string);
+	else
+		DEBUG_MSG(LOG_WARNING, "method set_clock_offset successful");
+
+	return ret;
+}
+
+/**
+ * Read the wall clock of the daemon.
+ *
+ * The controller probes the clocks of the daemons with this method to
+ * estimate their offsets.
+ *
+ * @param[in,out] env XML-RPC environment object
+ * @param[in,out] param_array unused arg
+ * @param[in,out] user_data unused arg
+ * return xmlrpc_value XML-RPC value
+ */
+static xmlrpc_value * method_get_time(xmlrpc_env * const env,
+		   xmlrpc_value * const param_array,
+		   void * const user_data)
+{
+	UNUSED_ARGUMENT(param_array);
+	UNUSED_ARGUMENT(user_data);
+
+	struct timespec now;
+	xmlrpc_value *ret = 0;
+
+	DEBUG_MSG(LOG_NOTICE, "method get_time called");
+
+	gettime(&now);
+	ret = xmlrpc_build_value(env, "{s:i,s:i}",
+				 "tv_sec", (int)now.tv_sec,
+				 "tv_nsec", (int)now.tv_nsec);
+
+	if (env->fault_occurred)
+		logging(LOG_WARNING, "method get_time failed: %s",
+			env->fault_string);
+
+	return ret;
+}
+
 /* This method returns version information of flowgrindd and OS as an xmlrpc struct */
 static xmlrpc_value * method_get_version(xmlrpc_env * const env,
 		   xmlrpc_value * const param_array,
@@ -844,11 +1124,14 @@ void init_rpc_server(struct fg_rpc_server *server, char *rpc_bind_addr, unsigned
 	xmlrpc_registry_add_method(env, registryP, NULL, "add_flow_destination", &add_flow_destination, NULL);
 	xmlrpc_registry_add_method(env, registryP, NULL, "add_flow_source", &add_flow_source, NULL);
 	xmlrpc_registry_add_method(env, registryP, NULL, "start_flows", &start_flows, NULL);
+	xmlrpc_registry_add_method(env, registryP, NULL, "arm_flows", &method_arm_flows, NULL);
 	xmlrpc_registry_add_method(env, registryP, NULL, "get_reports", &method_get_reports, NULL);
 	xmlrpc_registry_add_method(env, registryP, NULL, "stop_flow", &method_stop_flow, NULL);
 	xmlrpc_registry_add_method(env, registryP, NULL, "get_version", &method_get_version, NULL);
 	xmlrpc_registry_add_method(env, registryP, NULL, "get_status", &method_get_status, NULL);
 	xmlrpc_registry_add_method(env, registryP, NULL, "get_uuid", &method_get_uuid, NULL);
+	xmlrpc_registry_add_method(env, registryP, NULL, "get_time", &method_get_time, NULL);
+	xmlrpc_registry_add_method(env, registryP, NULL, "set_clock_offset", &method_set_clock_offset, NULL);
 
 	/* In the modern form of the Abyss API, we supply parameters in memory
 	   like a normal API.  We select the modern form by setting
@@ -53,6 +53,10 @@
 #include <string.h>
 #endif /* HAVE_STRING_H */
 
+#ifdef HAVE_SO_TIMESTAMPING
+#include <linux/net_tstamp.h>
+#endif /* HAVE_SO_TIMESTAMPING */
+
 #ifdef HAVE_LIBPCAP
 #include <pcap.h>
 #include "fg_pcap.h"
@@ -344,6 +348,141 @@ int toggle_tcp_cork(int fd)
 #endif /* HAVE_SO_TCP_CORK */
 }
 
+int set_so_zerocopy(int fd)
+{
+#ifdef HAVE_SO_ZEROCOPY
+	int opt = 1;
+
+	DEBUG_MSG(LOG_WARNING, "setting SO_ZEROCOPY on fd %d", fd);
+	return setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt));
+#else /* HAVE_SO_ZEROCOPY */
+	UNUSED_ARGUMENT(fd);
+	DEBUG_MSG(LOG_ERR, "cannot set SO_ZEROCOPY for OS other than Linux");
+	errno = ENOPROTOOPT;
+	return -1;
+#endif /* HAVE_SO_ZEROCOPY */
+}
+
+int set_tcp_inq(int fd)
+{
+#ifdef HAVE_TCP_INQ
+	int opt = 1;
+
+	DEBUG_MSG(LOG_WARNING, "setting TCP_INQ on fd %d", fd);
+	return setsockopt(fd, SOL_TCP, TCP_INQ, &opt, sizeof(opt));
+#else /* HAVE_TCP_INQ */
+	UNUSED_ARGUMENT(fd);
+	DEBUG_MSG(LOG_ERR, "cannot set TCP_INQ for OS other than Linux");
+	errno = ENOPROTOOPT;
+	return -1;
+#endif /* HAVE_TCP_INQ */
+}
+
+int set_so_timestamping(int fd, int rx, int tx)
+{
+#ifdef HAVE_SO_TIMESTAMPING
+	int opt = SOF_TIMESTAMPING_SOFTWARE;
+
+	/* Hardware timestamps are taken from the clock of the interface,
+	 * which the one-way delay cannot be compared with */
+	if (rx)
+		opt |= SOF_TIMESTAMPING_RX_SOFTWARE;
+	/* Which sends are stamped is requested per send. The timestamps are
+	 * keyed by the offset of the last byte of the send in the stream */
+	if (tx)
+		opt |= SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+
+	DEBUG_MSG(LOG_WARNING, "setting SO_TIMESTAMPING to 0x%x on fd %d",
+		  opt, fd);
+	return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &opt, sizeof(opt));
+#else /* HAVE_SO_TIMESTAMPING */
+	UNUSED_ARGUMENT(fd);
+	UNUSED_ARGUMENT(rx);
+	UNUSED_ARGUMENT(tx);
+	DEBUG_MSG(LOG_ERR, "cannot set SO_TIMESTAMPING for OS other than "
+		  "Linux");
+	errno = ENOPROTOOPT;
+	return -1;
+#endif /* HAVE_SO_TIMESTAMPING */
+}
+
+int set_tcp_notsent_lowat(int fd, int bytes)
+{
+#ifdef HAVE_SO_TCP_NOTSENT_LOWAT
+	DEBUG_MSG(LOG_WARNING, "setting TCP_NOTSENT_LOWAT to %d on fd %d",
+		  bytes, fd);
+	return setsockopt(fd, SOL_TCP, TCP_NOTSENT_LOWAT, &bytes,
+			  sizeof(bytes));
+#else /* HAVE_SO_TCP_NOTSENT_LOWAT */
+	UNUSED_ARGUMENT(fd);
+	UNUSED_ARGUMENT(bytes);
+	DEBUG_MSG(LOG_ERR, "cannot set TCP_NOTSENT_LOWAT for OS other than "
+		  "Linux");
+	errno = ENOPROTOOPT;
+	return -1;
+#endif /* HAVE_SO_TCP_NOTSENT_LOWAT */
+}
+
+int set_so_rcvlowat(int fd, int bytes)
+{
+	DEBUG_MSG(LOG_WARNING, "setting SO_RCVLOWAT to %d on fd %d", bytes, fd);
+	return setsockopt(fd, SOL_SOCKET, SO_RCVLOWAT, &bytes, sizeof(bytes));
+}
+
+int set_tcp_fastopen(int fd, int queue_length)
+{
+#ifdef HAVE_SO_TCP_FASTOPEN
+	DEBUG_MSG(LOG_WARNING, "setting TCP_FASTOPEN to %d on fd %d",
+		  queue_length, fd);
+	return setsockopt(fd, SOL_TCP, TCP_FASTOPEN, &queue_length,
+			  sizeof(queue_length));
+#else /* HAVE_SO_TCP_FASTOPEN */
+	UNUSED_ARGUMENT(fd);
+	UNUSED_ARGUMENT(queue_length);
+	DEBUG_MSG(LOG_ERR, "cannot set TCP_FASTOPEN on this OS");
+	errno = ENOPROTOOPT;
+	return -1;
+#endif /* HAVE_SO_TCP_FASTOPEN */
+}
+
+int set_tcp_fastopen_connect(int fd)
+{
+#ifdef HAVE_SO_TCP_FASTOPEN_CONNECT
+	int opt = 1;
+
+	DEBUG_MSG(LOG_WARNING, "setting TCP_FASTOPEN_CONNECT on fd %d", fd);
+	return setsockopt(fd, SOL_TCP, TCP_FASTOPEN_CONNECT, &opt,
+			  sizeof(opt));
+#else /* HAVE_SO_TCP_FASTOPEN_CONNECT */
+	UNUSED_ARGUMENT(fd);
+	DEBUG_MSG(LOG_ERR, "cannot set TCP_FASTOPEN_CONNECT for OS other "
+		  "than Linux");
+	errno = ENOPROTOOPT;
+	return -1;
+#endif /* HAVE_SO_TCP_FASTOPEN_CONNECT */
+}
+
+/* Returns the number of TCP sockets of the host in TIME_WAIT, -1 if unknown */
+int get_tcp_time_wait(void)
+{
+#ifdef __LINUX__
+	char line[256];
+	int time_wait = -1;
+	FILE *sockstat = fopen("/proc/net/sockstat", "r");
+
+	if (!sockstat)
+		return -1;
+	while (fgets(line, sizeof(line), sockstat))
+		if (sscanf(line, "TCP: inuse %*d orphan %*d tw %d",
+			   &time_wait) == 1)
+			break;
+	fclose(sockstat);
+	return time_wait;
+#else /* __LINUX__ */
+	return -1;
+#endif /* __LINUX__ */
+}
+
 int set_tcp_mtcp(int fd)
 {
 #ifndef TCP_MTCP
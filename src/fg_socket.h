@@ -49,6 +49,14 @@ int set_tcp_nodelay(int fd);
 int set_dscp(int fd, int dscp);
 int set_tcp_cork(int fd);
 int toggle_tcp_cork(int fd);
+int set_so_zerocopy(int fd);
+int set_tcp_inq(int fd);
+int set_so_timestamping(int fd, int rx, int tx);
+int set_tcp_notsent_lowat(int fd, int bytes);
+int set_so_rcvlowat(int fd, int bytes);
+int set_tcp_fastopen(int fd, int queue_length);
+int set_tcp_fastopen_connect(int fd);
+int get_tcp_time_wait(void);
 int set_window_size(int, int);
 int set_window_size_directed(int, int, int);
 
@@ -30,6 +30,7 @@
 #endif /* HAVE_CONFIG_H */
 
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
@@ -98,6 +99,12 @@ double time_diff(const struct timespec *tp1, const struct timespec *tp2)
 		+ (double) (tp2->tv_nsec - tp1->tv_nsec) / (long) NSEC_PER_SEC;
 }
 
+int64_t time_diff_ns(const struct timespec *tp1, const struct timespec *tp2)
+{
+	return (int64_t) (tp2->tv_sec - tp1->tv_sec) * NSEC_PER_SEC
+		+ (tp2->tv_nsec - tp1->tv_nsec);
+}
+
 double time_diff_now(const struct timespec *tp)
 {
 	struct timespec now;
@@ -135,8 +142,13 @@ bool normalize_tp(struct timespec *tp)
 
 void time_add(struct timespec *tp, double seconds)
 {
-	tp->tv_sec += (time_t) seconds;
-	tp->tv_nsec += (long) ((seconds - (time_t) seconds) * (long) NSEC_PER_SEC);
+	time_add_ns(tp, llround(seconds * NSEC_PER_SEC));
+}
+
+void time_add_ns(struct timespec *tp, int64_t ns)
+{
+	tp->tv_sec += (time_t) (ns / NSEC_PER_SEC);
+	tp->tv_nsec += (long) (ns % NSEC_PER_SEC);
 	normalize_tp(tp);
 }
 
@@ -156,6 +168,13 @@ int gettime(struct timespec *tp)
 	/* Get wall-clock time */
 	return clock_gettime(CLOCK_REALTIME, tp);
 }
+
+int gettime_mono(struct timespec *tp)
+{
+	/* Unlike CLOCK_MONOTONIC_RAW, CLOCK_MONOTONIC is read in the vDSO by
+	 * all Linux versions, from the TSC if it is invariant */
+	return clock_gettime(CLOCK_MONOTONIC, tp);
+}
 /* OS X hasn't defined POSIX clocks, but clock_get_time() */
 #elif defined HAVE_CLOCK_GET_TIME
 int gettime(struct timespec *tp)
@@ -184,4 +203,20 @@ int gettime(struct timespec *tp)
 
 	return (rc == KERN_SUCCESS ? 0 : -1);
 }
+
+int gettime_mono(struct timespec *tp)
+{
+	clock_serv_t cclock;
+	mach_timespec_t mts;
+
+	/* The system clock counts the time since boot */
+	host_get_clock_service(mach_host_self(), SYSTEM_CLOCK, &cclock);
+	kern_return_t rc = clock_get_time(cclock, &mts);
+	mach_port_deallocate(mach_task_self(), cclock);
+
+	tp->tv_sec = mts.tv_sec;
+	tp->tv_nsec = mts.tv_nsec;
+
+	return (rc == KERN_SUCCESS ? 0 : -1);
+}
 #endif /* HAVE_CLOCK_GETTIME */
@@ -35,6 +35,7 @@
 #include <sys/time.h>
 #include <time.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifndef NSEC_PER_SEC
 /** Number of nanoseconds per second. */
@@ -105,6 +106,18 @@ const char *ctimespec(const struct timespec *tp, bool ns);
  */
 double time_diff(const struct timespec *tp1, const struct timespec *tp2);
 
+/**
+ * Returns the time difference between two points in time @p tp1 and @p tp2
+ * in integer nanoseconds.
+ *
+ * Unlike time_diff(), no precision is lost for long intervals.
+ *
+ * @param[in] tp1 point in time
+ * @param[in] tp2 point in time
+ * @return time difference in nanoseconds, negative if @p tp1 is after @p tp2
+ */
+int64_t time_diff_ns(const struct timespec *tp1, const struct timespec *tp2);
+
 /**
  * Returns time difference between now and the specific point in time @p tp.
  *
@@ -142,6 +155,15 @@ bool normalize_tp(struct timespec *tp);
  */
 void time_add(struct timespec *tp, double seconds);
 
+/**
+ * Add an amount of time @p ns in nanoseconds to a specific point in time
+ * @p tp.
+ *
+ * @param[in,out] tp point in time
+ * @param[in] ns amount of time in nanoseconds, may be negative
+ */
+void time_add_ns(struct timespec *tp, int64_t ns);
+
 /**
  * Returns the current wall-clock time with nanosecond precision.
  *
@@ -155,4 +177,18 @@ void time_add(struct timespec *tp, double seconds);
  */
 int gettime(struct timespec *tp);
 
+/**
+ * Returns the current time of a monotonic clock with nanosecond precision.
+ *
+ * The clock does not jump if the system time is set, and is only slewed by
+ * NTP, so it is suited for scheduling and measuring intervals on a single
+ * host. Its epoch is unspecified, thus points in time of different hosts
+ * cannot be compared. On Linux, reading it does not enter the kernel.
+ *
+ * @param[out] tp current time in seconds and nanoseconds since an
+ * unspecified point in the past
+ * @return return 0 for success, or -1 for failure
+ */
+int gettime_mono(struct timespec *tp);
+
 #endif /* _FG_TIME_H_ */
@@ -0,0 +1,247 @@
+/**
+ * @file fg_txstamp.c
+ * @brief Transmit timestamps of sampled blocks in the Flowgrind daemon
+ */
+
+/*
+ * Copyright (C) 2026 Flowgrind authors.
+ *
+ * This file is part of Flowgrind.
+ *
+ * Flowgrind is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Flowgrind is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Flowgrind.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <netinet/in.h>
+
+#ifdef HAVE_SO_TIMESTAMPING
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#endif /* HAVE_SO_TIMESTAMPING */
+
+#include "debug.h"
+#include "fg_definitions.h"
+#include "fg_error.h"
+#include "fg_socket.h"
+#include "fg_time.h"
+#include "fg_txstamp.h"
+
+#ifdef HAVE_SO_TIMESTAMPING
+int txstamp_init(struct flow *flow)
+{
+	struct txstamp *tx;
+	struct cmsghdr *cmsg;
+	uint32_t flags = SOF_TIMESTAMPING_TX_SCHED |
+			 SOF_TIMESTAMPING_TX_SOFTWARE |
+			 SOF_TIMESTAMPING_TX_ACK;
+
+	if (set_so_timestamping(flow->fd, flow->settings.timestamping,
+				1) == -1) {
+		flow_error(flow, "Unable to set SO_TIMESTAMPING: %s",
+			   strerror(errno));
+		return -1;
+	}
+
+	tx = calloc(1, sizeof(*tx));
+	if (!tx) {
+		flow_error(flow, "Could not allocate memory for transmit "
+			   "timestamps");
+		return -1;
+	}
+
+	cmsg = (struct cmsghdr *)tx->control;
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SO_TIMESTAMPING;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(flags));
+	memcpy(CMSG_DATA(cmsg), &flags, sizeof(flags));
+
+	flow->tx = tx;
+	return 0;
+}
+
+void txstamp_free(struct flow *flow)
+{
+	free(flow->tx);
+	flow->tx = NULL;
+}
+
+void txstamp_prepare_block(struct flow *flow)
+{
+	struct txstamp *tx = flow->tx;
+	struct txstamp_sample *sample = &tx->samples[tx->next];
+
+	tx->sampling = false;
+	tx->credit += flow->settings.tx_timestamps;
+	if (tx->credit < 1)
+		return;
+	tx->credit -= 1;
+
+	/* Too many sampled blocks still wait for their acknowledgment */
+	if (sample->used)
+		return;
+
+	/* The stream starts with the hello of a shared listener */
+	uint32_t offset = flow->statistics[FINAL].bytes_written +
+			  strlen(flow->source_settings.hello);
+	memset(sample, 0, sizeof(*sample));
+	sample->used = true;
+	sample->key = offset + flow->current_write_block_size - 1;
+	sample->sent = ((struct block *)flow->write_block)->data;
+
+	tx->next = (tx->next + 1) % TXSTAMP_INFLIGHT;
+	tx->sampling = true;
+}
+
+void txstamp_attach(struct flow *flow, struct msghdr *msg)
+{
+	/* Only the send covering the last byte of the block gets timestamps
+	 * keyed like the sample, the others are ignored */
+	if (flow->tx->sampling) {
+		msg->msg_control = flow->tx->control;
+		msg->msg_controllen = sizeof(flow->tx->control);
+	} else {
+		msg->msg_control = NULL;
+		msg->msg_controllen = 0;
+	}
+}
+
+/* Account the time the block of @p sample spent in @p stage once the
+ * timestamps of both its ends are known */
+static void account_stage(struct flow *flow, struct txstamp_sample *sample,
+			  enum tx_stage stage)
+{
+	const struct timespec *begin = stage == TX_SNDBUF ? &sample->sent :
+				       &sample->passed[stage - 1];
+	const struct timespec *end = &sample->passed[stage];
+
+	if ((!begin->tv_sec && !begin->tv_nsec) ||
+	    (!end->tv_sec && !end->tv_nsec))
+		return;
+
+	double time = time_diff(begin, end);
+	if (time < 0)
+		return;
+
+	foreach(int *i, INTERVAL, FINAL) {
+		flow->statistics[*i].tx_samples[stage]++;
+		ASSIGN_MIN(flow->statistics[*i].tx_min[stage], time);
+		ASSIGN_MAX(flow->statistics[*i].tx_max[stage], time);
+		flow->statistics[*i].tx_sum[stage] += time;
+	}
+}
+
+/* Note that the block of @p sample passed the end of @p stage at @p stamp */
+static void pass_stage(struct flow *flow, struct txstamp_sample *sample,
+		       enum tx_stage stage, const struct timespec *stamp)
+{
+	struct timespec *end = &sample->passed[stage];
+
+	/* A retransmission is stamped again */
+	if (end->tv_sec || end->tv_nsec)
+		return;
+	*end = *stamp;
+
+	/* The timestamps are not necessarily queued in order */
+	account_stage(flow, sample, stage);
+	if (stage + 1 < TX_STAGES)
+		account_stage(flow, sample, stage + 1);
+}
+
+/* Account the timestamp @p stamp of type @p type for the block keyed by
+ * @p key */
+static void record_stamp(struct flow *flow, uint32_t key, uint32_t type,
+			 const struct timespec *stamp)
+{
+	struct txstamp_sample *sample = NULL;
+
+	for (unsigned i = 0; i < TXSTAMP_INFLIGHT; i++)
+		if (flow->tx->samples[i].used &&
+		    flow->tx->samples[i].key == key) {
+			sample = &flow->tx->samples[i];
+			break;
+		}
+	/* A send of a sampled block that did not complete it */
+	if (!sample)
+		return;
+
+	DEBUG_MSG(LOG_DEBUG, "transmit timestamp %u for byte %u of flow %d",
+		  type, key, flow->id);
+
+	switch (type) {
+	case SCM_TSTAMP_SCHED:
+		pass_stage(flow, sample, TX_SNDBUF, stamp);
+		break;
+	case SCM_TSTAMP_SND:
+		pass_stage(flow, sample, TX_QDISC, stamp);
+		break;
+	case SCM_TSTAMP_ACK:
+		pass_stage(flow, sample, TX_ACK, stamp);
+		sample->used = false;
+		break;
+	}
+}
+
+int txstamp_reap(struct flow *flow)
+{
+	char control[CMSG_SPACE(sizeof(struct scm_timestamping)) +
+		     CMSG_SPACE(sizeof(struct sock_extended_err)) +
+		     CMSG_SPACE(sizeof(struct sockaddr_in6))];
+
+	for (;;) {
+		struct scm_timestamping stamps;
+		struct sock_extended_err *serr = NULL;
+		bool stamped = false;
+		struct msghdr msg;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(flow->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0
+									 : -1;
+
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+			    cmsg->cmsg_type == SCM_TIMESTAMPING) {
+				memcpy(&stamps, CMSG_DATA(cmsg),
+				       sizeof(stamps));
+				stamped = true;
+			} else if ((cmsg->cmsg_level == SOL_IP &&
+				    cmsg->cmsg_type == IP_RECVERR) ||
+				   (cmsg->cmsg_level == SOL_IPV6 &&
+				    cmsg->cmsg_type == IPV6_RECVERR)) {
+				serr = (struct sock_extended_err *)
+				       CMSG_DATA(cmsg);
+			}
+		}
+
+		if (stamped && serr && serr->ee_errno == ENOMSG &&
+		    serr->ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+			record_stamp(flow, serr->ee_data, serr->ee_info,
+				     &stamps.ts[0]);
+	}
+
+	return 0;
+}
+#endif /* HAVE_SO_TIMESTAMPING */
@@ -0,0 +1,127 @@
+/**
+ * @file fg_txstamp.h
+ * @brief Transmit timestamps of sampled blocks in the Flowgrind daemon
+ */
+
+/*
+ * Copyright (C) 2026 Flowgrind authors.
+ *
+ * This file is part of Flowgrind.
+ *
+ * Flowgrind is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Flowgrind is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Flowgrind.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _FG_TXSTAMP_H_
+#define _FG_TXSTAMP_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "daemon.h"
+
+#ifdef HAVE_SO_TIMESTAMPING
+/** Number of sampled blocks a flow can have in flight. */
+#define TXSTAMP_INFLIGHT 64
+
+/** A request block sampled for transmit timestamps. */
+struct txstamp_sample {
+	/** The sample waits for the timestamps of its block. */
+	bool used;
+	/** Offset of the last byte of the block in the data stream. The
+	 * kernel keys the timestamps of the send covering it by it. */
+	uint32_t key;
+	/** Point in time the block was handed to the socket. */
+	struct timespec sent;
+	/** Point in time the block passed the previous stage, zero if not
+	 * yet. Indexed by the stage that ends with it. */
+	struct timespec passed[TX_STAGES];
+};
+
+/**
+ * Transmit timestamp state of a flow.
+ *
+ * The kernel reports the timestamps of a sampled block on the error queue of
+ * the socket once the block has passed the packet scheduler, the network
+ * device and has been acknowledged. The time between these points is
+ * accounted to the stages of #tx_stage.
+ */
+struct txstamp {
+	/** Ring of the sampled blocks in flight. */
+	struct txstamp_sample samples[TXSTAMP_INFLIGHT];
+	/** Slot of the next sample. */
+	unsigned next;
+	/** Share of a block accrued towards the next sample. */
+	double credit;
+	/** The current write block is sampled. */
+	bool sampling;
+	/** Control message requesting the timestamps, attached to each send
+	 * of a sampled block. */
+	char control[CMSG_SPACE(sizeof(uint32_t))];
+};
+
+/**
+ * Set up transmit timestamps for @p flow.
+ *
+ * Must be called once the data connection is established, but before any
+ * data has been written to it. While connecting, the kernel would key the
+ * timestamps relative to the SYN.
+ *
+ * @param[in,out] flow flow to sample blocks of
+ * @return 0 on success, -1 on failure with the flow error set
+ */
+int txstamp_init(struct flow *flow);
+
+/**
+ * Release the transmit timestamp state of @p flow.
+ *
+ * @param[in,out] flow flow whose state is released
+ */
+void txstamp_free(struct flow *flow);
+
+/**
+ * Decide whether the write block just prepared is sampled.
+ *
+ * Must be called whenever the write block has been filled with a new header.
+ *
+ * @param[in,out] flow flow that prepared a write block
+ */
+void txstamp_prepare_block(struct flow *flow);
+
+/**
+ * Attach the request for transmit timestamps to @p msg if the current write
+ * block is sampled, or remove it otherwise.
+ *
+ * @param[in] flow flow sending the current write block
+ * @param[in,out] msg message of the send
+ */
+void txstamp_attach(struct flow *flow, struct msghdr *msg);
+
+/**
+ * Process the transmit timestamps queued on the socket of @p flow.
+ *
+ * @param[in,out] flow flow to process the timestamps of
+ * @return 0 on success, -1 on failure with errno set
+ */
+int txstamp_reap(struct flow *flow);
+#endif /* HAVE_SO_TIMESTAMPING */
+
+#endif /* _FG_TXSTAMP_H_ */
@@ -0,0 +1,310 @@
+/**
+ * @file fg_zerocopy.c
+ * @brief Zerocopy transmission and reception of blocks in the Flowgrind daemon
+ */
+
+/*
+ * Copyright (C) 2026 Flowgrind authors.
+ *
+ * This file is part of Flowgrind.
+ *
+ * Flowgrind is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Flowgrind is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Flowgrind.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+
+#ifdef HAVE_SO_ZEROCOPY
+#include <linux/errqueue.h>
+#endif /* HAVE_SO_ZEROCOPY */
+
+#include "debug.h"
+#include "fg_definitions.h"
+#include "fg_zerocopy.h"
+
+#ifdef HAVE_SO_ZEROCOPY
+/** Marks an unused entry of the notification ID table. */
+#define ZEROCOPY_ID_UNUSED -2
+
+int zerocopy_init(struct flow *flow)
+{
+	struct zerocopy *zc = calloc(1, sizeof(*zc));
+	if (!zc)
+		return -1;
+
+	zc->current = -1;
+	for (unsigned i = 0; i < ZEROCOPY_INFLIGHT; i++)
+		zc->id_slot[i] = ZEROCOPY_ID_UNUSED;
+	zc->msg.msg_iov = zc->iov;
+
+	flow->zc = zc;
+	return 0;
+}
+
+void zerocopy_free(struct flow *flow)
+{
+	free(flow->zc);
+	flow->zc = NULL;
+}
+
+/* Returns a header slot without sends in flight, or -1 */
+static int free_header_slot(struct zerocopy *zc)
+{
+	for (unsigned i = 0; i < ZEROCOPY_HEADERS; i++) {
+		unsigned slot = (zc->next_slot + i) % ZEROCOPY_HEADERS;
+		if (!zc->outstanding[slot]) {
+			zc->next_slot = (slot + 1) % ZEROCOPY_HEADERS;
+			return slot;
+		}
+	}
+	return -1;
+}
+
+/* Returns true if the kernel can be given another zerocopy send */
+static inline bool id_available(const struct zerocopy *zc)
+{
+	return zc->id_slot[zc->next_id % ZEROCOPY_INFLIGHT] ==
+	       ZEROCOPY_ID_UNUSED;
+}
+
+int zerocopy_prepare_send(struct flow *flow)
+{
+	struct zerocopy *zc = flow->zc;
+	unsigned offset = flow->current_block_bytes_written;
+	unsigned header_size = sizeof(struct block);
+
+	/* A new block has been serialized into the write block */
+	if (!offset) {
+		zc->current = free_header_slot(zc);
+		if (zc->current == -1 && zerocopy_reap(flow) == 0)
+			zc->current = free_header_slot(zc);
+		if (zc->current != -1)
+			memcpy(&zc->headers[zc->current], flow->write_block,
+			       header_size);
+	}
+
+	zc->flags = 0;
+	if (zc->current != -1 && !zc->copy_next) {
+		if (!id_available(zc))
+			zerocopy_reap(flow);
+		if (id_available(zc))
+			zc->flags = MSG_ZEROCOPY;
+	}
+	zc->copy_next = false;
+	if (flow->write_more)
+		zc->flags |= MSG_MORE;
+
+	/* The header is taken from the ring, the payload directly from the
+	 * shared payload */
+	zc->msg.msg_iovlen = 0;
+	zc->with_header = offset < header_size;
+	if (zc->with_header) {
+		zc->iov[0].iov_base = (zc->current != -1 ?
+				       (char *)&zc->headers[zc->current] :
+				       flow->write_block) + offset;
+		zc->iov[0].iov_len = header_size - offset;
+		zc->msg.msg_iovlen++;
+		offset = header_size;
+	}
+	if (offset < flow->current_write_block_size) {
+		zc->iov[zc->msg.msg_iovlen].iov_base =
+			(char *)flow->payload + offset;
+		zc->iov[zc->msg.msg_iovlen].iov_len =
+			flow->current_write_block_size - offset;
+		zc->msg.msg_iovlen++;
+	}
+
+	return zc->flags;
+}
+
+int zerocopy_complete_send(struct flow *flow, int res)
+{
+	struct zerocopy *zc = flow->zc;
+
+	if (res == -ENOBUFS && zc->flags & MSG_ZEROCOPY) {
+		DEBUG_MSG(LOG_NOTICE, "no memory for zerocopy notifications "
+			  "on flow %d", flow->id);
+		zc->copy_next = true;
+		return -EAGAIN;
+	}
+	if (res <= 0)
+		return res;
+
+	foreach(int *i, INTERVAL, FINAL)
+		flow->statistics[*i].zerocopy_sends++;
+
+	if (!(zc->flags & MSG_ZEROCOPY)) {
+		foreach(int *i, INTERVAL, FINAL)
+			flow->statistics[*i].zerocopy_copied++;
+		return res;
+	}
+
+	/* Each successful zerocopy send consumes one notification ID */
+	int slot = zc->with_header ? zc->current : -1;
+	zc->id_slot[zc->next_id++ % ZEROCOPY_INFLIGHT] = slot;
+	if (slot != -1)
+		zc->outstanding[slot]++;
+	zc->inflight++;
+
+	return res;
+}
+
+int zerocopy_send(struct flow *flow)
+{
+	int rc;
+
+	do {
+		rc = sendmsg(flow->fd, &flow->zc->msg,
+			     zerocopy_prepare_send(flow));
+		rc = zerocopy_complete_send(flow, rc == -1 ? -errno : rc);
+	} while (rc == -EAGAIN && flow->zc->copy_next);
+
+	if (rc < 0) {
+		errno = -rc;
+		return -1;
+	}
+	return rc;
+}
+
+/* Complete the zerocopy sends with notification IDs @p lo to @p hi */
+static void complete_range(struct flow *flow, uint32_t lo, uint32_t hi,
+			   bool copied)
+{
+	struct zerocopy *zc = flow->zc;
+
+	for (uint32_t id = lo; ; id++) {
+		int16_t *slot = &zc->id_slot[id % ZEROCOPY_INFLIGHT];
+		if (*slot != ZEROCOPY_ID_UNUSED) {
+			if (*slot != -1)
+				zc->outstanding[*slot]--;
+			*slot = ZEROCOPY_ID_UNUSED;
+			zc->inflight--;
+			/* The kernel could not transmit from our memory */
+			if (copied)
+				foreach(int *i, INTERVAL, FINAL)
+					flow->statistics[*i].zerocopy_copied++;
+		}
+		if (id == hi)
+			break;
+	}
+}
+
+int zerocopy_reap(struct flow *flow)
+{
+	char control[CMSG_SPACE(sizeof(struct sock_extended_err)) +
+		     CMSG_SPACE(sizeof(struct sockaddr_in6))];
+
+	for (;;) {
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(flow->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0
+									 : -1;
+
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (!(cmsg->cmsg_level == SOL_IP &&
+			      cmsg->cmsg_type == IP_RECVERR) &&
+			    !(cmsg->cmsg_level == SOL_IPV6 &&
+			      cmsg->cmsg_type == IPV6_RECVERR))
+				continue;
+
+			struct sock_extended_err *serr =
+				(struct sock_extended_err *)CMSG_DATA(cmsg);
+			if (serr->ee_errno ||
+			    serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			DEBUG_MSG(LOG_DEBUG, "zerocopy sends %u to %u of flow "
+				  "%d completed", serr->ee_info, serr->ee_data,
+				  flow->id);
+			complete_range(flow, serr->ee_info, serr->ee_data,
+				       serr->ee_code &
+				       SO_EE_CODE_ZEROCOPY_COPIED);
+		}
+	}
+
+	return 0;
+}
+#endif /* HAVE_SO_ZEROCOPY */
+
+#ifdef HAVE_TCP_ZEROCOPY_RECEIVE
+int zerocopy_receive_init(struct flow *flow)
+{
+	struct zerocopy_receive *zr = calloc(1, sizeof(*zr));
+	if (!zr)
+		return -1;
+
+	zr->area = mmap(NULL, ZEROCOPY_RECEIVE_AREA, PROT_READ, MAP_SHARED,
+			flow->fd, 0);
+	if (zr->area == MAP_FAILED) {
+		free(zr);
+		return -1;
+	}
+
+	zr->copy = malloc(ZEROCOPY_RECEIVE_COPY);
+	if (!zr->copy) {
+		munmap(zr->area, ZEROCOPY_RECEIVE_AREA);
+		free(zr);
+		return -1;
+	}
+
+	flow->zr = zr;
+	return 0;
+}
+
+void zerocopy_receive_free(struct flow *flow)
+{
+	if (!flow->zr)
+		return;
+
+	munmap(flow->zr->area, ZEROCOPY_RECEIVE_AREA);
+	free(flow->zr->copy);
+	free(flow->zr);
+	flow->zr = NULL;
+}
+
+int zerocopy_receive(struct flow *flow, unsigned *copy)
+{
+	struct tcp_zerocopy_receive zc;
+	socklen_t len = sizeof(zc);
+
+	memset(&zc, 0, sizeof(zc));
+	zc.address = (uintptr_t)flow->zr->area;
+	zc.length = ZEROCOPY_RECEIVE_AREA;
+
+	if (getsockopt(flow->fd, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE, &zc,
+		       &len) == -1)
+		return -1;
+
+	DEBUG_MSG(LOG_DEBUG, "flow %d mapped %u bytes, %u bytes to copy",
+		  flow->id, zc.length, zc.recv_skip_hint);
+
+	*copy = zc.recv_skip_hint;
+	return zc.length;
+}
+#endif /* HAVE_TCP_ZEROCOPY_RECEIVE */
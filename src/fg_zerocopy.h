@@ -0,0 +1,196 @@
+/**
+ * @file fg_zerocopy.h
+ * @brief Zerocopy transmission and reception of blocks in the Flowgrind daemon
+ */
+
+/*
+ * Copyright (C) 2026 Flowgrind authors.
+ *
+ * This file is part of Flowgrind.
+ *
+ * Flowgrind is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Flowgrind is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Flowgrind.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _FG_ZEROCOPY_H_
+#define _FG_ZEROCOPY_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "common.h"
+#include "daemon.h"
+
+#ifdef HAVE_SO_ZEROCOPY
+/** Number of block headers a flow can have in flight. */
+#define ZEROCOPY_HEADERS 64
+/** Number of zerocopy sends a flow can have in flight. */
+#define ZEROCOPY_INFLIGHT 1024
+
+/**
+ * Zerocopy state of a flow.
+ *
+ * With MSG_ZEROCOPY the kernel transmits directly from user memory, so memory
+ * passed to a send must not change until the kernel signals its completion on
+ * the error queue of the socket. The shared payload never changes, but the
+ * header in the write block does with every block. Hence the header of each
+ * block is copied into a ring of headers first, and a slot of the ring is
+ * reused only once all sends referring to it have completed.
+ */
+struct zerocopy {
+	/** Copies of the headers of the blocks in flight. */
+	struct block headers[ZEROCOPY_HEADERS];
+	/** Number of uncompleted sends referring to each header. */
+	unsigned outstanding[ZEROCOPY_HEADERS];
+	/** Header slot of the block currently sent, -1 if the block is
+	 * copied into the kernel. */
+	int current;
+	/** Header slot to look at first for the next block. */
+	unsigned next_slot;
+
+	/** Header slot referred to by each send in flight, indexed by the
+	 * notification ID modulo #ZEROCOPY_INFLIGHT. -1 if the send refers
+	 * to the payload only, -2 if unused. */
+	int16_t id_slot[ZEROCOPY_INFLIGHT];
+	/** Notification ID the kernel assigns to the next zerocopy send. */
+	uint32_t next_id;
+	/** Number of zerocopy sends not yet completed. */
+	unsigned inflight;
+
+	/** Message of the pending send. Kept here since io_uring reads it
+	 * asynchronously. */
+	struct msghdr msg;
+	/** Header and payload part of the pending send. */
+	struct iovec iov[2];
+	/** Flags of the pending send. */
+	int flags;
+	/** The pending send includes bytes of the block header. */
+	bool with_header;
+	/** The kernel ran out of memory for notifications, so copy the next
+	 * send. */
+	bool copy_next;
+};
+
+/**
+ * Set up the zerocopy state of @p flow.
+ *
+ * SO_ZEROCOPY must already be enabled on the data socket.
+ *
+ * @param[in,out] flow flow to set up zerocopy for
+ * @return 0 on success, -1 on failure with errno set
+ */
+int zerocopy_init(struct flow *flow);
+
+/**
+ * Release the zerocopy state of @p flow.
+ *
+ * @param[in,out] flow flow whose state is released
+ */
+void zerocopy_free(struct flow *flow);
+
+/**
+ * Prepare the message to send the rest of the current write block.
+ *
+ * Must be called whenever the write block has been filled with a new header.
+ * Falls back to copying the block if no header slot or notification ID is
+ * free.
+ *
+ * @param[in,out] flow flow to send data on
+ * @return the flags to pass to sendmsg() along with the prepared message
+ */
+int zerocopy_prepare_send(struct flow *flow);
+
+/**
+ * Account the result of the send prepared by zerocopy_prepare_send().
+ *
+ * @param[in,out] flow flow that sent data
+ * @param[in] res number of bytes sent or negative error number
+ * @return @p res, or -EAGAIN if the kernel could not take the zerocopy send
+ * and the next one has to be copied
+ */
+int zerocopy_complete_send(struct flow *flow, int res);
+
+/**
+ * Send the rest of the current write block of @p flow.
+ *
+ * @param[in,out] flow flow to send data on
+ * @return number of bytes sent, -1 on failure with errno set
+ */
+int zerocopy_send(struct flow *flow);
+
+/**
+ * Process the completion notifications queued on the socket of @p flow.
+ *
+ * @param[in,out] flow flow to process the notifications of
+ * @return 0 on success, -1 on failure with errno set
+ */
+int zerocopy_reap(struct flow *flow);
+#endif /* HAVE_SO_ZEROCOPY */
+
+#ifdef HAVE_TCP_ZEROCOPY_RECEIVE
+/** Size of the area received data is mapped into. */
+#define ZEROCOPY_RECEIVE_AREA (1 << 20)
+/** Size of the buffer data is copied into if it cannot be mapped. */
+#define ZEROCOPY_RECEIVE_COPY (1 << 16)
+
+/**
+ * Mapped receive state of a flow.
+ *
+ * With TCP_ZEROCOPY_RECEIVE the kernel maps the pages holding received data
+ * into an area mapped from the socket instead of copying the data. Only whole
+ * pages can be mapped, the rest is copied into a small buffer.
+ */
+struct zerocopy_receive {
+	/** Area mapped from the socket, received pages are mapped into. */
+	char *area;
+	/** Buffer for received data that cannot be mapped. */
+	char *copy;
+};
+
+/**
+ * Set up mapped receive on the data socket of @p flow.
+ *
+ * @param[in,out] flow flow to set up mapped receive for
+ * @return 0 on success, -1 on failure with errno set
+ */
+int zerocopy_receive_init(struct flow *flow);
+
+/**
+ * Release the mapped receive state of @p flow.
+ *
+ * @param[in,out] flow flow whose state is released
+ */
+void zerocopy_receive_free(struct flow *flow);
+
+/**
+ * Map the next received data of @p flow into its receive area.
+ *
+ * Data mapped by the previous call is unmapped. The caller has to copy the
+ * @p copy bytes following the mapped data with recv() before the next call.
+ *
+ * @param[in,out] flow flow to receive data on
+ * @param[out] copy number of bytes that could not be mapped
+ * @return number of bytes mapped at the start of the receive area, -1 on
+ * failure with errno set
+ */
+int zerocopy_receive(struct flow *flow, unsigned *copy);
+#endif /* HAVE_TCP_ZEROCOPY_RECEIVE */
+
+#endif /* _FG_ZEROCOPY_H_ */
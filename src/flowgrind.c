@@ -124,6 +124,9 @@ static struct arg_parser parser;
 /** Number of currently active flows. */
 static unsigned short active_flows = 0;
 
+/** Point in time the clock offsets of the daemons were last estimated. */
+static struct timespec clocks_updated;
+
 /* To cover a gcc bug (http://gcc.gnu.org/bugzilla/show_bug.cgi?id=36446) */
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
@@ -210,6 +213,7 @@ static void usage_trafgenopt(void)
 inline static void print_output(const char *fmt, ...)
 	__attribute__((format(printf, 1, 2)));
 static void fetch_reports(xmlrpc_client *);
+static void update_clocks(xmlrpc_client *rpc_client);
 static void report_flow(struct report* report);
 static void print_interval_report(unsigned short flow_id, enum endpoint_t e,
 		                  struct report *report);
@@ -302,7 +306,8 @@ static void usage(short status)
 		"                 for the CONTROL connection to the same host.\n"
 		"                 An endpoint that isn't specified is assumed to be localhost\n"
 		"  -J #           use random seed # (default: read /dev/urandom)\n"
-		"  -I             enable one-way delay calculation (no clock synchronization)\n"
+		"  -I             enable one-way delay calculation. Between different daemons,\n"
+		"                 it is corrected by the estimated offset of their clocks\n"
 		"  -L             call connect() on test socket immediately before starting to\n"
 		"                 send data (late connect). If not specified the test connection\n"
 		"                 is established in the preparation phase before the test starts\n"
@@ -323,6 +328,40 @@ static void usage(short status)
 		"                 truncates values if used with stochastic traffic generation\n"
 		"  -W x=#         set requested receiver buffer (advertised window), in bytes\n"
 		"  -Y x=#.#       set initial delay before the host starts to send, in seconds\n"
+		"      --cpu x=#  handle flow by the daemon worker thread bound to CPU core #\n"
+		"      --discard x\n"
+		"                 drop the payload of received blocks without copying it, only\n"
+		"                 the block headers are read\n"
+		"      --payload-file x=FILE\n"
+		"                 send the payload of the blocks from FILE with sendfile(2)\n"
+		"      --msg-more x=#|burst\n"
+		"                 send blocks with MSG_MORE, flushing them every # blocks or\n"
+		"                 at the end of each burst of blocks\n"
+		"      --notsent-lowat x=#\n"
+		"                 set TCP_NOTSENT_LOWAT to # bytes, limiting the unsent data\n"
+		"                 queued in the socket\n"
+		"      --rcvlowat x=#|block\n"
+		"                 set SO_RCVLOWAT to # bytes or to the size of the received\n"
+		"                 blocks, waking up once that much data arrived\n"
+		"      --budget x=#[blocks]\n"
+		"                 with -P, move at most # bytes or blocks per round before\n"
+		"                 yielding to the other flows of the daemon\n"
+		"      --pipeline x=#\n"
+		"                 closed-loop request/response: keep at most # requests\n"
+		"                 awaiting their response, needs -G p=... or -A\n"
+		"      --tx-timestamps x=#.#\n"
+		"                 take transmit timestamps of the given share of the request\n"
+		"                 blocks to break their latency down into send buffer, qdisc\n"
+		"                 and acknowledgment\n"
+		"      --crr[=tfo]\n"
+		"                 connect/request/response: open a new connection for every\n"
+		"                 request, with 'tfo' the request is sent with TCP Fast Open\n"
+		"      --connections=#\n"
+		"                 spread the flow over # connections sharing its settings,\n"
+		"                 request blocks are sent on them in turn (needs epoll)\n"
+		"      --shared-listener\n"
+		"                 connect to the listen socket the destination daemon shares\n"
+		"                 among its flows, the source sends a hello to name the flow\n"
 /*		"  -Z x=#.#       set amount of data to be send, in bytes (instead of -t)\n"*/,
 		progname,
 		MIN_BLOCK_SIZE
@@ -354,6 +393,12 @@ static void usage_sockopt(void)
 		"               disable nagle algorithm on test socket\n"
 		"  -O x=SO_DEBUG\n"
 		"               set SO_DEBUG on test socket\n"
+		"  -O x=SO_ZEROCOPY\n"
+		"               set SO_ZEROCOPY on test socket and send with MSG_ZEROCOPY\n"
+		"  -O x=TCP_ZEROCOPY_RECEIVE\n"
+		"               map received data with TCP_ZEROCOPY_RECEIVE instead of copying\n"
+		"  -O x=SO_TIMESTAMPING\n"
+		"               take the arrival time of blocks from kernel receive timestamps\n"
 		"  -O x=IP_MTU_DISCOVER\n"
 		"               set IP_MTU_DISCOVER on test socket if not already enabled by\n"
 		"               system default\n"
@@ -512,8 +557,24 @@ static void init_flow_options(void)
 			cflow[id].settings[*i].nonagle = 0;
 			cflow[id].settings[*i].traffic_dump = 0;
 			cflow[id].settings[*i].so_debug = 0;
+			cflow[id].settings[*i].zerocopy = 0;
+			cflow[id].settings[*i].zerocopy_receive = 0;
+			cflow[id].settings[*i].timestamping = 0;
+			cflow[id].settings[*i].tx_timestamps = 0;
+			cflow[id].settings[*i].discard = 0;
+			cflow[id].settings[*i].payload_file[0] = 0;
+			cflow[id].settings[*i].msg_more = 0;
+			cflow[id].settings[*i].notsent_lowat = 0;
+			cflow[id].settings[*i].rcvlowat = 0;
+			cflow[id].settings[*i].budget = 0;
+			cflow[id].settings[*i].budget_blocks = 0;
+			cflow[id].settings[*i].pipeline = 0;
+			cflow[id].settings[*i].crr = CRR_NONE;
+			cflow[id].settings[*i].connections = 0;
+			cflow[id].settings[*i].shared_listener = 0;
 			cflow[id].settings[*i].dscp = 0;
 			cflow[id].settings[*i].ipmtudiscover = 0;
+			cflow[id].settings[*i].cpu = -1;
 
 			cflow[id].settings[*i].num_extra_socket_options = 0;
 		}
@@ -882,6 +943,174 @@ static void check_idle(xmlrpc_client *rpc_client)
 	}
 }
 
+/**
+ * Estimate the offset of the clock of @p daemon to the one of the controller.
+ *
+ * Out of #CLOCK_PROBES probes, the one with the shortest round trip is taken
+ * since its error bound is the smallest.
+ *
+ * @param[in,out] rpc_client to connect controller to daemon
+ * @param[in,out] daemon daemon whose clock is probed
+ */
+static void probe_clock(xmlrpc_client *rpc_client, struct daemon *daemon)
+{
+	struct clock_estimate *clock = &daemon->clock;
+	struct timespec probed = {0, 0};
+	double offset = 0, error = INFINITY;
+
+	for (int i = 0; i < CLOCK_PROBES; i++) {
+		xmlrpc_value *resultP = 0;
+		struct timespec sent, received, remote;
+		int tv_sec, tv_nsec;
+
+		gettime(&sent);
+		xmlrpc_client_call2f(&rpc_env, rpc_client, daemon->url,
+				     "get_time", &resultP, "()");
+		gettime(&received);
+		die_if_fault_occurred(&rpc_env);
+		if (!resultP)
+			continue;
+
+		xmlrpc_decompose_value(&rpc_env, resultP, "{s:i,s:i,*}",
+				       "tv_sec", &tv_sec, "tv_nsec", &tv_nsec);
+		die_if_fault_occurred(&rpc_env);
+		xmlrpc_DECREF(resultP);
+
+		double half_rtt = time_diff(&sent, &received) / 2;
+		if (half_rtt >= error)
+			continue;
+
+		/* The daemon read its clock halfway through the round trip */
+		remote.tv_sec = tv_sec;
+		remote.tv_nsec = tv_nsec;
+		error = half_rtt;
+		offset = time_diff(&sent, &remote) - half_rtt;
+		probed = sent;
+		time_add(&probed, half_rtt);
+	}
+
+	if (isinf(error))
+		return;
+
+	DEBUG_MSG(LOG_NOTICE, "clock of node %s is off by %.6lfs (+/- %.6lfs)",
+		  daemon->url, offset, error);
+
+	if (!clock->valid) {
+		clock->valid = true;
+		clock->first_offset = offset;
+		clock->first_error = error;
+		clock->first_probed = probed;
+	} else if (fabs(offset - clock->first_offset) >
+		   error + clock->first_error) {
+		/* The drift is taken once the offset changed by more than
+		 * the estimates can tell apart */
+		clock->drift = (offset - clock->first_offset) /
+			       time_diff(&clock->first_probed, &probed);
+	}
+
+	clock->offset = offset;
+	clock->error = error;
+	clock->probed = probed;
+}
+
+/* Offset of the clock of a daemon at @p tp by its estimate @p clock */
+static inline double clock_offset_at(const struct clock_estimate *clock,
+				     const struct timespec *tp)
+{
+	return clock->offset + clock->drift * time_diff(&clock->probed, tp);
+}
+
+/* Returns true if the one-way delay of flow @p id is corrected by the
+ * offset of the clocks of its daemons */
+static inline bool flow_clock_corrected(unsigned id)
+{
+	return cflow[id].one_way_delay &&
+	       cflow[id].endpoint[SOURCE].daemon !=
+	       cflow[id].endpoint[DESTINATION].daemon;
+}
+
+/**
+ * Estimate the offsets of the clocks of the daemons and pass them on to the
+ * destinations of the flows, which correct their one-way delay by them.
+ *
+ * Only the daemons of flows between different daemons with option -I are
+ * probed.
+ *
+ * @param[in,out] rpc_client to connect controller to daemon
+ */
+static void update_clocks(xmlrpc_client *rpc_client)
+{
+	struct timespec now;
+
+	gettime(&clocks_updated);
+
+	for (unsigned id = 0; id < copt.num_flows; id++) {
+		if (!flow_clock_corrected(id))
+			continue;
+		foreach(int *i, SOURCE, DESTINATION) {
+			struct daemon *daemon = cflow[id].endpoint[*i].daemon;
+			if (daemon->api_version < 5) {
+				warnx("node %s cannot estimate clock offsets, "
+				      "one-way delay of flow %u is not "
+				      "corrected", daemon->url, id);
+				cflow[id].one_way_delay = 0;
+				break;
+			}
+		}
+	}
+
+	const struct list_node *node = fg_list_front(&unique_daemons);
+	while (node) {
+		if (sigint_caught)
+			return;
+
+		struct daemon *daemon = node->data;
+		node = node->next;
+
+		for (unsigned id = 0; id < copt.num_flows; id++) {
+			if (flow_clock_corrected(id) &&
+			    (cflow[id].endpoint[SOURCE].daemon == daemon ||
+			     cflow[id].endpoint[DESTINATION].daemon == daemon)) {
+				probe_clock(rpc_client, daemon);
+				break;
+			}
+		}
+	}
+
+	gettime(&now);
+	for (unsigned id = 0; id < copt.num_flows; id++) {
+		if (!flow_clock_corrected(id) || cflow[id].finished[DESTINATION])
+			continue;
+
+		const struct clock_estimate *source =
+			&cflow[id].endpoint[SOURCE].daemon->clock;
+		const struct clock_estimate *destination =
+			&cflow[id].endpoint[DESTINATION].daemon->clock;
+		if (!source->valid || !destination->valid)
+			continue;
+
+		/* The flow may have ended in the meantime */
+		xmlrpc_env env;
+		xmlrpc_value *resultP = 0;
+		xmlrpc_env_init(&env);
+		xmlrpc_client_call2f(&env, rpc_client,
+				     cflow[id].endpoint[DESTINATION].daemon->url,
+				     "set_clock_offset", &resultP,
+				     "({s:i,s:d,s:d,s:d})",
+				     "flow_id", cflow[id].endpoint_id[DESTINATION],
+				     "offset", clock_offset_at(destination, &now) -
+					       clock_offset_at(source, &now),
+				     "drift", destination->drift - source->drift,
+				     "error", destination->error + source->error);
+		if (env.fault_occurred)
+			DEBUG_MSG(LOG_WARNING, "could not set clock offset of "
+				  "flow %u: %s", id, env.fault_string);
+		if (resultP)
+			xmlrpc_DECREF(resultP);
+		xmlrpc_env_clean(&env);
+	}
+}
+
 /**
  * To show/hide intermediated interval report columns.
  *
@@ -993,6 +1222,8 @@ static void prepare_flow(int id, xmlrpc_client *rpc_client)
 	xmlrpc_value *resultP, *extra_options;
 
 	int listen_data_port;
+	const char *hello_value;
+	char hello[HELLO_SIZE + 1];
 	DEBUG_MSG(LOG_WARNING, "prepare flow %d destination", id);
 
 	/* Contruct extra socket options array */
@@ -1030,6 +1261,8 @@ static void prepare_flow(int id, xmlrpc_client *rpc_client)
 		"{s:i,s:i,s:i,s:i,s:i}"
 		"{s:s}"
 		"{s:i,s:A}"
+		"{s:i}" /* worker placement */
+		"{s:i,s:i,s:i,s:d,s:i,s:s,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i}" /* data path */
 		")",
 
 		/* general flow settings */
@@ -1083,16 +1316,37 @@ static void prepare_flow(int id, xmlrpc_client *rpc_client)
 		"ipmtudiscover", cflow[id].settings[DESTINATION].ipmtudiscover,
 		"dump_prefix", copt.dump_prefix,
 		"num_extra_socket_options", cflow[id].settings[DESTINATION].num_extra_socket_options,
-		"extra_socket_options", extra_options);
+		"extra_socket_options", extra_options,
+
+		"cpu", cflow[id].settings[DESTINATION].cpu,
+
+		"zerocopy", cflow[id].settings[DESTINATION].zerocopy,
+		"zerocopy_receive", cflow[id].settings[DESTINATION].zerocopy_receive,
+		"timestamping", cflow[id].settings[DESTINATION].timestamping,
+		"tx_timestamps", cflow[id].settings[DESTINATION].tx_timestamps,
+		"discard", cflow[id].settings[DESTINATION].discard,
+		"payload_file", cflow[id].settings[DESTINATION].payload_file,
+		"msg_more", cflow[id].settings[DESTINATION].msg_more,
+		"notsent_lowat", cflow[id].settings[DESTINATION].notsent_lowat,
+		"rcvlowat", cflow[id].settings[DESTINATION].rcvlowat,
+		"budget", cflow[id].settings[DESTINATION].budget,
+		"budget_blocks", cflow[id].settings[DESTINATION].budget_blocks,
+		"pipeline", cflow[id].settings[DESTINATION].pipeline,
+		"crr", cflow[id].settings[DESTINATION].crr,
+		"connections", cflow[id].settings[DESTINATION].connections,
+		"shared_listener", cflow[id].settings[DESTINATION].shared_listener);
 
 	die_if_fault_occurred(&rpc_env);
 
-	xmlrpc_parse_value(&rpc_env, resultP, "{s:i,s:i,s:i,s:i,*}",
+	xmlrpc_parse_value(&rpc_env, resultP, "{s:i,s:i,s:i,s:i,s:s,*}",
 		"flow_id", &cflow[id].endpoint_id[DESTINATION],
 		"listen_data_port", &listen_data_port,
 		"real_listen_send_buffer_size", &cflow[id].endpoint[DESTINATION].send_buffer_size_real,
-		"real_listen_read_buffer_size", &cflow[id].endpoint[DESTINATION].receive_buffer_size_real);
+		"real_listen_read_buffer_size", &cflow[id].endpoint[DESTINATION].receive_buffer_size_real,
+		"hello", &hello_value);
 	die_if_fault_occurred(&rpc_env);
+	/* The string is owned by the result */
+	snprintf(hello, sizeof(hello), "%s", hello_value);
 
 	if (resultP)
 		xmlrpc_DECREF(resultP);
@@ -1135,7 +1389,9 @@ static void prepare_flow(int id, xmlrpc_client *rpc_client)
 		"{s:i,s:i,s:i,s:i,s:i}"
 		"{s:s}"
 		"{s:i,s:A}"
-		"{s:s,s:i,s:i}"
+		"{s:i}" /* worker placement */
+		"{s:i,s:i,s:i,s:d,s:i,s:s,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i}" /* data path */
+		"{s:s,s:i,s:i,s:s}"
 		")",
 
 		/* general flow settings */
@@ -1192,10 +1448,29 @@ static void prepare_flow(int id, xmlrpc_client *rpc_client)
 		"num_extra_socket_options", cflow[id].settings[SOURCE].num_extra_socket_options,
 		"extra_socket_options", extra_options,
 
+		"cpu", cflow[id].settings[SOURCE].cpu,
+
+		"zerocopy", cflow[id].settings[SOURCE].zerocopy,
+		"zerocopy_receive", cflow[id].settings[SOURCE].zerocopy_receive,
+		"timestamping", cflow[id].settings[SOURCE].timestamping,
+		"tx_timestamps", cflow[id].settings[SOURCE].tx_timestamps,
+		"discard", cflow[id].settings[SOURCE].discard,
+		"payload_file", cflow[id].settings[SOURCE].payload_file,
+		"msg_more", cflow[id].settings[SOURCE].msg_more,
+		"notsent_lowat", cflow[id].settings[SOURCE].notsent_lowat,
+		"rcvlowat", cflow[id].settings[SOURCE].rcvlowat,
+		"budget", cflow[id].settings[SOURCE].budget,
+		"budget_blocks", cflow[id].settings[SOURCE].budget_blocks,
+		"pipeline", cflow[id].settings[SOURCE].pipeline,
+		"crr", cflow[id].settings[SOURCE].crr,
+		"connections", cflow[id].settings[SOURCE].connections,
+		"shared_listener", cflow[id].settings[SOURCE].shared_listener,
+
 		/* source settings */
 		"destination_address", cflow[id].endpoint[DESTINATION].test_address,
 		"destination_port", listen_data_port,
-		"late_connect", (int)cflow[id].late_connect);
+		"late_connect", (int)cflow[id].late_connect,
+		"hello", hello);
 	die_if_fault_occurred(&rpc_env);
 
 	xmlrpc_DECREF(extra_options);
@@ -1226,6 +1501,72 @@ static void prepare_all_flows(xmlrpc_client *rpc_client)
 	}
 }
 
+/**
+ * Arm all daemons to start their flows together.
+ *
+ * The clock of each daemon is probed first. The start is then set far enough
+ * ahead for the arming of all daemons to complete before it, and passed to
+ * each daemon in terms of its own clock.
+ *
+ * @param[in,out] rpc_client to connect controller to daemon
+ * @return false if the daemons cannot be armed, true otherwise
+ */
+static bool arm_all_daemons(xmlrpc_client *rpc_client)
+{
+	struct timespec start, now;
+	double margin = START_MARGIN;
+	const struct list_node *node;
+
+	for (node = fg_list_front(&unique_daemons); node; node = node->next) {
+		struct daemon *daemon = node->data;
+		if (daemon->api_version < 6) {
+			warnx("node %s cannot be armed, the flows are started "
+			      "one node after another", daemon->url);
+			return false;
+		}
+	}
+
+	for (node = fg_list_front(&unique_daemons); node; node = node->next) {
+		struct daemon *daemon = node->data;
+		if (sigint_caught)
+			return false;
+		probe_clock(rpc_client, daemon);
+		if (!daemon->clock.valid)
+			return false;
+		margin += START_ARM_ROUND_TRIPS * 2 * daemon->clock.error;
+	}
+
+	gettime(&start);
+	time_add(&start, margin);
+
+	for (node = fg_list_front(&unique_daemons); node; node = node->next) {
+		xmlrpc_value *resultP = 0;
+		struct daemon *daemon = node->data;
+		struct timespec armed = start;
+
+		if (sigint_caught)
+			return false;
+
+		time_add(&armed, clock_offset_at(&daemon->clock, &start));
+		DEBUG_MSG(LOG_ERR, "arming flows on server with UUID %s",
+			  daemon->uuid);
+		xmlrpc_client_call2f(&rpc_env, rpc_client, daemon->url,
+				     "arm_flows", &resultP, "({s:i,s:i})",
+				     "start_tv_sec", (int)armed.tv_sec,
+				     "start_tv_nsec", (int)armed.tv_nsec);
+		die_if_fault_occurred(&rpc_env);
+		if (resultP)
+			xmlrpc_DECREF(resultP);
+	}
+
+	gettime(&now);
+	if (time_is_after(&now, &start))
+		warnx("arming the nodes took %.3f ms longer than expected, the "
+		      "flows start late", time_diff(&start, &now) * 1e3);
+
+	return true;
+}
+
 /**
  * Start test connections for all flows in a test
  *
@@ -1235,6 +1576,9 @@ static void prepare_all_flows(xmlrpc_client *rpc_client)
  * are respective to flow endpoints. Single daemons can maintain multiple flows
  * endpoints, So controller should start a daemon only once.
  *
+ * The daemons are armed to start together if all of them support it, see
+ * arm_all_daemons(). Otherwise they are started one after another.
+ *
  * @param[in,out] rpc_client to connect controller to daemon
  */
 static void start_all_flows(xmlrpc_client *rpc_client)
@@ -1249,7 +1593,10 @@ static void start_all_flows(xmlrpc_client *rpc_client)
 	gettime(&lastreport_begin);
 	gettime(&now);
 
-	const struct list_node *node = fg_list_front(&unique_daemons);
+	/* Without a synchronized start, the flows of the daemons started
+	 * later are behind by the round trips to the daemons before */
+	const struct list_node *node = arm_all_daemons(rpc_client)
+				       ? NULL : fg_list_front(&unique_daemons);
 	while (node) {
 		if (sigint_caught)
 			return;
@@ -1277,6 +1624,8 @@ static void start_all_flows(xmlrpc_client *rpc_client)
 		}
 		gettime(&lastreport_begin);
 		fetch_reports(rpc_client);
+		if (time_diff_now(&clocks_updated) >= CLOCK_UPDATE_INTERVAL)
+			update_clocks(rpc_client);
 		gettime(&lastreport_end);
 
 		/* All flows have ended */
@@ -1359,17 +1708,26 @@ has_more_reports:
 				int tcpi_snd_mss;
 				int bytes_read_low, bytes_read_high;
 				int bytes_written_low, bytes_written_high;
+				int bytes_discarded_low, bytes_discarded_high;
 
 				xmlrpc_decompose_value(&rpc_env, rv,
 					"("
 					"{s:i,s:i,s:i,s:i,s:i,s:i,s:i,*}" /* Report data & timeval */
-					"{s:i,s:i,s:i,s:i,*}" /* bytes */
-					"{s:i,s:i,s:i,s:i,*}" /* blocks */
+					"{s:i,s:i,s:i,s:i,s:i,s:i,*}" /* bytes */
+					"{s:i,s:i,s:i,s:i,s:i,*}" /* blocks */
 					"{s:d,s:d,s:d,s:d,s:d,s:d,s:d,s:d,s:d,*}" /* RTT, IAT, Delay */
+					"{s:d,s:d,s:d,s:d,*}" /* from schedule */
+					"{s:i,s:i,s:d,s:d,s:d,s:d,s:d,s:d,*}" /* kernel timestamps */
+					"{s:d,s:d,*}" /* clock offset */
+					"{s:d,*}" /* start error */
+					"{s:i,s:d,s:d,s:d,s:i,s:d,s:d,s:d,s:i,s:d,s:d,s:d,*}" /* transmit stages */
 					"{s:i,s:i,*}" /* MTU */
 					"{s:i,s:i,s:i,s:i,s:i,*}" /* TCP info */
 					"{s:i,s:i,s:i,s:i,s:i,*}" /* ...      */
 					"{s:i,s:i,s:i,s:i,s:i,*}" /* ...      */
+					"{s:i,s:i,*}" /* zerocopy */
+					"{s:i,s:i,s:i,*}" /* scheduling */
+					"{s:i,s:i,s:d,s:d,s:d,s:i,s:i,*}" /* connections */
 					"{s:i,*}"
 					")",
 
@@ -1385,11 +1743,14 @@ has_more_reports:
 					"bytes_read_low", &bytes_read_low,
 					"bytes_written_high", &bytes_written_high,
 					"bytes_written_low", &bytes_written_low,
+					"bytes_discarded_high", &bytes_discarded_high,
+					"bytes_discarded_low", &bytes_discarded_low,
 
 					"request_blocks_read", &report.request_blocks_read,
 					"request_blocks_written", &report.request_blocks_written,
 					"response_blocks_read", &report.response_blocks_read,
 					"response_blocks_written", &report.response_blocks_written,
+					"iat_samples", &report.iat_samples,
 
 					"rtt_min", &report.rtt_min,
 					"rtt_max", &report.rtt_max,
@@ -1400,6 +1761,33 @@ has_more_reports:
 					"delay_min", &report.delay_min,
 					"delay_max", &report.delay_max,
 					"delay_sum", &report.delay_sum,
+					"sched_delay_max", &report.sched_delay_max,
+					"sched_delay_sum", &report.sched_delay_sum,
+					"sched_rtt_max", &report.sched_rtt_max,
+					"sched_rtt_sum", &report.sched_rtt_sum,
+					"kernel_blocks", &report.kernel_blocks,
+					"kernel_iat_samples", &report.kernel_iat_samples,
+					"kernel_iat_min", &report.kernel_iat_min,
+					"kernel_iat_max", &report.kernel_iat_max,
+					"kernel_iat_sum", &report.kernel_iat_sum,
+					"kernel_delay_min", &report.kernel_delay_min,
+					"kernel_delay_max", &report.kernel_delay_max,
+					"kernel_delay_sum", &report.kernel_delay_sum,
+					"clock_offset", &report.clock_offset,
+					"clock_error", &report.clock_error,
+					"start_error", &report.start_error,
+					"tx_sndbuf_samples", &report.tx_samples[TX_SNDBUF],
+					"tx_sndbuf_min", &report.tx_min[TX_SNDBUF],
+					"tx_sndbuf_max", &report.tx_max[TX_SNDBUF],
+					"tx_sndbuf_sum", &report.tx_sum[TX_SNDBUF],
+					"tx_qdisc_samples", &report.tx_samples[TX_QDISC],
+					"tx_qdisc_min", &report.tx_min[TX_QDISC],
+					"tx_qdisc_max", &report.tx_max[TX_QDISC],
+					"tx_qdisc_sum", &report.tx_sum[TX_QDISC],
+					"tx_ack_samples", &report.tx_samples[TX_ACK],
+					"tx_ack_min", &report.tx_min[TX_ACK],
+					"tx_ack_max", &report.tx_max[TX_ACK],
+					"tx_ack_sum", &report.tx_sum[TX_ACK],
 
 					"pmtu", &report.pmtu,
 					"imtu", &report.imtu,
@@ -1422,15 +1810,30 @@ has_more_reports:
 					"tcpi_ca_state", &tcpi_ca_state,
 					"tcpi_snd_mss", &tcpi_snd_mss,
 
+					"zerocopy_sends", &report.zerocopy_sends,
+					"zerocopy_copied", &report.zerocopy_copied,
+					"wakeups", &report.wakeups,
+					"budget_exhausted", &report.budget_exhausted,
+					"response_blocks_pending", &report.response_blocks_pending,
+					"connects", &report.connects,
+					"connect_failures", &report.connect_failures,
+					"connect_time_min", &report.connect_time_min,
+					"connect_time_max", &report.connect_time_max,
+					"connect_time_sum", &report.connect_time_sum,
+					"time_wait", &report.time_wait,
+					"connections", &report.connections,
+
 					"status", &report.status
 				);
 				xmlrpc_DECREF(rv);
 #ifdef HAVE_UNSIGNED_LONG_LONG_INT
 				report.bytes_read = ((long long)bytes_read_high << 32) + (uint32_t)bytes_read_low;
 				report.bytes_written = ((long long)bytes_written_high << 32) + (uint32_t)bytes_written_low;
+				report.bytes_discarded = ((long long)bytes_discarded_high << 32) + (uint32_t)bytes_discarded_low;
 #else /* HAVE_UNSIGNED_LONG_LONG_INT */
 				report.bytes_read = (uint32_t)bytes_read_low;
 				report.bytes_written = (uint32_t)bytes_written_low;
+				report.bytes_discarded = (uint32_t)bytes_discarded_low;
 #endif /* HAVE_UNSIGNED_LONG_LONG_INT */
 
 				/* FIXME Kernel metrics (tcp_info). Other OS than
@@ -1827,9 +2230,8 @@ static void print_interval_report(unsigned short flow_id, enum endpoint_t e,
 
 	/* IAT */
 	double iat_avg = 0.0;
-	if (report->request_blocks_read && report->iat_sum)
-		iat_avg = report->iat_sum /
-			  (double)(report->request_blocks_read);
+	if (report->iat_samples && report->iat_sum)
+		iat_avg = report->iat_sum / (double)(report->iat_samples);
 	else
 		report->iat_min = report->iat_max = iat_avg = INFINITY;
 	changed |= print_column(&header1, &header2, &data, COL_IAT_MIN,
@@ -2097,12 +2499,44 @@ static void print_final_report(unsigned short flow_id, enum endpoint_t e)
 		asprintf_append(&buf, "through = " "%.6f/%.6f [Mbit/s] (out/in)",
 				thruput_write, thruput_read);
 
+	/* Synchronized start */
+	if (report->start_error)
+		asprintf_append(&buf, ", start error = %.3f [ms]",
+				report->start_error * 1e3);
+
 	/* Transactions */
 	double trans = report->response_blocks_read / MAX(real_read, real_write);
 	if (isnan(trans))
 		trans = 0.0;
 	if (trans)
 		asprintf_append(&buf, ", transactions/s = %.2f [#]", trans);
+	if (settings->pipeline)
+		asprintf_append(&buf, ", pipeline depth = %d [#]",
+				settings->pipeline);
+
+	/* Connections */
+	if (settings->crr) {
+		asprintf_append(&buf, ", connects/s = %.2f [#]",
+				report_time > 0 ? report->connects / report_time
+						: 0.0);
+		if (report->connects && e == SOURCE)
+			asprintf_append(&buf, ", connect = %.3f/%.3f/%.3f [ms] "
+					"(min/avg/max)",
+					report->connect_time_min * 1e3,
+					report->connect_time_sum * 1e3 /
+					(double)report->connects,
+					report->connect_time_max * 1e3);
+		if (report->connect_failures)
+			asprintf_append(&buf, ", connect failures = %u",
+					report->connect_failures);
+		if (report->time_wait >= 0)
+			asprintf_append(&buf, ", TIME_WAIT = %d [#]",
+					report->time_wait);
+	}
+
+	if (settings->connections > 1)
+		asprintf_append(&buf, ", connections = %u/%d [#] (open/req)",
+				report->connections, settings->connections);
 
 	/* Blocks */
 	if (report->request_blocks_written || report->request_blocks_read)
@@ -2121,12 +2555,19 @@ static void print_final_report(unsigned short flow_id, enum endpoint_t e)
 		asprintf_append(&buf, ", RTT = %.3f/%.3f/%.3f [ms] (min/avg/max)",
 				report->rtt_min * 1e3, rtt_avg * 1e3,
 				report->rtt_max * 1e3);
+		/* Only paced blocks can be sent later than due */
+		if (report->sched_rtt_sum > report->rtt_sum)
+			asprintf_append(&buf, ", RTT from schedule = "
+					"%.3f/%.3f [ms] (avg/max)",
+					report->sched_rtt_sum * 1e3 /
+					(double)(report->response_blocks_read),
+					report->sched_rtt_max * 1e3);
 	}
 
 	/* IAT */
-	if (report->request_blocks_read) {
+	if (report->iat_samples) {
 		double iat_avg = report->iat_sum /
-				 (double)(report->request_blocks_read);
+				 (double)(report->iat_samples);
 		asprintf_append(&buf, ", IAT = %.3f/%.3f/%.3f [ms] (min/avg/max)",
 				report->iat_min * 1e3, iat_avg * 1e3,
 				report->iat_max * 1e3);
@@ -2139,8 +2580,49 @@ static void print_final_report(unsigned short flow_id, enum endpoint_t e)
 		asprintf_append(&buf, ", delay = %.3f/%.3f/%.3f [ms] (min/avg/max)",
 				report->delay_min * 1e3, delay_avg * 1e3,
 				report->delay_max * 1e3);
+		if (report->clock_error)
+			asprintf_append(&buf, ", clock offset = %.3f +/- %.3f "
+					"[ms]", report->clock_offset * 1e3,
+					report->clock_error * 1e3);
+		if (report->sched_delay_sum > report->delay_sum)
+			asprintf_append(&buf, ", delay from schedule = "
+					"%.3f/%.3f [ms] (avg/max)",
+					report->sched_delay_sum * 1e3 /
+					(double)(report->request_blocks_read),
+					report->sched_delay_max * 1e3);
 	}
 
+	/* Arrival by the kernel receive timestamps */
+	if (report->kernel_blocks) {
+		double delay_avg = report->kernel_delay_sum /
+				   (double)(report->kernel_blocks);
+		if (report->kernel_iat_samples)
+			asprintf_append(&buf, ", kernel IAT = %.3f/%.3f/%.3f "
+					"[ms] (min/avg/max)",
+					report->kernel_iat_min * 1e3,
+					report->kernel_iat_sum * 1e3 /
+					(double)(report->kernel_iat_samples),
+					report->kernel_iat_max * 1e3);
+		asprintf_append(&buf, ", kernel delay = %.3f/%.3f/%.3f [ms] "
+				"(min/avg/max)", report->kernel_delay_min * 1e3,
+				delay_avg * 1e3, report->kernel_delay_max * 1e3);
+	}
+
+	/* Transmit stages of the sampled blocks */
+	const char *stages[TX_STAGES] = {
+		[TX_SNDBUF] = "send buffer",
+		[TX_QDISC] = "qdisc",
+		[TX_ACK] = "until ACK",
+	};
+	for (int stage = 0; stage < TX_STAGES; stage++)
+		if (report->tx_samples[stage])
+			asprintf_append(&buf, ", %s = %.3f/%.3f/%.3f [ms] "
+					"(min/avg/max)", stages[stage],
+					report->tx_min[stage] * 1e3,
+					report->tx_sum[stage] * 1e3 /
+					(double)report->tx_samples[stage],
+					report->tx_max[stage] * 1e3);
+
 	/* Fixed sending rate per second was set */
 	if (settings->write_rate_str)
 		asprintf_append(&buf, ", rate = %s", settings->write_rate_str);
@@ -2158,12 +2640,59 @@ static void print_final_report(unsigned short flow_id, enum endpoint_t e)
 		asprintf_append(&buf, ", TCP_MTCP");
 	if (settings->dscp)
 		asprintf_append(&buf, ", dscp = 0x%02x", settings->dscp);
+	if (settings->zerocopy)
+		asprintf_append(&buf, ", SO_ZEROCOPY (%u of %u sends copied)",
+				report->zerocopy_copied,
+				report->zerocopy_sends);
+	if (settings->zerocopy_receive)
+		asprintf_append(&buf, ", TCP_ZEROCOPY_RECEIVE");
+	if (settings->timestamping)
+		asprintf_append(&buf, ", SO_TIMESTAMPING (%u of %u blocks "
+				"stamped)", report->kernel_blocks,
+				report->request_blocks_read);
+	if (settings->tx_timestamps)
+		asprintf_append(&buf, ", transmit timestamps (%g%% of blocks "
+				"sampled)", settings->tx_timestamps * 100);
+	if (settings->discard)
+		asprintf_append(&buf, ", discarded = %.0f [B]",
+				(double)report->bytes_discarded);
+	if (*settings->payload_file)
+		asprintf_append(&buf, ", payload from %s",
+				settings->payload_file);
+	if (settings->msg_more == MSG_MORE_BURST)
+		asprintf_append(&buf, ", MSG_MORE (flushed per burst)");
+	else if (settings->msg_more)
+		asprintf_append(&buf, ", MSG_MORE (flushed every %d blocks)",
+				settings->msg_more);
+	if (settings->notsent_lowat)
+		asprintf_append(&buf, ", TCP_NOTSENT_LOWAT = %d [B]",
+				settings->notsent_lowat);
+	if (settings->rcvlowat)
+		asprintf_append(&buf, ", SO_RCVLOWAT = %d [B]",
+				settings->rcvlowat);
+	if (report_time > 0)
+		asprintf_append(&buf, ", wakeups = %.0f/s",
+				report->wakeups / report_time);
+	if (report->response_blocks_pending)
+		asprintf_append(&buf, ", %u response blocks pending",
+				report->response_blocks_pending);
+	if (settings->budget)
+		asprintf_append(&buf, ", budget = %d %s (used up %u times)",
+				settings->budget,
+				settings->budget_blocks ? "blocks" : "[B]",
+				report->budget_exhausted);
 
 	/* Other flow options */
 	if (cflow[flow_id].late_connect)
 		asprintf_append(&buf, ", late connecting");
 	if (cflow[flow_id].shutdown)
 		asprintf_append(&buf, ", calling shutdown");
+	if (settings->crr == CRR_FASTOPEN)
+		asprintf_append(&buf, ", CRR with TCP Fast Open");
+	else if (settings->crr)
+		asprintf_append(&buf, ", CRR");
+	if (settings->shared_listener)
+		asprintf_append(&buf, ", shared listener");
 
 out:
 	print_output("%s\n", buf);
@@ -2482,6 +3011,8 @@ static void parse_flow_option_endpoint(int code, const char* arg,
 {
 	int optint = 0;
 	double optdouble = 0.0;
+	char suffix[7] = "";
+	int rc = 0;
 
 	struct flow_settings* settings = &cflow[flow_id].settings[endpoint_id];
 
@@ -2547,6 +3078,12 @@ static void parse_flow_option_endpoint(int code, const char* arg,
 			strcpy(settings->cc_alg, arg + 15);
 		} else if (!strcmp(arg, "SO_DEBUG")) {
 			settings->so_debug = 1;
+		} else if (!strcmp(arg, "SO_ZEROCOPY")) {
+			settings->zerocopy = 1;
+		} else if (!strcmp(arg, "TCP_ZEROCOPY_RECEIVE")) {
+			settings->zerocopy_receive = 1;
+		} else if (!strcmp(arg, "SO_TIMESTAMPING")) {
+			settings->timestamping = 1;
 		} else if (!strcmp(arg, "IP_MTU_DISCOVER")) {
 			settings->ipmtudiscover = 1;
 		} else {
@@ -2603,6 +3140,70 @@ static void parse_flow_option_endpoint(int code, const char* arg,
 				  flow_id, opt_string);
 		settings->delay[WRITE] = optdouble;
 		break;
+	case CPU_OPTION:
+		if (sscanf(arg, "%d", &optint) != 1 || optint < 0)
+			PARSE_ERR("in flow %i: option %s needs non-negative "
+				  "integer", flow_id, opt_string);
+		settings->cpu = optint;
+		break;
+	case DISCARD_OPTION:
+		settings->discard = 1;
+		break;
+	case PAYLOAD_FILE_OPTION:
+		if (!*arg || strlen(arg) >= sizeof(settings->payload_file))
+			PARSE_ERR("in flow %i: option %s needs a file name "
+				  "shorter than %zu characters", flow_id,
+				  opt_string, sizeof(settings->payload_file));
+		strcpy(settings->payload_file, arg);
+		break;
+	case NOTSENT_LOWAT_OPTION:
+		if (sscanf(arg, "%d", &optint) != 1 || optint <= 0)
+			PARSE_ERR("in flow %i: option %s needs positive "
+				  "integer", flow_id, opt_string);
+		settings->notsent_lowat = optint;
+		break;
+	case BUDGET_OPTION:
+		rc = sscanf(arg, "%d%6s", &optint, suffix);
+		if (rc < 1 || optint <= 0 ||
+		    (rc == 2 && strcmp(suffix, "blocks")))
+			PARSE_ERR("in flow %i: option %s needs positive "
+				  "integer, optionally followed by 'blocks'",
+				  flow_id, opt_string);
+		settings->budget = optint;
+		settings->budget_blocks = (rc == 2);
+		break;
+	case PIPELINE_OPTION:
+		if (sscanf(arg, "%d", &optint) != 1 || optint <= 0)
+			PARSE_ERR("in flow %i: option %s needs positive "
+				  "integer", flow_id, opt_string);
+		settings->pipeline = optint;
+		break;
+	case RCVLOWAT_OPTION:
+		if (!strcmp(arg, "block"))
+			settings->rcvlowat = RCVLOWAT_BLOCK;
+		else if (sscanf(arg, "%d", &optint) == 1 && optint > 0)
+			settings->rcvlowat = optint;
+		else
+			PARSE_ERR("in flow %i: option %s needs positive "
+				  "integer or 'block'", flow_id, opt_string);
+		break;
+	case MSG_MORE_OPTION:
+		if (!strcmp(arg, "burst"))
+			settings->msg_more = MSG_MORE_BURST;
+		else if (sscanf(arg, "%d", &optint) == 1 && optint > 0)
+			settings->msg_more = optint;
+		else
+			PARSE_ERR("in flow %i: option %s needs positive "
+				  "integer or 'burst'", flow_id, opt_string);
+		break;
+	case TX_TIMESTAMPS_OPTION:
+		if (sscanf(arg, "%lf", &optdouble) != 1 || optdouble <= 0 ||
+		    optdouble > 1)
+			PARSE_ERR("in flow %i: option %s needs a share of "
+				  "blocks greater than 0 and at most 1",
+				  flow_id, opt_string);
+		settings->tx_timestamps = optdouble;
+		break;
 	}
 }
 
@@ -2618,6 +3219,7 @@ static void parse_flow_option(int code, const char* arg, const char* opt_string,
 			      int flow_id)
 {
 	unsigned optunsigned = 0;
+	int optint = 0;
 
 	switch (code) {
 	/* flow options w/o endpoint identifier */
@@ -2626,6 +3228,7 @@ static void parse_flow_option(int code, const char* arg, const char* opt_string,
 		break;
 	case 'I':
 		SHOW_COLUMNS(COL_DLY_MIN, COL_DLY_AVG, COL_DLY_MAX);
+		cflow[flow_id].one_way_delay = 1;
 		break;
 	case 'J':
 		if (sscanf(arg, "%u", &optunsigned) != 1)
@@ -2642,6 +3245,30 @@ static void parse_flow_option(int code, const char* arg, const char* opt_string,
 	case 'Q':
 		cflow[flow_id].summarize_only = 1;
 		break;
+	case CRR_OPTION:
+		if (!arg || !strcmp(arg, "plain"))
+			optint = CRR_PLAIN;
+		else if (!strcmp(arg, "tfo"))
+			optint = CRR_FASTOPEN;
+		else
+			PARSE_ERR("option %s needs 'plain' or 'tfo' as argument",
+				  opt_string);
+		cflow[flow_id].settings[SOURCE].crr = optint;
+		cflow[flow_id].settings[DESTINATION].crr = optint;
+		break;
+	case CONNECTIONS_OPTION:
+		if (sscanf(arg, "%d", &optint) != 1 || optint < 1 ||
+		    optint > MAX_CONNECTIONS)
+			PARSE_ERR("option %s needs a number of connections "
+				  "between 1 and %d", opt_string,
+				  MAX_CONNECTIONS);
+		cflow[flow_id].settings[SOURCE].connections = optint;
+		cflow[flow_id].settings[DESTINATION].connections = optint;
+		break;
+	case SHARED_LISTENER_OPTION:
+		cflow[flow_id].settings[SOURCE].shared_listener = 1;
+		cflow[flow_id].settings[DESTINATION].shared_listener = 1;
+		break;
 	}
 }
 
@@ -2927,6 +3554,18 @@ static void parse_cmdline(int argc, char *argv[])
 		{'U', 0, ap_yes, OPT_FLOW_ENDPOINT, 0},
 		{'W', 0, ap_yes, OPT_FLOW_ENDPOINT, 0},
 		{'Y', 0, ap_yes, OPT_FLOW_ENDPOINT, 0},
+		{CPU_OPTION, "cpu", ap_yes, OPT_FLOW_ENDPOINT, 0},
+		{DISCARD_OPTION, "discard", ap_yes, OPT_FLOW_ENDPOINT, 0},
+		{PAYLOAD_FILE_OPTION, "payload-file", ap_yes, OPT_FLOW_ENDPOINT, 0},
+		{MSG_MORE_OPTION, "msg-more", ap_yes, OPT_FLOW_ENDPOINT, 0},
+		{NOTSENT_LOWAT_OPTION, "notsent-lowat", ap_yes, OPT_FLOW_ENDPOINT, 0},
+		{RCVLOWAT_OPTION, "rcvlowat", ap_yes, OPT_FLOW_ENDPOINT, 0},
+		{BUDGET_OPTION, "budget", ap_yes, OPT_FLOW_ENDPOINT, 0},
+		{PIPELINE_OPTION, "pipeline", ap_yes, OPT_FLOW_ENDPOINT, 0},
+		{TX_TIMESTAMPS_OPTION, "tx-timestamps", ap_yes, OPT_FLOW_ENDPOINT, 0},
+		{CRR_OPTION, "crr", ap_maybe, OPT_FLOW, 0},
+		{CONNECTIONS_OPTION, "connections", ap_yes, OPT_FLOW, 0},
+		{SHARED_LISTENER_OPTION, "shared-listener", ap_no, OPT_FLOW, 0},
 		{0, 0, ap_no, 0, 0}
 	};
 
@@ -3056,6 +3695,41 @@ static void parse_cmdline(int argc, char *argv[])
 		ap_free_mutex_state(&ms[*i]);
 }
 
+/**
+ * Determine the size of the blocks endpoint @p e of flow @p id receives.
+ *
+ * These are the request blocks of the other endpoint and the response blocks
+ * to its own requests.
+ *
+ * @param[in] id ID of the flow
+ * @param[in] e endpoint receiving the blocks
+ * @return size of the smallest block received, 0 if it is not constant
+ */
+static int received_block_size(int id, enum endpoint_t e)
+{
+	const struct flow_settings *own = &cflow[id].settings[e];
+	const struct flow_settings *peer =
+		&cflow[id].settings[e == SOURCE ? DESTINATION : SOURCE];
+	int size = 0;
+
+	if (peer->duration[WRITE]) {
+		if (peer->request_trafgen_options.distribution != CONSTANT)
+			return 0;
+		size = MAX(MIN_BLOCK_SIZE,
+			   (int)peer->request_trafgen_options.param_one);
+	}
+	if (own->duration[WRITE] &&
+	    own->response_trafgen_options.param_one) {
+		if (own->response_trafgen_options.distribution != CONSTANT)
+			return 0;
+		int response = MAX(MIN_BLOCK_SIZE,
+				   (int)own->response_trafgen_options.param_one);
+		size = size ? MIN(size, response) : response;
+	}
+
+	return size;
+}
+
 /**
  * Sanity checking flow options.
  */
@@ -3103,6 +3777,79 @@ static void sanity_check(void)
 				      "specified rate", id);
 				exit(EXIT_FAILURE);
 			}
+
+			if (cflow[id].settings[*i].rcvlowat == RCVLOWAT_BLOCK) {
+				cflow[id].settings[*i].rcvlowat =
+					received_block_size(id, *i);
+				if (!cflow[id].settings[*i].rcvlowat) {
+					errx("flow %d receives blocks of "
+					     "varying size, --rcvlowat needs a "
+					     "size", id);
+					exit(EXIT_FAILURE);
+				}
+			}
+
+			if (cflow[id].settings[*i].pipeline &&
+			    cflow[id].settings[*i].duration[WRITE] &&
+			    !cflow[id].settings[*i].response_trafgen_options.param_one) {
+				errx("flow %d has a pipeline depth but requests "
+				     "no responses", id);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		/* Each connection carries one request and its response */
+		if (cflow[id].settings[SOURCE].crr) {
+			if (cflow[id].settings[DESTINATION].duration[WRITE]) {
+				errx("flow %d cannot be bidirectional in CRR "
+				     "mode", id);
+				exit(EXIT_FAILURE);
+			}
+			struct trafgen_options *response =
+				&cflow[id].settings[SOURCE].response_trafgen_options;
+			if (!response->param_one) {
+				response->distribution = CONSTANT;
+				response->param_one = MIN_BLOCK_SIZE;
+			}
+		}
+
+		/* All connections of a flow are established up front */
+		if (cflow[id].settings[SOURCE].connections > 1) {
+			if (cflow[id].settings[SOURCE].crr ||
+			    cflow[id].late_connect) {
+				errx("flow %d cannot have many connections in "
+				     "CRR mode or with late connect", id);
+				exit(EXIT_FAILURE);
+			}
+			foreach(int *i, SOURCE, DESTINATION)
+				if (cflow[id].settings[*i].msg_more) {
+					errx("flow %d cannot have many "
+					     "connections with MSG_MORE", id);
+					exit(EXIT_FAILURE);
+				}
+		}
+
+		/* The timestamps are keyed by the offset in the stream of a
+		 * single connection */
+		foreach(int *i, SOURCE, DESTINATION)
+			if (cflow[id].settings[*i].tx_timestamps &&
+			    (cflow[id].settings[SOURCE].crr ||
+			     cflow[id].settings[SOURCE].connections > 1 ||
+			     cflow[id].settings[*i].zerocopy ||
+			     *cflow[id].settings[*i].payload_file)) {
+				errx("flow %d cannot take transmit timestamps "
+				     "in CRR mode, with many connections, "
+				     "zerocopy or a payload file", id);
+				exit(EXIT_FAILURE);
+			}
+
+		/* Only the first connection of a flow is named by its hello */
+		if (cflow[id].settings[SOURCE].shared_listener &&
+		    (cflow[id].settings[SOURCE].crr ||
+		     cflow[id].settings[SOURCE].connections > 1)) {
+			errx("flow %d cannot use a shared listener in CRR mode "
+			     "or with many connections", id);
+			exit(EXIT_FAILURE);
 		}
 		DEBUG_MSG(LOG_DEBUG, "sanity check parameter set of flow %d completed", id);
 	}
@@ -3148,6 +3895,10 @@ int main(int argc, char *argv[])
 	if (!sigint_caught)
 		prepare_all_flows(rpc_client);
 
+	DEBUG_MSG(LOG_WARNING, "estimate clock offsets");
+	if (!sigint_caught)
+		update_clocks(rpc_client);
+
 	DEBUG_MSG(LOG_WARNING, "print headline");
 	if (!sigint_caught)
 		print_headline();
@@ -49,6 +49,18 @@
 /** Number of emited reports before interval header is printed again. */
 #define MAX_REPORTS_IN_ROW 25
 
+/** Number of probes of the clock of a daemon per estimate of its offset. */
+#define CLOCK_PROBES 8
+
+/** Minimal time between two estimates of the clock offsets, in seconds. */
+#define CLOCK_UPDATE_INTERVAL 1.0
+
+/** Minimal time between arming the daemons and their start, in seconds. */
+#define START_MARGIN 0.1
+
+/** Round trips to a daemon the arming of its flows is allowed to take. */
+#define START_ARM_ROUND_TRIPS 4
+
 /** Transport protocols. */
 enum protocol_t {
 	/** Transmission Control Protocol. */
@@ -172,6 +184,30 @@ enum mutex_context_t {
 enum long_opt_only {
 	/** Pseudo short option for option --log-file. */
 	LOG_FILE_OPTION = CHAR_MAX + 1,
+	/** Pseudo short option for flow option --cpu. */
+	CPU_OPTION,
+	/** Pseudo short option for flow option --discard. */
+	DISCARD_OPTION,
+	/** Pseudo short option for flow option --payload-file. */
+	PAYLOAD_FILE_OPTION,
+	/** Pseudo short option for flow option --msg-more. */
+	MSG_MORE_OPTION,
+	/** Pseudo short option for flow option --notsent-lowat. */
+	NOTSENT_LOWAT_OPTION,
+	/** Pseudo short option for flow option --rcvlowat. */
+	RCVLOWAT_OPTION,
+	/** Pseudo short option for flow option --budget. */
+	BUDGET_OPTION,
+	/** Pseudo short option for flow option --pipeline. */
+	PIPELINE_OPTION,
+	/** Pseudo short option for flow option --tx-timestamps. */
+	TX_TIMESTAMPS_OPTION,
+	/** Pseudo short option for flow option --crr. */
+	CRR_OPTION,
+	/** Pseudo short option for flow option --connections. */
+	CONNECTIONS_OPTION,
+	/** Pseudo short option for flow option --shared-listener. */
+	SHARED_LISTENER_OPTION,
 };
 
 /** Controller options. */
@@ -196,6 +232,34 @@ struct controller_options {
 	enum tcp_stack_t force_unit;
 };
 
+/**
+ * Estimate of the offset of the wall clock of a daemon to the one of the
+ * controller.
+ *
+ * Like NTP, the clock of the daemon is assumed to be read in the middle of the
+ * round trip of a probe, which bounds the error of the offset by half the round
+ * trip time. The drift is measured against the first estimate.
+ */
+struct clock_estimate {
+	/** The offset has been estimated at least once. */
+	bool valid;
+	/** Offset at @p probed, in seconds. Positive if the clock of the
+	 * daemon is ahead. */
+	double offset;
+	/** Error bound of @p offset, in seconds. */
+	double error;
+	/** Drift of the offset, in seconds per second. */
+	double drift;
+	/** Point in time of the controller the offset was estimated at. */
+	struct timespec probed;
+	/** Offset of the first estimate. */
+	double first_offset;
+	/** Error bound of the first estimate. */
+	double first_error;
+	/** Point in time of the controller the first estimate was taken. */
+	struct timespec first_probed;
+};
+
 /** Infos about a flowgrind daemon. */
 struct daemon {
 /* Note: a daemon can potentially managing multiple flows */
@@ -209,6 +273,8 @@ struct daemon {
 	char os_release[257];
 	/** Pointer to daemon XMLPRC URL. */
 	char *url;
+	/** Offset of the clock of the daemon to the one of the controller. */
+	struct clock_estimate clock;
 };
 
 /** Infos about a flowgrind daemon and daemon-controller connection. */
@@ -252,6 +318,9 @@ struct cflow {
 	char summarize_only;
 	/** Enumerate bytes in payload instead of sending zeros (option -E). */
 	char byte_counting;
+	/** Correct the one-way delay by the estimated offset of the clocks
+	 * of the daemons (option -I). */
+	char one_way_delay;
 	/** Random seed for stochastic traffic generation (option -J). */
 	unsigned random_seed;
 
@@ -51,6 +51,7 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 
 /* xmlrpc-c */
 #include <xmlrpc-c/base.h>
@@ -71,6 +72,7 @@
 #include "debug.h"
 #include "fg_argparser.h"
 #include "fg_rpc_server.h"
+#include "fg_listener.h"
 
 #ifdef HAVE_LIBPCAP
 #include "fg_pcap.h"
@@ -97,8 +99,14 @@ static unsigned port = DEFAULT_LISTEN_PORT;
 /* XXX add a brief description doxygen */
 static char *rpc_bind_addr = NULL;
 
-/** CPU core to which flowgrindd should bind to. */
-static int core;
+/** CPU cores to which the daemon worker threads should bind to (option -c). */
+static int *cores = NULL;
+
+/** Number of CPU cores given by option -c. */
+static unsigned num_cores = 0;
+
+/** Number of daemon worker threads (option -t). */
+static unsigned num_threads = 0;
 
 /** Command line option parser. */
 static struct arg_parser parser;
@@ -129,7 +137,8 @@ static void usage(short status)
 
 		"Mandatory arguments to long options are mandatory for short options too.\n"
 		"  -b ADDR        XML-RPC server bind address\n"
-		"  -c #           bound daemon to specific CPU. First CPU is 0\n"
+		"  -c #[,#]...    bind daemon worker threads to specific CPUs. Worker threads\n"
+		"                 are assigned to the given CPUs in turn. First CPU is 0\n"
 #ifdef DEBUG
 		"  -d, --debug    increase debugging verbosity. Add option multiple times to\n"
 		"                 increase the verbosity (no daemon, log to stderr)\n"
@@ -137,7 +146,18 @@ static void usage(short status)
 		"  -d             don't fork into background, log to stderr\n"
 #endif /* DEBUG */
 		"  -h, --help     display this help and exit\n"
+		"  -l POLICY      place new flows on worker threads by POLICY:\n"
+		"                 rr (round-robin, default) or least (least-loaded)\n"
 		"  -p #           XML-RPC server port\n"
+		"  -s #           port of the listen sockets shared by the destination flows\n"
+		"                 asking for it (default: any free port)\n"
+		"  -t #           number of worker threads, each running its own event loop\n"
+		"                 (default: number of CPUs given by -c, otherwise 1)\n"
+#ifdef HAVE_LIBURING
+		"  -u             use io_uring for the test sockets. Falls back to the default\n"
+		"                 event loop if io_uring is not available\n"
+		"  -U             like -u, but payload is received into registered buffers\n"
+#endif /* HAVE_LIBURING */
 #ifdef HAVE_LIBPCAP
 		"  -w DIR         target directory for dump files. The daemon must be run as root\n"
 #endif /* HAVE_LIBPCAP */
@@ -181,36 +201,107 @@ static void sighandler(int sig)
 	}
 }
 
-void create_daemon_thread()
+/**
+ * Create the daemon worker threads.
+ *
+ * Each worker thread runs its own event loop on its own share of the flows.
+ * If CPU cores are given (option -c), worker threads are bound to them in
+ * turn. If only the number of worker threads is given (option -t), worker
+ * threads are spread over all available CPU cores.
+ */
+static void create_worker_threads(void)
+{
+	int ncores = get_ncores(NCORE_CURRENT);
+
+	if (!num_threads)
+		num_threads = num_cores ? num_cores : 1;
+
+	workers = calloc(num_threads, sizeof(struct worker));
+	if (!workers)
+		critx("could not allocate memory for worker threads");
+	num_workers = num_threads;
+
+	for (unsigned i = 0; i < num_workers; i++) {
+		int core = -1;
+
+		if (num_cores)
+			core = cores[i % num_cores];
+		else if (ap_is_used(&parser, 't') && ncores > 0)
+			core = i % ncores;
+
+		init_worker(&workers[i], i, core);
+	}
+
+	for (unsigned i = 0; i < num_workers; i++) {
+		int rc = pthread_create(&workers[i].thread, NULL, daemon_main,
+					&workers[i]);
+		if (rc)
+			critc(rc, "could not start worker thread %u", i);
+	}
+
+	DEBUG_MSG(LOG_INFO, "started %u worker threads", num_workers);
+}
+
+/**
+ * Parse a comma separated list of CPU cores (option -c).
+ *
+ * @param[in] arg list of CPU cores
+ */
+static void parse_core_list(const char *arg)
 {
-	int flags;
+	char *list = strdup(arg);
+	char *saveptr = NULL;
+
+	if (!list)
+		critx("could not allocate memory for CPU list");
 
-	if (pipe(daemon_pipe) == -1)
-		crit("could not create pipe");
+	for (char *tok = strtok_r(list, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		int core;
 
-	if ((flags = fcntl(daemon_pipe[0], F_GETFL, 0)) == -1)
-		flags = 0;
-	fcntl(daemon_pipe[0], F_SETFL, flags | O_NONBLOCK);
+		if (sscanf(tok, "%d", &core) != 1)
+			PARSE_ERR("failed to parse CPU number");
 
-	pthread_mutex_init(&mutex, NULL);
+		cores = realloc(cores, (num_cores + 1) * sizeof(int));
+		if (!cores)
+			critx("could not allocate memory for CPU list");
+		cores[num_cores++] = core;
+	}
 
-	int rc = pthread_create(&daemon_thread, NULL, daemon_main, 0);
-	if (rc)
-		critc(rc, "could not start thread");
+	free(list);
+
+	if (!num_cores)
+		PARSE_ERR("failed to parse CPU number");
 }
 
-void bind_daemon_to_core(void)
+#ifdef HAVE_EPOLL
+/**
+ * Raise the soft limit of open files to the hard limit.
+ *
+ * With epoll the number of flows the daemon can handle is only bound by the
+ * number of file descriptors it may open.
+ */
+static void raise_nofile_limit(void)
 {
-	pthread_t thread = pthread_self();
-	int rc = pthread_setaffinity(thread, core);
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == -1) {
+		logging(LOG_WARNING, "getrlimit() failed: %s", strerror(errno));
+		return;
+	}
+
+	if (rl.rlim_cur == rl.rlim_max)
+		return;
 
-	if (rc)
-		logging(LOG_WARNING, "failed to bind %s (PID %d) to CPU core %i",
-			progname, getpid(), core);
+	rl.rlim_cur = rl.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+		logging(LOG_WARNING, "failed to raise limit of open files: "
+			"%s", strerror(errno));
 	else
-		DEBUG_MSG(LOG_INFO, "bind %s (PID %d) to CPU core %i",
-			  progname, getpid(), core);
+		DEBUG_MSG(LOG_INFO, "raised limit of open files to %llu",
+			  (unsigned long long)rl.rlim_cur);
 }
+#endif /* HAVE_EPOLL */
 
 #ifdef HAVE_LIBPCAP
 int process_dump_dir() {
@@ -262,8 +353,15 @@ static void parse_cmdline(int argc, char *argv[])
 		{'d', 0, ap_no, 0, 0},
 #endif
 		{'h', "help", ap_no, 0, 0},
+		{'l', 0, ap_yes, 0, 0},
 		{'o', 0, ap_yes, 0, 0},
 		{'p', 0, ap_yes, 0, 0},
+		{'s', 0, ap_yes, 0, 0},
+		{'t', 0, ap_yes, 0, 0},
+#ifdef HAVE_LIBURING
+		{'u', 0, ap_no, 0, 0},
+		{'U', 0, ap_no, 0, 0},
+#endif /* HAVE_LIBURING */
 		{'v', "version", ap_no, 0, 0},
 #ifdef HAVE_LIBPCAP
 		{'w', 0, ap_yes, 0, 0},
@@ -290,8 +388,7 @@ static void parse_cmdline(int argc, char *argv[])
 				PARSE_ERR("failed to parse bind address");
 			break;
 		case 'c':
-			if (sscanf(arg, "%u", &core) != 1)
-				PARSE_ERR("failed to parse CPU number");
+			parse_core_list(arg);
 			break;
 		case 'd':
 #ifdef DEBUG
@@ -301,10 +398,38 @@ static void parse_cmdline(int argc, char *argv[])
 		case 'h':
 			usage(EXIT_SUCCESS);
 			break;
+		case 'l':
+			if (!strcmp(arg, "rr") || !strcmp(arg, "round-robin"))
+				placement_policy = PLACEMENT_ROUND_ROBIN;
+			else if (!strcmp(arg, "least") ||
+				 !strcmp(arg, "least-loaded"))
+				placement_policy = PLACEMENT_LEAST_LOADED;
+			else
+				PARSE_ERR("unknown placement policy: %s", arg);
+			break;
 		case 'p':
 			if (sscanf(arg, "%u", &port) != 1)
 				PARSE_ERR("failed to parse port number");
 			break;
+		case 's':
+			if (sscanf(arg, "%hu", &shared_listen_port) != 1)
+				PARSE_ERR("failed to parse shared listen port");
+			break;
+		case 't':
+			if (sscanf(arg, "%u", &num_threads) != 1 ||
+			    num_threads < 1)
+				PARSE_ERR("number of worker threads must be "
+					  "positive");
+			break;
+#ifdef HAVE_LIBURING
+		case 'u':
+			use_io_uring = true;
+			break;
+		case 'U':
+			use_io_uring = true;
+			use_registered_buffers = true;
+			break;
+#endif /* HAVE_LIBURING */
 #ifdef HAVE_LIBPCAP
 		case 'w':
 			dump_dir = strdup(arg);
@@ -338,15 +463,17 @@ static void parse_cmdline(int argc, char *argv[])
 
 static void sanity_check(void)
 {
-	if (core < 0) {
-		errx("CPU binding failed. Given CPU ID is negative");
-		exit(EXIT_FAILURE);
-	}
+	for (unsigned i = 0; i < num_cores; i++) {
+		if (cores[i] < 0) {
+			errx("CPU binding failed. Given CPU ID is negative");
+			exit(EXIT_FAILURE);
+		}
 
-	if (core > get_ncores(NCORE_CURRENT)) {
-		errx("CPU binding failed. Given CPU ID is higher then "
-		     "available CPU cores");
-		exit(EXIT_FAILURE);
+		if (cores[i] > get_ncores(NCORE_CURRENT)) {
+			errx("CPU binding failed. Given CPU ID is higher then "
+			     "available CPU cores");
+			exit(EXIT_FAILURE);
+		}
 	}
 
 	/* TODO more sanity checks... (e.g. if port is in valid range) */
@@ -395,7 +522,9 @@ int main(int argc, char *argv[])
 	else
 		init_logging(LOGGING_STDERR);
 
-	fg_list_init(&flows);
+#ifdef HAVE_EPOLL
+	raise_nofile_limit();
+#endif /* HAVE_EPOLL */
 
 #ifdef HAVE_LIBPCAP
 	fg_pcap_init();
@@ -412,10 +541,7 @@ int main(int argc, char *argv[])
 		logging(LOG_NOTICE, "flowgrindd daemonized");
 	}
 
-	if (ap_is_used(&parser, 'c'))
-		bind_daemon_to_core();
-
-	create_daemon_thread();
+	create_worker_threads();
 
 	/* This will block */
 	run_rpc_server(&server);
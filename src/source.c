@@ -59,6 +59,8 @@
 #include "fg_socket.h"
 #include "fg_time.h"
 #include "fg_log.h"
+#include "fg_definitions.h"
+#include "fg_connections.h"
 
 #ifdef HAVE_LIBPCAP
 #include "fg_pcap.h"
@@ -101,6 +103,7 @@ static int name2socket(struct flow *flow, char *server_name, unsigned port, stru
 
 		if (fd < 0)
 			continue;
+#ifndef HAVE_EPOLL
 		/* FIXME: currently we use portable select() API, which
 		 * is limited by the number of bits in an fd_set */
 		if (fd >= FD_SETSIZE) {
@@ -112,6 +115,7 @@ static int name2socket(struct flow *flow, char *server_name, unsigned port, stru
 		        freeaddrinfo(ressave);
 			return -1;
 		}
+#endif /* HAVE_EPOLL */
 
 		if (send_buffer_size)
 			*send_buffer_size = set_window_size_directed(fd, send_buffer_size_req, SO_SNDBUF);
@@ -153,18 +157,105 @@ static int name2socket(struct flow *flow, char *server_name, unsigned port, stru
 int do_connect(struct flow *flow) {
 	int rc;
 
+	/* The SYN carries the request if a Fast Open cookie is cached */
+	if (flow->settings.crr == CRR_FASTOPEN &&
+	    set_tcp_fastopen_connect(flow->fd) == -1) {
+		flow_error(flow, "Unable to set TCP_FASTOPEN_CONNECT: %s",
+			   strerror(errno));
+		return -1;
+	}
+	if (flow->settings.crr)
+		gettime_mono(&flow->crr_connect_start);
+
 	rc = connect(flow->fd, flow->addr, flow->addr_len);
 	if (rc == -1 && errno != EINPROGRESS) {
+		/* A CRR flow retries once local ports are free again */
+		if (flow->settings.crr && errno == EADDRNOTAVAIL)
+			return rc;
 		flow_error(flow, "connect() failed: %s",
 				strerror(errno));
 		err("failed to connect flow %u", flow->id);
 		return rc;
 	}
 	flow->connect_called = 1;
+	flow->crr_connecting = (flow->settings.crr != CRR_NONE);
 	flow->pmtu = get_pmtu(flow->fd);
 	return 0;
 }
 
+/**
+ * Replace the data socket of a source by a new, unconnected one.
+ *
+ * A CRR flow connects the new socket once its next request block is due, a
+ * flow with many connections right away.
+ *
+ * @param[in,out] flow flow whose data socket is replaced
+ * @return 0 on success, -1 on failure with the flow error set
+ */
+int renew_data_socket(struct flow *flow)
+{
+	if (flow->fd != -1) {
+		unwatch_flow(flow);
+		close(flow->fd);
+	}
+	flow->connect_called = 0;
+	flow->crr_connecting = 0;
+
+	flow->fd = socket(flow->addr->sa_family, SOCK_STREAM, IPPROTO_TCP);
+	if (flow->fd == -1) {
+		flow_error(flow, "Could not create data socket: %s",
+			   strerror(errno));
+		return -1;
+	}
+#ifndef HAVE_EPOLL
+	/* FIXME: currently we use portable select() API, which
+	 * is limited by the number of bits in an fd_set */
+	if (flow->fd >= FD_SETSIZE) {
+		flow_error(flow, "Could not create data socket: too many "
+			   "file descriptors in use by this daemon");
+		return -1;
+	}
+#endif /* HAVE_EPOLL */
+
+	set_window_size_directed(flow->fd,
+				 flow->settings.requested_send_buffer_size,
+				 SO_SNDBUF);
+	set_window_size_directed(flow->fd,
+				 flow->settings.requested_read_buffer_size,
+				 SO_RCVBUF);
+	return set_flow_tcp_options(flow);
+}
+
+/**
+ * Establish the connections of a flow with many connections.
+ *
+ * The connection of the data socket created for the flow is the first one.
+ *
+ * @param[in,out] flow flow whose first connection is being established
+ * @return 0 on success, -1 on failure with the flow error set
+ */
+static int add_connections(struct flow *flow)
+{
+#ifdef HAVE_EPOLL
+	if (!flow->conns)
+		return 0;
+
+	if (connections_add(flow, flow->fd) == -1)
+		return -1;
+	while (flow->conns->count < flow->conns->size) {
+		/* The socket is owned by the connections already */
+		flow->fd = -1;
+		if (renew_data_socket(flow) == -1 ||
+		    connections_add(flow, flow->fd) == -1 ||
+		    do_connect(flow) == -1)
+			return -1;
+	}
+#else /* HAVE_EPOLL */
+	UNUSED_ARGUMENT(flow);
+#endif /* HAVE_EPOLL */
+	return 0;
+}
+
 /**
  * To set daemon flow as source endpoint
  *
@@ -172,21 +263,37 @@ int do_connect(struct flow *flow) {
  * late connection option the data connection is established to connect the 
  * destination daemon listening port address with source daemon. 
  *
+ * @param[in,out] worker worker thread the flow is assigned to
  * @param[in,out] request Contain the test option and parameter for daemon source endpoint 
  */
-int add_flow_source(struct request_add_flow_source *request)
+int add_flow_source(struct worker *worker,
+		    struct request_add_flow_source *request)
 {
 #ifdef HAVE_SO_TCP_CONGESTION
 	socklen_t opt_len = 0;
 #endif /* HAVE_SO_TCP_CONGESTION */
 	struct flow *flow;
 
-	if (fg_list_size(&flows) >= MAX_FLOWS_DAEMON) {
+	unsigned num_flows = daemon_num_flows();
+
+	if (num_flows >= MAX_FLOWS_DAEMON) {
 		logging(LOG_WARNING, "can not accept another flow, already "
-			"handling %zu flows", fg_list_size(&flows));
+			"handling %u flows", num_flows);
 		request_error(&request->r,
 			"Can not accept another flow, already "
-			"handling %zu flows.", fg_list_size(&flows));
+			"handling %u flows.", num_flows);
+		return -1;
+	}
+
+	const char *unsupported = unsupported_flow(&request->settings);
+	if (unsupported) {
+		request_error(&request->r, "%s", unsupported);
+		return -1;
+	}
+	if (request->settings.connections > 1 &&
+	    request->source_settings.late_connect) {
+		request_error(&request->r, "flows with many connections are "
+			      "not supported with late connect");
 		return -1;
 	}
 
@@ -197,26 +304,44 @@ int add_flow_source(struct request_add_flow_source *request)
 	}
 
 	init_flow(flow, 1);
+	flow->worker = worker;
 
 	flow->settings = request->settings;
 	flow->source_settings = request->source_settings;
-	/* be greedy with buffer sizes */
-	flow->write_block = calloc(1, flow->settings.maximum_block_size);
-	flow->read_block = calloc(1, flow->settings.maximum_block_size);
+	/* Sent ahead of the data if the destination has a shared listener */
+	flow->hello_left = strlen(flow->source_settings.hello);
+	/* Only the block headers are kept per flow */
+	flow->write_block = calloc(1, MIN_BLOCK_SIZE);
+	flow->read_block = calloc(1, MIN_BLOCK_SIZE);
+	flow->payload = get_shared_payload(flow->settings.maximum_block_size,
+					   flow->settings.byte_counting);
 	/* Controller flow ID is set in the daemon */
 	flow->id = flow->settings.flow_id;
-	if (flow->write_block == NULL || flow->read_block == NULL) {
+	if (flow->write_block == NULL || flow->read_block == NULL ||
+	    flow->payload == NULL) {
 		logging(LOG_ALERT, "could not allocate memory for read/write "
 			"blocks");
 		request_error(&request->r, "could not allocate memory for read/write blocks");
 		uninit_flow(flow);
 		return -1;
 	}
-	if (flow->settings.byte_counting) {
-		int byte_idx;
-		for (byte_idx = 0; byte_idx < flow->settings.maximum_block_size; byte_idx++)
-			*(flow->write_block + byte_idx) = (unsigned char)(byte_idx & 0xff);
+
+	if (open_payload_file(flow) == -1) {
+		logging(LOG_ALERT, "could not open payload file: %s",
+			flow->error);
+		request_error(&request->r, "%s", flow->error);
+		uninit_flow(flow);
+		return -1;
+	}
+
+#ifdef HAVE_EPOLL
+	if (flow->settings.connections > 1 && connections_init(flow) == -1) {
+		request->r.error = flow->error;
+		flow->error = NULL;
+		uninit_flow(flow);
+		return -1;
 	}
+#endif /* HAVE_EPOLL */
 
 	flow->state = GRIND_WAIT_CONNECT;
 	flow->fd = name2socket(flow, flow->source_settings.destination_host,
@@ -253,9 +378,10 @@ int add_flow_source(struct request_add_flow_source *request)
 #ifdef HAVE_LIBPCAP
 	fg_pcap_go(flow);
 #endif /* HAVE_LIBPCAP */
-	if (!flow->source_settings.late_connect) {
+	/* CRR flows connect whenever a request block is due */
+	if (!flow->source_settings.late_connect && !flow->settings.crr) {
 		DEBUG_MSG(4, "(early) connecting test socket (fd=%u)", flow->fd);
-		if (do_connect(flow) == -1) {
+		if (do_connect(flow) == -1 || add_connections(flow) == -1) {
 			request->r.error = flow->error;
 			flow->error = NULL;
 			uninit_flow(flow);
@@ -265,7 +391,13 @@ int add_flow_source(struct request_add_flow_source *request)
 
 	request->flow_id = flow->id;
 
-	fg_list_push_back(&flows, flow);
+	if (add_flow(worker, flow) == -1) {
+		logging(LOG_ALERT, "could not allocate memory for flow");
+		request_error(&request->r, "could not allocate memory for "
+			      "flow");
+		uninit_flow(flow);
+		return -1;
+	}
 
 	return 0;
 }
@@ -32,7 +32,9 @@
 #include "config.h"
 #endif /* HAVE_CONFIG_H */
 
-int add_flow_source(struct request_add_flow_source *request);
+int add_flow_source(struct worker *worker,
+		    struct request_add_flow_source *request);
 int do_connect(struct flow *flow);
+int renew_data_socket(struct flow *flow);
 
 #endif /* _SOURCE_H_ */